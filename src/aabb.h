@@ -44,24 +44,29 @@ class aabb{
             return 2;
         }
 
+        point3 centroid() const{
+            return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+        }
+
+        double surface_area() const{
+            double dx = x.size(), dy = y.size(), dz = z.size();
+            return 2.0 * (dx * dy + dy * dz + dz * dx);
+        }
+
         bool hit (const ray& r, interval ray_t) const{
             const point3& origin = r.origin();
-            const vec3& direction = r.direction();
+            const vec3& inv_dir = r.inv_direction();
 
             for(int axis = 0; axis < 3; axis++){
+                // The direction sign picks which slab plane the ray enters through
                 const interval& ax = axis_interval(axis);
-                const double adinv = 1.0 / direction[axis];
+                bool neg = r.dir_is_neg(axis);
 
-                auto t0 = (ax.min - origin[axis]) * adinv;
-                auto t1 = (ax.max - origin[axis]) * adinv;
+                auto t0 = ((neg ? ax.max : ax.min) - origin[axis]) * inv_dir[axis];
+                auto t1 = ((neg ? ax.min : ax.max) - origin[axis]) * inv_dir[axis];
 
-                if(t0 < t1){
-                    if(t0 > ray_t.min) ray_t.min = t0;
-                    if(t1 < ray_t.max) ray_t.max = t1;
-                } else {
-                    if(t1 > ray_t.min) ray_t.min = t1;
-                    if(t0 < ray_t.max) ray_t.max = t0;
-                }
+                if(t0 > ray_t.min) ray_t.min = t0;
+                if(t1 < ray_t.max) ray_t.max = t1;
 
                 if(ray_t.max <= ray_t.min) return false;
             }
@@ -83,6 +88,18 @@ class aabb{
 const aabb aabb::empty = aabb(interval::empty, interval::empty, interval::empty);
 const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
 
+inline float float_round_down(double x){
+    // Largest float not above x, for bounds that must contain the double precision box
+    float f = float(x);
+    return (double(f) > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float float_round_up(double x){
+    // Smallest float not below x
+    float f = float(x);
+    return (double(f) < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
 aabb operator+(const aabb& bbox, const vec3& offset){
     return aabb(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
 }
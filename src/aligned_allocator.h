@@ -0,0 +1,47 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+template <typename T, size_t Alignment>
+class aligned_allocator {
+    // Allocator for std::vector that aligns storage to Alignment bytes (a power of two), so node
+    // arrays start on cache lines and SIMD loads stay aligned. Needed since std::allocator only
+    // honors over-aligned types from C++17 on.
+    public:
+        using value_type = T;
+
+        template <typename U>
+        struct rebind { using other = aligned_allocator<U, Alignment>; };
+
+        aligned_allocator() {}
+        template <typename U>
+        aligned_allocator(const aligned_allocator<U, Alignment>&) {}
+
+        T* allocate(size_t n){
+            // Over-allocate, then store the original pointer just in front of the aligned block
+            void* raw = ::operator new(n * sizeof(T) + Alignment + sizeof(void*));
+            auto address = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+            address = (address + Alignment - 1) & ~uintptr_t(Alignment - 1);
+            reinterpret_cast<void**>(address)[-1] = raw;
+            return reinterpret_cast<T*>(address);
+        }
+
+        void deallocate(T* p, size_t){
+            if(p) ::operator delete(reinterpret_cast<void**>(p)[-1]);
+        }
+
+        template <typename U>
+        bool operator==(const aligned_allocator<U, Alignment>&) const { return true; }
+        template <typename U>
+        bool operator!=(const aligned_allocator<U, Alignment>&) const { return false; }
+};
+
+// A vector whose storage starts on a 64-byte cache line
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T, 64>>;
+
+#endif // ALIGNED_ALLOCATOR_H
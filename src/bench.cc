@@ -0,0 +1,1806 @@
+// Microbenchmarks for the renderer's hot paths.
+// Usage: raytracer_bench [name...]   (runs every benchmark when no name is given)
+#include "scene_cache.h"
+#include "instance.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start){
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static double run_threads(int threads, const std::function<void(int)>& body){
+    // Runs body(thread_index) on the given number of threads and returns the wall time
+    auto start = bench_clock::now();
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++)
+        workers.emplace_back(body, t);
+    for(auto& w : workers)
+        w.join();
+    return seconds_since(start);
+}
+
+static std::vector<int> thread_counts(){
+    // One thread, then every hardware thread
+    std::vector<int> counts = {1};
+    int n = int(std::thread::hardware_concurrency());
+    if(n > 1) counts.push_back(n);
+    return counts;
+}
+
+// Keeps results alive so the optimizer can't drop the work being timed
+static volatile double bench_sink;
+
+// ---------------------------------------------------------------------------------------------
+// rng: rand() against the thread-local PCG32 behind random_double()
+
+static double rand_double() {
+    // The generator random_double() used before PCG32
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static void bench_rng(){
+    const long samples = 20000000;
+    std::cout << "rng: " << samples << " samples per thread\n";
+
+    for(int threads : thread_counts()){
+        double rand_time = run_threads(threads, [&](int) {
+            double sum = 0;
+            for(long i = 0; i < samples; i++) sum += rand_double();
+            bench_sink = sum;
+        });
+        double pcg_time = run_threads(threads, [&](int t) {
+            seed_random(0, t);
+            double sum = 0;
+            for(long i = 0; i < samples; i++) sum += random_double();
+            bench_sink = sum;
+        });
+
+        double total = double(samples) * threads;
+        std::cout << "  " << std::setw(3) << threads << " thread(s): "
+                  << "rand() " << std::setw(8) << total / rand_time / 1e6 << " M/s, "
+                  << "pcg32 " << std::setw(8) << total / pcg_time / 1e6 << " M/s, "
+                  << "speedup " << rand_time / pcg_time << "x\n";
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// bvh: tree quality and traversal speed of the median and SAH builders
+
+struct bvh_config {
+    const char* name;
+    bvh_options options;
+};
+
+static std::vector<bvh_config> bvh_configs(){
+    bvh_options median;
+    bvh_options sah;
+    sah.split = bvh_split::sah;
+    bvh_options sah_leaf4 = sah;
+    sah_leaf4.max_leaf_size = 4;
+    bvh_options linear = sah_leaf4;
+    linear.layout = bvh_layout::linear;
+    return {{"median", median}, {"sah", sah}, {"sah leaf<=4", sah_leaf4}, {"linear", linear}};
+}
+
+struct scene_entry {
+    // A benchmark scene by name. Scenes that take BVH options are built with the ones make is
+    // given, the others ignore them.
+    const char* name;
+    std::function<scene(const bvh_options&)> build;
+
+    scene_entry(const char* name, scene (*make)(const bvh_options&)) : name(name), build(make) {}
+    scene_entry(const char* name, scene (*make)())
+        : name(name), build([make](const bvh_options&) { return make(); }) {}
+
+    scene make(const bvh_options& options = bvh_options()) const { return build(options); }
+};
+
+static std::vector<scene_entry> bvh_bench_scenes(){
+    // The scenes the BVH benchmarks trace under each build configuration
+    return {
+        {"bouncing_spheres", [](const bvh_options& o) { return bouncing_spheres(o); }},
+        {"final_scene", [](const bvh_options& o) { return final_scene(200, 8, 50, o); }},
+    };
+}
+
+static std::vector<ray> camera_rays(const camera& cam, int count){
+    // Rays from the camera position spread over its field of view, roughly like primary rays
+    std::vector<ray> rays;
+    rays.reserve(count);
+    auto forward = unit_vector(cam.lookat - cam.lookfrom);
+    auto right = unit_vector(cross(forward, cam.vup));
+    auto up = cross(right, forward);
+    auto spread = std::tan(degrees_to_radians(cam.vfov) / 2);
+    for(int i = 0; i < count; i++){
+        auto dir = forward + random_double(-spread, spread) * right + random_double(-spread, spread) * up;
+        rays.push_back(ray(cam.lookfrom, dir, random_double()));
+    }
+    return rays;
+}
+
+static double cast_rays(const hittable& world, const std::vector<ray>& rays){
+    // Returns the closest-hit throughput on one thread in million rays per second
+    auto start = bench_clock::now();
+    int hits = 0;
+    hit_record rec;
+    for(const auto& r : rays)
+        hits += world.hit(r, interval(0.001, infinity), rec);
+    bench_sink = hits;
+    return rays.size() / seconds_since(start) / 1e6;
+}
+
+static void bench_bvh(){
+    struct object_set {
+        const char* name;
+        hittable_list (*make)();
+    };
+    const object_set sets[] = {
+        {"bouncing_spheres", bouncing_spheres_objects},
+        {"final_scene boxes", final_scene_boxes},
+        {"final_scene spheres", final_scene_sphere_cluster},
+    };
+
+    std::cout << "bvh: build and tree quality\n";
+    for(const auto& set : sets){
+        seed_random(0);
+        auto objects = set.make();
+        std::cout << "  " << set.name << " (" << objects.objects.size() << " objects)\n";
+
+        for(const auto& config : bvh_configs()){
+            const int builds = 20;
+            bvh_stats stats;
+            auto start = bench_clock::now();
+            for(int i = 0; i < builds; i++)
+                make_bvh(objects, config.options, &stats);
+            double build_ms = seconds_since(start) * 1000 / builds;
+
+            std::cout << "    " << std::left << std::setw(12) << config.name << std::right
+                      << " build " << std::setw(7) << build_ms << " ms"
+                      << "  nodes " << std::setw(5) << stats.node_count
+                      << "  leaves " << std::setw(5) << stats.leaf_count
+                      << "  depth " << std::setw(3) << stats.max_depth
+                      << "  SAH cost " << std::setw(7) << stats.sah_cost << '\n';
+        }
+    }
+
+    std::cout << "bvh: render time (200 px, 8 spp) and single-thread closest-hit rays\n";
+    const auto scenes = bvh_bench_scenes();
+    for(const auto& entry : scenes){
+        std::cout << "  " << entry.name << '\n';
+        for(const auto& config : bvh_configs()){
+            seed_random(0);
+            auto s = entry.make(config.options);
+            s.cam.image_width = 200;
+            s.cam.samples_per_pixel = 8;
+            s.cam.show_progress = false;
+
+            auto start = bench_clock::now();
+            s.cam.render_image(s.world);
+            double render_time = seconds_since(start);
+
+            seed_random(1);
+            double mrays = cast_rays(s.world, camera_rays(s.cam, 500000));
+            std::cout << "    " << std::left << std::setw(12) << config.name << std::right
+                      << " " << std::setw(7) << render_time << " s  "
+                      << std::setw(7) << mrays << " Mrays/s\n";
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// aabb: box tests with the inverse direction cached in the ray against dividing on every test
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define BENCH_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+    #define BENCH_NOINLINE __declspec(noinline)
+#else
+    #define BENCH_NOINLINE
+#endif
+
+// Both box tests are kept out of line, as they are behind the virtual hit calls of a BVH, so the
+// compiler can't hoist the division out of the benchmark loop
+
+BENCH_NOINLINE static bool aabb_hit_dividing(const aabb& box, const ray& r, interval ray_t){
+    // The slab test as it was before rays carried their inverse direction
+    const point3& origin = r.origin();
+    const vec3& direction = r.direction();
+
+    for(int axis = 0; axis < 3; axis++){
+        const interval& ax = box.axis_interval(axis);
+        const double adinv = 1.0 / direction[axis];
+
+        auto t0 = (ax.min - origin[axis]) * adinv;
+        auto t1 = (ax.max - origin[axis]) * adinv;
+
+        if(t0 < t1){
+            if(t0 > ray_t.min) ray_t.min = t0;
+            if(t1 < ray_t.max) ray_t.max = t1;
+        } else {
+            if(t1 > ray_t.min) ray_t.min = t1;
+            if(t0 < ray_t.max) ray_t.max = t0;
+        }
+
+        if(ray_t.max <= ray_t.min) return false;
+    }
+    return true;
+}
+
+BENCH_NOINLINE static bool aabb_hit_cached(const aabb& box, const ray& r, interval ray_t){
+    return box.hit(r, ray_t);
+}
+
+static void bench_aabb(){
+    seed_random(0);
+    std::vector<aabb> boxes;
+    for(int i = 0; i < 64; i++){
+        auto p = point3::random(-10, 10);
+        boxes.push_back(aabb(p, p + vec3::random(0.5, 3)));
+    }
+    std::vector<ray> rays;
+    for(int i = 0; i < 20000; i++)
+        rays.push_back(ray(point3::random(-12, 12), random_unit_vector()));
+
+    const int passes = 20;
+    double tests = double(passes) * rays.size() * boxes.size();
+    int hits_dividing = 0, hits_cached = 0;
+
+    auto start = bench_clock::now();
+    for(int pass = 0; pass < passes; pass++)
+        for(const auto& r : rays)
+            for(const auto& box : boxes)
+                hits_dividing += aabb_hit_dividing(box, r, interval(0.001, infinity));
+    double dividing_time = seconds_since(start);
+
+    start = bench_clock::now();
+    for(int pass = 0; pass < passes; pass++)
+        for(const auto& r : rays)
+            for(const auto& box : boxes)
+                hits_cached += aabb_hit_cached(box, r, interval(0.001, infinity));
+    double cached_time = seconds_since(start);
+    bench_sink = hits_dividing + hits_cached;
+
+    std::cout << "aabb: " << tests / 1e6 << " M box tests ("
+              << (hits_dividing == hits_cached ? "same" : "DIFFERENT") << " hits)\n"
+              << "  dividing per test " << std::setw(8) << tests / dividing_time / 1e6 << " M/s\n"
+              << "  cached inverse    " << std::setw(8) << tests / cached_time / 1e6 << " M/s  "
+              << dividing_time / cached_time << "x\n";
+}
+
+// ---------------------------------------------------------------------------------------------
+// wide: 4- and 8-wide BVHs with each box test kernel against the binary trees
+
+static int wide_kernel_hits(simd_level level, const wide_bvh_node<8>& node, const wide_bvh_ray& r, float* tnear){
+#if RT_X86
+    if(level == simd_level::avx2) return wide_box_hits_avx2(node, r, tnear);
+    if(level == simd_level::sse) return wide_box_hits_sse<8>(node, r, tnear);
+#endif
+    return wide_box_hits_scalar<8>(node, r, tnear);
+}
+
+static int wide_face_ray_mismatches(simd_level level, int& lanes){
+    // Wide box tests of rays that start on a plane of one of the node's boxes and run along it,
+    // with a zero or negative zero direction component across the plane. Returns how many lanes
+    // the kernel decides differently from linear_bvh_node::hit on the same float bounds.
+    int mismatches = 0;
+    seed_random(3);
+    for(int round = 0; round < 4000; round++){
+        wide_bvh_node<8> node;
+        linear_bvh_node boxes[8];
+        node.child_count = 8;
+        for(int lane = 0; lane < 8; lane++){
+            boxes[lane].set_bounds(aabb(point3::random(-2, -0.1), point3::random(0.1, 2)));
+            for(int axis = 0; axis < 3; axis++){
+                node.bounds[axis][lane] = boxes[lane].bounds_min[axis];
+                node.bounds[axis + 3][lane] = boxes[lane].bounds_max[axis];
+            }
+        }
+
+        // Float coordinates, so the wide ray starts exactly where the linear one does
+        const auto& face = boxes[random_int(0, 7)];
+        int axis = random_int(0, 2);
+        point3 origin = point3::random(-3, 3);
+        for(int i = 0; i < 3; i++) origin[i] = float(origin[i]);
+        origin[axis] = random_int(0, 1) ? face.bounds_min[axis] : face.bounds_max[axis];
+        vec3 direction = random_unit_vector();
+        direction[axis] = random_int(0, 1) ? real(0) : -real(0);
+        ray r(origin, direction, 0);
+        interval ray_t(0.001, infinity);
+
+        alignas(32) float tnear[8];
+        int mask = wide_kernel_hits(level, node, make_wide_bvh_ray(r, ray_t), tnear);
+        int dir_is_neg[3] = {r.dir_is_neg(0), r.dir_is_neg(1), r.dir_is_neg(2)};
+        for(int lane = 0; lane < 8; lane++){
+            bool single = boxes[lane].hit(r.origin(), r.inv_direction(), dir_is_neg, ray_t);
+            if(single != bool((mask >> lane) & 1)) mismatches++;
+            lanes++;
+        }
+    }
+    return mismatches;
+}
+
+static int grazing_ray_mismatches(const hittable& world, const hittable& reference,
+                                  const std::vector<aabb>& boxes, int& rays){
+    // Rays that start on the plane of a box face and run along it, so they graze the faces
+    // across that plane. Returns how many closest hits or occlusion queries of world differ
+    // from those of reference.
+    int mismatches = 0;
+    seed_random(4);
+    for(int i = 0; i < 20000; i++){
+        const aabb& box = boxes[random_int(0, int(boxes.size()) - 1)];
+        int axis = random_int(0, 2);
+        point3 origin;
+        for(int a = 0; a < 3; a++){
+            const interval& ax = box.axis_interval(a);
+            origin[a] = random_double(ax.min - 1, ax.max + 1);
+        }
+        origin[axis] = random_int(0, 1) ? box.axis_interval(axis).min : box.axis_interval(axis).max;
+        vec3 direction = random_unit_vector();
+        direction[axis] = random_int(0, 1) ? real(0) : -real(0);
+        ray r(origin, direction, 0);
+
+        hit_record rec, reference_rec;
+        bool hit = world.hit(r, interval(0.001, infinity), rec);
+        bool reference_hit = reference.hit(r, interval(0.001, infinity), reference_rec);
+        if(hit != reference_hit || (hit && rec.t != reference_rec.t)) mismatches++;
+
+        interval shadow(0.001, random_double(0.5, 5));
+        if(world.occluded(r, shadow) != reference.occluded(r, shadow)) mismatches++;
+        rays++;
+    }
+    return mismatches;
+}
+
+static void bench_wide(){
+    struct wide_config {
+        const char* name;
+        bvh_layout layout;
+        simd_level simd;
+    };
+    const wide_config configs[] = {
+        {"bvh_node", bvh_layout::tree, simd_level::automatic},
+        {"linear", bvh_layout::linear, simd_level::automatic},
+        {"wide4 scalar", bvh_layout::wide4, simd_level::scalar},
+        {"wide4 sse", bvh_layout::wide4, simd_level::sse},
+        {"wide8 scalar", bvh_layout::wide8, simd_level::scalar},
+        {"wide8 sse", bvh_layout::wide8, simd_level::sse},
+        {"wide8 avx2", bvh_layout::wide8, simd_level::avx2},
+    };
+    const auto scenes = bvh_bench_scenes();
+
+    std::cout << "wide: single-thread closest-hit rays, SAH leaf<=4 builds (best kernel here: "
+              << simd_level_name(resolve_simd_level(simd_level::automatic)) << ")\n";
+    for(const auto& entry : scenes){
+        std::cout << "  " << entry.name << '\n';
+        double baseline = 0;
+        for(const auto& config : configs){
+            if(resolve_simd_level(config.simd) != config.simd && config.simd != simd_level::automatic){
+                std::cout << "    " << std::left << std::setw(14) << config.name << std::right << " unsupported\n";
+                continue;
+            }
+            bvh_options options;
+            options.split = bvh_split::sah;
+            options.max_leaf_size = 4;
+            options.layout = config.layout;
+            options.simd = config.simd;
+
+            seed_random(0);
+            auto s = entry.make(options);
+            seed_random(1);
+            auto rays = camera_rays(s.cam, 500000);
+            double mrays = cast_rays(s.world, rays);
+            if(baseline == 0) baseline = mrays;
+            std::cout << "    " << std::left << std::setw(14) << config.name << std::right
+                      << std::setw(7) << mrays << " Mrays/s  " << std::setw(5) << mrays / baseline << "x\n";
+        }
+    }
+
+    std::cout << "  rays along box faces, wide box tests deciding otherwise than linear nodes:";
+    for(simd_level level : {simd_level::scalar, simd_level::sse, simd_level::avx2}){
+        if(resolve_simd_level(level) != level) continue;
+        int lanes = 0;
+        int mismatches = wide_face_ray_mismatches(level, lanes);
+        std::cout << ' ' << simd_level_name(level) << ' ' << mismatches << " of " << lanes;
+    }
+    std::cout << '\n';
+
+    // Boxes with float corners, so face planes fall on the float bounds of the linear nodes
+    seed_random(0);
+    hittable_list faces;
+    std::vector<aabb> boxes;
+    auto white = make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    for(int i = 0; i < 200; i++){
+        point3 a = point3::random(-10, 10);
+        point3 b = a + vec3::random(0.2, 2);
+        for(int axis = 0; axis < 3; axis++){
+            a[axis] = float(a[axis]);
+            b[axis] = float(b[axis]);
+        }
+        boxes.push_back(aabb(a, b));
+        auto sides = box(a, b, white);
+        for(const auto& side : sides->objects) faces.add(side);
+    }
+    bvh_options reference_options;
+    reference_options.split = bvh_split::sah;
+    reference_options.max_leaf_size = 4;
+    reference_options.layout = bvh_layout::linear;
+    auto reference = make_bvh(faces, reference_options);
+
+    std::cout << "  rays along box faces, hits and occlusion differing from the linear BVH:";
+    for(const auto& config : configs){
+        if(config.layout != bvh_layout::wide4 && config.layout != bvh_layout::wide8) continue;
+        if(resolve_simd_level(config.simd) != config.simd) continue;
+        bvh_options options = reference_options;
+        options.layout = config.layout;
+        options.simd = config.simd;
+        int rays = 0;
+        int mismatches = grazing_ray_mismatches(*make_bvh(faces, options), *reference, boxes, rays);
+        std::cout << "\n    " << std::left << std::setw(14) << config.name << std::right
+                  << ' ' << mismatches << " of " << 2 * rays;
+    }
+    std::cout << '\n';
+}
+
+// ---------------------------------------------------------------------------------------------
+// occlusion: shadow rays traced as closest-hit queries against the any-hit occlusion query
+
+static std::vector<ray> shadow_rays(const hittable& world, const camera& cam, int count){
+    // Rays from the first hits of camera rays towards random points on a square above the
+    // scene, ending at the point (t = 1) like rays towards a sampled light
+    std::vector<ray> rays;
+    rays.reserve(count);
+    auto bbox = world.bounding_box();
+    while(int(rays.size()) < count){
+        for(const auto& r : camera_rays(cam, count)){
+            hit_record rec;
+            if(!world.hit(r, interval(0.001, infinity), rec)) continue;
+            point3 target(random_double(bbox.x.min, bbox.x.max), bbox.y.max + 10,
+                          random_double(bbox.z.min, bbox.z.max));
+            rays.push_back(ray(rec.p, target - rec.p, r.time()));
+            if(int(rays.size()) == count) break;
+        }
+    }
+    return rays;
+}
+
+static void bench_occlusion(){
+    const auto scenes = bvh_bench_scenes();
+    const std::pair<const char*, bvh_layout> layouts[] = {
+        {"bvh_node", bvh_layout::tree},
+        {"linear", bvh_layout::linear},
+        {"wide8", bvh_layout::wide8},
+    };
+    const int count = 500000;
+
+    std::cout << "occlusion: " << count << " single-thread shadow rays, SAH leaf<=4 builds\n";
+    for(const auto& entry : scenes){
+        std::cout << "  " << entry.name << '\n';
+        for(const auto& layout : layouts){
+            bvh_options options;
+            options.split = bvh_split::sah;
+            options.max_leaf_size = 4;
+            options.layout = layout.second;
+
+            seed_random(0);
+            auto s = entry.make(options);
+            seed_random(1);
+            auto rays = shadow_rays(s.world, s.cam, count);
+
+            // Media scatter at random, so the blocked fractions of the two queries can differ slightly
+            seed_random(2);
+            auto start = bench_clock::now();
+            int closest_blocked = 0;
+            hit_record rec;
+            for(const auto& r : rays)
+                closest_blocked += s.world.hit(r, interval(0.001, 0.999), rec);
+            double closest_time = seconds_since(start);
+
+            seed_random(2);
+            start = bench_clock::now();
+            int any_blocked = 0;
+            for(const auto& r : rays)
+                any_blocked += s.world.occluded(r, interval(0.001, 0.999));
+            double any_time = seconds_since(start);
+
+            std::cout << "    " << std::left << std::setw(9) << layout.first << std::right
+                      << " closest hit " << std::setw(6) << count / closest_time / 1e6 << " Mrays/s"
+                      << "  occluded " << std::setw(6) << count / any_time / 1e6 << " Mrays/s"
+                      << "  speedup " << closest_time / any_time << "x"
+                      << "  blocked " << std::setprecision(1) << 100.0 * any_blocked / count << "% / "
+                      << 100.0 * closest_blocked / count << '%' << std::setprecision(2) << '\n';
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// integrator: path length and ray throughput with and without Russian roulette
+
+static double mean_luminance(const framebuffer& image){
+    double sum = 0;
+    for(size_t i = 0; i < image.pixel_count(); i++)
+        sum += luminance(image.pixel(i));
+    return sum / image.pixel_count();
+}
+
+static void bench_integrator(){
+    const scene_entry scenes[] = {
+        {"cornell_box", cornell_box},
+        {"cornell_smoke", cornell_smoke},
+    };
+
+    std::cout << "integrator: 150 px, 32 spp, max depth 50\n";
+    for(const auto& entry : scenes){
+        std::cout << "  " << entry.name << '\n';
+        for(int rr_depth : {-1, 5, 3, 1}){
+            seed_random(0);
+            auto s = entry.make();
+            s.cam.image_width = 150;
+            s.cam.samples_per_pixel = 32;
+            s.cam.russian_roulette_depth = rr_depth;
+            s.cam.show_progress = false;
+
+            auto image = s.cam.render_image(s.world);
+            const auto& st = s.cam.stats;
+            std::cout << "    roulette " << std::left << std::setw(8)
+                      << (rr_depth < 0 ? std::string("off") : "after " + std::to_string(rr_depth)) << std::right
+                      << " path length " << std::setw(6) << st.average_path_length()
+                      << "  " << std::setw(6) << st.rays_per_second() / 1e6 << " Mrays/s"
+                      << "  " << std::setw(6) << st.seconds << " s"
+                      << "  mean luminance " << std::setprecision(4) << mean_luminance(image)
+                      << std::setprecision(2) << '\n';
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// render: whole-frame ray throughput on bouncing_spheres per thread count
+
+static void bench_render(){
+    std::cout << "render: bouncing_spheres, 400 px, 16 spp, max depth 50\n";
+    for(int threads : thread_counts()){
+        seed_random(0);
+        auto s = bouncing_spheres();
+        s.cam.image_width = 400;
+        s.cam.samples_per_pixel = 16;
+        s.cam.thread_count = threads;
+        s.cam.show_progress = false;
+
+        s.cam.render_image(s.world);
+        const auto& st = s.cam.stats;
+        std::cout << "  " << std::setw(3) << threads << " thread(s): " << std::setw(6)
+                  << st.rays_per_second() / 1e6 << " Mrays/s  " << std::setw(6) << st.seconds << " s\n";
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// image: writing a 4K frame as ASCII P3 through write_color against the whole-buffer writers
+
+static void bench_image(){
+    seed_random(0);
+    auto s = simple_light();
+    s.cam.aspect_ratio = 16.0 / 9.0;
+    s.cam.image_width = 3840;
+    s.cam.samples_per_pixel = 2;
+    s.cam.show_progress = false;
+    auto image = s.cam.render_image(s.world);
+
+    std::cout << "image: " << image.width() << "x" << image.height() << " simple_light, written to memory\n";
+    auto report = [&](const char* name, const std::function<void(std::ostream&)>& write) {
+        std::ostringstream out;
+        auto start = bench_clock::now();
+        write(out);
+        double seconds = seconds_since(start);
+        std::cout << "  " << std::left << std::setw(10) << name << std::right << std::setw(8) << seconds * 1000
+                  << " ms  " << std::setw(8) << out.str().size() / 1e6 << " MB\n";
+    };
+
+    report("P3 ascii", [&](std::ostream& out) {
+        out << "P3\n" << image.width() << ' ' << image.height() << "\n255\n";
+        for(size_t i = 0; i < image.pixel_count(); i++)
+            write_color(out, image.pixel(i));
+    });
+    report("P6", [&](std::ostream& out) { write_ppm(out, image); });
+    report("PNG", [&](std::ostream& out) { write_png(out, image); });
+    report("PFM", [&](std::ostream& out) { write_pfm(out, image); });
+}
+
+// ---------------------------------------------------------------------------------------------
+// progressive: cost of rendering in passes and of saving a checkpoint after every pass
+
+static void bench_progressive(){
+    std::cout << "progressive: final_scene, 300 px, 32 spp\n";
+    std::string checkpoint = "raytracer_bench_checkpoint.tmp";
+    struct mode {
+        const char* name;
+        int samples_per_pass;
+        bool save;
+    };
+    const mode modes[] = {{"one pass", 0, false}, {"1 spp passes", 1, false}, {"+ checkpoints", 1, true}};
+
+    double baseline = 0;
+    for(const auto& m : modes){
+        seed_random(0);
+        auto s = final_scene(300, 32, 50);
+        s.cam.show_progress = false;
+        s.cam.samples_per_pass = m.samples_per_pass;
+        if(m.save){
+            std::remove(checkpoint.c_str());
+            s.cam.checkpoint_path = checkpoint;
+            s.cam.checkpoint_interval = 0;
+        }
+        s.cam.render_image(s.world);
+        if(m.save) std::remove(checkpoint.c_str());
+
+        double seconds = s.cam.stats.seconds;
+        if(baseline == 0) baseline = seconds;
+        std::cout << "  " << std::left << std::setw(14) << m.name << std::right << std::setw(7) << seconds
+                  << " s  " << std::setw(5) << seconds / baseline << "x\n";
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// adaptive: uniform sample counts against variance driven adaptive sampling at equal error
+
+static double rmse(const framebuffer& image, const framebuffer& reference){
+    // Root mean square difference of the color components
+    double sum = 0;
+    for(size_t i = 0; i < image.pixel_count(); i++){
+        color d = image.pixel(i) - reference.pixel(i);
+        sum += d.length_squared() / 3;
+    }
+    return std::sqrt(sum / image.pixel_count());
+}
+
+static framebuffer output_values(const framebuffer& image){
+    // The gamma encoded 0..1 values the image is written with
+    framebuffer encoded(image.width(), image.height());
+    for(size_t i = 0; i < image.pixel_count(); i++){
+        color c = image.pixel(i);
+        encoded.set_pixel(i, color(std::fmin(linear_to_gamma(c.x()), 1.0), std::fmin(linear_to_gamma(c.y()), 1.0),
+                                   std::fmin(linear_to_gamma(c.z()), 1.0)));
+    }
+    return encoded;
+}
+
+struct reference_scene {
+    // A scene of the error benchmarks: rendered width and the sample count of the reference
+    scene_entry entry;
+    bool sample_lights;
+    int width;
+    int reference_spp;
+};
+
+static void bench_adaptive(){
+    const reference_scene scenes[] = {
+        {{"cornell_box, light sampling", cornell_box}, true, 80, 2048},
+        {{"bouncing_spheres", [] { return bouncing_spheres(); }}, false, 100, 4096},
+    };
+    const int max_spp = 1024;
+
+    std::cout << "adaptive: uniform vs. adaptive 16.." << max_spp << " spp, error of the 0..1 output values\n";
+    for(const auto& test : scenes){
+        auto render = [&](int spp, double threshold, uint64_t seed, render_stats& st) {
+            seed_random(0);
+            auto s = test.entry.make();
+            s.cam.image_width = test.width;
+            s.cam.samples_per_pixel = spp;
+            s.cam.adaptive_threshold = threshold;
+            s.cam.sample_lights = test.sample_lights;
+            s.cam.seed = seed;
+            s.cam.show_progress = false;
+            auto image = s.cam.render_image(s.world, gather_lights(s.world));
+            st = s.cam.stats;
+            return image;
+        };
+
+        render_stats st;
+        auto reference = output_values(render(test.reference_spp, 0, 1, st));
+        std::cout << "  " << test.entry.name << ", " << test.width << " px (reference " << test.reference_spp
+                  << " spp, " << st.seconds << " s)\n";
+
+        // Uniform RMSE falls as 1/sqrt(time), so the uniform time for any error follows from
+        // the last uniform render
+        double uniform_time = 0, uniform_error = 0;
+        for(int spp = 16; spp <= 256; spp *= 2){
+            auto image = render(spp, 0, 2, st);
+            uniform_time = st.seconds;
+            uniform_error = rmse(output_values(image), reference);
+            std::cout << "    uniform  " << std::setw(5) << spp << " spp            rmse " << std::setprecision(4)
+                      << uniform_error << std::setprecision(2) << "  " << std::setw(6) << st.seconds << " s\n";
+        }
+
+        for(double threshold : {0.03, 0.02, 0.01}){
+            auto image = render(max_spp, threshold, 2, st);
+            double error = rmse(output_values(image), reference);
+            double equal_time = uniform_time * (uniform_error / error) * (uniform_error / error);
+            std::cout << "    adaptive " << std::setprecision(3) << threshold << " threshold " << std::setprecision(2)
+                      << std::setw(6) << st.average_samples() << " spp  rmse " << std::setprecision(4) << error
+                      << std::setprecision(2) << "  " << std::setw(6) << st.seconds << " s"
+                      << "  uniform at equal error " << std::setw(6) << equal_time << " s  "
+                      << equal_time / st.seconds << "x\n";
+
+            // Pixels per power-of-two sample count bucket
+            std::vector<int> histogram;
+            for(uint32_t n : st.pixel_samples){
+                int bucket = 0;
+                while((2u << bucket) <= n) bucket++;
+                if(bucket >= int(histogram.size())) histogram.resize(bucket + 1, 0);
+                histogram[bucket]++;
+            }
+            std::cout << "      spp histogram:";
+            for(int bucket = 0; bucket < int(histogram.size()); bucket++){
+                if(histogram[bucket] == 0) continue;
+                std::cout << "  " << (1 << bucket) << "+: " << std::setprecision(1)
+                          << 100.0 * histogram[bucket] / st.pixel_samples.size() << '%' << std::setprecision(2);
+            }
+            std::cout << '\n';
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// nee: time to reach a target error with BSDF sampling alone and with light sampling and MIS
+
+static void bench_nee(){
+    const scene_entry scenes[] = {
+        {"cornell_box", cornell_box},
+        {"simple_light", simple_light},
+    };
+    const int width = 80;
+    const int reference_spp = 2048;
+    const int max_spp = 64;
+
+    std::cout << "nee: " << width << " px, reference " << reference_spp << " spp with light sampling\n";
+    for(const auto& entry : scenes){
+        auto render = [&](bool sample_lights, int spp, uint64_t seed, double& seconds) {
+            seed_random(0);
+            auto s = entry.make();
+            s.cam.image_width = width;
+            s.cam.samples_per_pixel = spp;
+            s.cam.sample_lights = sample_lights;
+            s.cam.seed = seed;
+            s.cam.show_progress = false;
+            auto image = s.cam.render_image(s.world, gather_lights(s.world));
+            seconds = s.cam.stats.seconds;
+            return image;
+        };
+
+        double reference_time;
+        auto reference = render(true, reference_spp, 1, reference_time);
+        std::cout << "  " << entry.name << " (reference " << reference_time << " s)\n";
+
+        // Error against time for doubling sample counts. The target is the error BSDF sampling
+        // reaches at max_spp. Error falls as 1/sqrt(time), so each mode's time to the target is
+        // extrapolated from its max_spp render.
+        double target = 0;
+        double time_to_target[2] = {0, 0};
+        for(int mode = 0; mode < 2; mode++){
+            for(int spp = 1; spp <= max_spp; spp *= 2){
+                double seconds;
+                auto image = render(mode == 1, spp, 2, seconds);
+                double error = rmse(image, reference);
+                if(mode == 0 && spp == max_spp) target = error;
+                if(spp == max_spp) time_to_target[mode] = seconds * (error / target) * (error / target);
+                std::cout << "    " << (mode ? "nee+mis" : "bsdf   ") << std::setw(4) << spp << " spp"
+                          << "  rmse " << std::setprecision(4) << error << std::setprecision(2)
+                          << "  " << std::setw(6) << seconds << " s\n";
+            }
+        }
+        std::cout << "    time to rmse " << std::setprecision(4) << target << std::setprecision(2)
+                  << ": bsdf " << time_to_target[0] << " s, nee+mis " << time_to_target[1]
+                  << " s, speedup " << time_to_target[0] / time_to_target[1] << "x\n";
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// sampler: error against time for the independent, stratified, Sobol and Halton samplers
+
+static void bench_sampler(){
+    const reference_scene scenes[] = {
+        {{"cornell_box, light sampling", cornell_box}, true, 80, 2048},
+        {{"bouncing_spheres", [] { return bouncing_spheres(); }}, false, 100, 2048},
+        {{"checkered_spheres", checkered_spheres}, false, 100, 1024},
+    };
+    const struct { const char* name; sampler_type type; } samplers[] = {
+        {"independent", sampler_type::independent},
+        {"stratified", sampler_type::stratified},
+        {"sobol", sampler_type::sobol},
+        {"halton", sampler_type::halton},
+    };
+    const int max_spp = 64;
+
+    std::cout << "sampler: rmse against a high sample count independent reference\n";
+    for(const auto& test : scenes){
+        auto render = [&](sampler_type type, int spp, uint64_t seed, double& seconds) {
+            seed_random(0);
+            auto s = test.entry.make();
+            s.cam.image_width = test.width;
+            s.cam.samples_per_pixel = spp;
+            s.cam.sample_lights = test.sample_lights;
+            s.cam.sampling = type;
+            s.cam.seed = seed;
+            s.cam.show_progress = false;
+            auto image = s.cam.render_image(s.world, gather_lights(s.world));
+            seconds = s.cam.stats.seconds;
+            return image;
+        };
+
+        double reference_time;
+        auto reference = render(sampler_type::independent, test.reference_spp, 1, reference_time);
+        std::cout << "  " << test.entry.name << ", " << test.width << " px (reference " << test.reference_spp
+                  << " spp, " << reference_time << " s)\n";
+
+        // Independent sampling's error falls as 1/sqrt(time), which gives its time for the error
+        // every other sampler reaches at max_spp
+        double independent_time = 0, independent_error = 0;
+        for(const auto& smp : samplers){
+            std::cout << "    " << std::left << std::setw(12) << smp.name << std::right;
+            double seconds = 0, error = 0;
+            for(int spp = 4; spp <= max_spp; spp *= 4){
+                auto image = render(smp.type, spp, 2, seconds);
+                error = rmse(image, reference);
+                std::cout << "  " << std::setw(3) << spp << " spp " << std::setprecision(4) << error
+                          << std::setprecision(2) << " " << std::setw(5) << seconds << " s";
+            }
+            if(smp.type == sampler_type::independent){
+                independent_time = seconds;
+                independent_error = error;
+                std::cout << '\n';
+                continue;
+            }
+            double equal_time = independent_time * (independent_error / error) * (independent_error / error);
+            std::cout << "  " << equal_time / seconds << "x\n";
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// warp: the rejection loops random_unit_vector()/random_in_unit_disk() used against the
+// closed-form warps that replaced them
+
+static long rejection_draws; // Random numbers the rejection loops consumed
+
+static double counted_random(){
+    rejection_draws++;
+    return random_double();
+}
+
+static vec3 rejection_unit_vector(){
+    // random_unit_vector() before the closed-form warps
+    while (true){
+        auto p = vec3(2 * counted_random() - 1, 2 * counted_random() - 1, 2 * counted_random() - 1);
+        auto lensq = p.length_squared();
+        if (1e-160 < lensq && lensq <= 1) return p/sqrt(lensq);
+    }
+}
+
+static vec3 rejection_in_unit_disk(){
+    // random_in_unit_disk() before the closed-form warps
+    while (true){
+        auto p = vec3(2 * counted_random() - 1, 2 * counted_random() - 1, 0);
+        if (p.length_squared() <= 1) return p;
+    }
+}
+
+static BENCH_NOINLINE vec3 lambertian_rejection(const vec3& normal){
+    // The old lambertian direction: normal plus a uniform unit vector
+    auto d = normal + rejection_unit_vector();
+    return d.near_zero() ? normal : d;
+}
+
+static BENCH_NOINLINE vec3 lambertian_closed_form(const vec3& normal){
+    auto d = normal + random_unit_vector();
+    return d.near_zero() ? normal : d;
+}
+
+static void bench_warp(){
+    const long samples = 10000000;
+    std::cout << "warp: " << samples << " samples from the thread's PCG32\n";
+
+    std::vector<vec3> normals(1024);
+    seed_random(0);
+    for(auto& n : normals) n = unit_vector(vec3::random(-1, 1) + vec3(0, 0, 1e-3));
+
+    struct warp_entry {
+        const char* name;
+        std::function<vec3(long)> rejection;
+        std::function<vec3(long)> closed_form;
+    };
+    const warp_entry warps[] = {
+        {"unit sphere",
+         [](long) { return rejection_unit_vector(); },
+         [](long) { return sample_unit_sphere(sample_2d()); }},
+        {"unit disk",
+         [](long) { return rejection_in_unit_disk(); },
+         [](long) { return sample_concentric_disk(sample_2d()); }},
+        {"lambertian",
+         [&](long i) { return lambertian_rejection(normals[i & 1023]); },
+         [&](long i) { return lambertian_closed_form(normals[i & 1023]); }},
+    };
+
+    for(const auto& w : warps){
+        double times[2];
+        double draws = 0;
+        for(int mode = 0; mode < 2; mode++){
+            seed_random(1);
+            rejection_draws = 0;
+            vec3 sum(0,0,0);
+            auto start = bench_clock::now();
+            for(long i = 0; i < samples; i++)
+                sum += mode ? w.closed_form(i) : w.rejection(i);
+            times[mode] = seconds_since(start);
+            bench_sink = sum.x() + sum.y() + sum.z();
+            if(mode == 0) draws = double(rejection_draws) / samples;
+        }
+        std::cout << "  " << std::left << std::setw(12) << w.name << std::right
+                  << " rejection " << std::setw(6) << times[0] / samples * 1e9 << " ns ("
+                  << draws << " draws)"
+                  << "  closed form " << std::setw(6) << times[1] / samples * 1e9 << " ns (2 draws)"
+                  << "  speedup " << times[0] / times[1] << "x\n";
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// scene_file: loading a scene file of a million spheres
+
+static std::string sphere_scene_text(int count){
+    // Random spheres with coordinates written the way people and exporters do
+    std::string text = "material m lambertian 0.5 0.5 0.5\n";
+    char line[128];
+    for(int i = 0; i < count; i++){
+        auto c = point3::random(-1000, 1000);
+        std::snprintf(line, sizeof line, "sphere %.4f %.4f %.4f %.3f m\n", c.x(), c.y(), c.z(), random_double(0.5, 2));
+        text += line;
+    }
+    return text;
+}
+
+static void bench_scene_file(){
+    const int count = 1000000;
+    seed_random(0);
+    std::string text = sphere_scene_text(count);
+    std::string path = "bench_spheres.scene";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << text;
+    }
+    std::cout << "scene_file: " << count << " spheres, " << text.size() / 1e6 << " MB\n";
+
+    for(int run = 0; run < 3; run++){
+        scene s;
+        std::string error;
+        auto start = bench_clock::now();
+        bool loaded = load_scene_file(path, s, error);
+        double seconds = seconds_since(start);
+        if(!loaded){
+            std::cout << "  " << error << '\n';
+            break;
+        }
+        std::cout << "  load " << std::setw(5) << seconds * 1e3 << " ms  " << std::setw(6)
+                  << s.world.objects.size() / seconds / 1e6 << " M primitives/s\n";
+    }
+
+    // The parser without file I/O or object construction costs: numbers alone through
+    // std::istream, the obvious way to read such a file
+    auto start = bench_clock::now();
+    std::istringstream in(text);
+    std::string word;
+    double x, sum = 0;
+    in >> word >> word >> word >> x >> x >> x;
+    while(in >> word >> x){
+        sum += x;
+        in >> x >> x >> x >> word;
+    }
+    bench_sink = sum;
+    std::cout << "  istream >> of the same text " << seconds_since(start) * 1e3 << " ms\n";
+    std::remove(path.c_str());
+}
+
+static void bench_scene_cache(){
+    // Startup of a million-sphere scene: parsing the text and building a BVH on every run,
+    // against mapping a cache that holds both. Rays are cast right after loading, so the
+    // pages of the mapping that traversal faults in are part of the comparison.
+    const int count = 1000000;
+    seed_random(0);
+    std::string path = "bench_spheres.scene";
+    std::string cache_path = path + ".cache";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << sphere_scene_text(count);
+    }
+    std::string error;
+    auto start = bench_clock::now();
+    if(!build_scene_cache(path, cache_path, error)){
+        std::cout << "scene_cache: " << error << '\n';
+        std::remove(path.c_str());
+        return;
+    }
+    std::cout << "scene_cache: " << count << " spheres, writing the cache " << seconds_since(start) * 1e3 << " ms\n";
+
+    bvh_options options;
+    options.layout = bvh_layout::linear;
+    options.split = bvh_split::sah;
+    options.max_leaf_size = 4;
+    std::vector<ray> rays = camera_rays(camera(), 10000);
+
+    for(int run = 0; run < 3; run++){
+        scene parsed;
+        start = bench_clock::now();
+        load_scene_file(path, parsed, error);
+        auto world = make_bvh(parsed.world, options);
+        double parse_seconds = seconds_since(start);
+        double parse_rays = cast_rays(*world, rays);
+
+        scene cached;
+        start = bench_clock::now();
+        bool loaded = load_scene_cache(cache_path, path, cached, error);
+        double cache_seconds = seconds_since(start);
+        if(!loaded){
+            std::cout << "  " << error << '\n';
+            break;
+        }
+        double cache_rays = cast_rays(cached.world, rays);
+
+        std::cout << "  parse + build " << std::setw(7) << parse_seconds * 1e3 << " ms  " << std::setw(5)
+                  << parse_rays << " Mrays/s    cache " << std::setw(6) << cache_seconds * 1e3 << " ms  "
+                  << std::setw(5) << cache_rays << " Mrays/s  " << std::setw(7)
+                  << parse_seconds / cache_seconds << "x faster start\n";
+    }
+    std::remove(path.c_str());
+    std::remove(cache_path.c_str());
+}
+
+static void bench_mesh(){
+    // A 1024 x 1024 vertex heightfield of two million triangles written as OBJ: streaming load
+    // and BVH build time, memory against the raw vertex and index data, and closest-hit rays
+    const int n = 1024;
+    std::string path = "bench_mesh.obj";
+    {
+        std::ofstream out(path, std::ios::binary);
+        char line[128];
+        for(int z = 0; z < n; z++){
+            for(int x = 0; x < n; x++){
+                double y = 20 * std::sin(x * 0.05) * std::cos(z * 0.07);
+                std::snprintf(line, sizeof line, "v %d %.4f %d\n", x, y, z);
+                out << line;
+            }
+        }
+        for(int z = 0; z + 1 < n; z++){
+            for(int x = 0; x + 1 < n; x++){
+                int v = z * n + x + 1;
+                std::snprintf(line, sizeof line, "f %d %d %d\nf %d %d %d\n", v, v + 1, v + n + 1, v, v + n + 1, v + n);
+                out << line;
+            }
+        }
+    }
+
+    auto start = bench_clock::now();
+    mesh_data data;
+    obj_reader reader(path);
+    if(!reader.read(data)){
+        std::cout << "mesh: " << reader.error() << '\n';
+        std::remove(path.c_str());
+        return;
+    }
+    double read_seconds = seconds_since(start);
+    size_t raw_bytes = data.positions.size() * sizeof(point3) + data.indices.size() * sizeof(uint32_t);
+    start = bench_clock::now();
+    triangle_mesh mesh(std::move(data), make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+    double build_seconds = seconds_since(start);
+
+    std::cout << "mesh: " << mesh.triangle_count() << " triangles, read " << read_seconds * 1e3 << " ms, BVH "
+              << build_seconds * 1e3 << " ms\n";
+    std::cout << "  " << mesh.memory_bytes() / 1e6 << " MB, " << double(mesh.memory_bytes()) / raw_bytes
+              << "x the raw vertex and index data (" << double(mesh.memory_bytes()) / mesh.triangle_count()
+              << " bytes per triangle)\n";
+
+    camera cam;
+    cam.lookfrom = point3(n / 2, 200, -100);
+    cam.lookat = point3(n / 2, 0, n / 2);
+    seed_random(0);
+    std::cout << "  " << cast_rays(mesh, camera_rays(cam, 1000000)) << " Mrays/s\n";
+    std::remove(path.c_str());
+}
+
+static mesh_data bumpy_sphere_mesh(int rings, int segments){
+    // A sphere of radius about 10 with bumps, two triangles per ring segment
+    mesh_data mesh;
+    for(int i = 0; i <= rings; i++){
+        double theta = pi * i / rings;
+        for(int j = 0; j < segments; j++){
+            double phi = 2 * pi * j / segments;
+            double radius = 10 * (1 + 0.1 * std::sin(5 * theta) * std::sin(5 * phi));
+            mesh.positions.push_back(radius * vec3(std::sin(theta) * std::cos(phi), std::cos(theta),
+                                                   std::sin(theta) * std::sin(phi)));
+        }
+    }
+    for(int i = 0; i < rings; i++){
+        for(int j = 0; j < segments; j++){
+            uint32_t a = uint32_t(i * segments + j), b = uint32_t(i * segments + (j + 1) % segments);
+            uint32_t c = a + uint32_t(segments), d = b + uint32_t(segments);
+            for(uint32_t v : {a, b, d, a, d, c}) mesh.indices.push_back(v);
+        }
+    }
+    return mesh;
+}
+
+static void bench_instances(){
+    // Ten thousand randomly rotated, scaled and placed copies of one 20k triangle mesh, in the
+    // instance_bvh top level against a linear BVH over shared_ptr<instance> objects
+    const int count = 10000;
+    auto mesh = make_shared<triangle_mesh>(bumpy_sphere_mesh(100, 100), make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+
+    seed_random(0);
+    std::vector<instance> instances;
+    hittable_list objects;
+    for(int i = 0; i < count; i++){
+        auto to_world = affine_transform::translation(point3::random(0, 2000))
+                      * affine_transform::rotation(random_unit_vector(), random_double(0, 360))
+                      * affine_transform::scaling(vec3(1, 1, 1) * random_double(0.5, 2));
+        instances.push_back(instance(mesh, to_world));
+        objects.add(make_shared<instance>(mesh, to_world));
+    }
+
+    std::cout << "instances: " << count << " instances of a " << mesh->triangle_count() << " triangle mesh ("
+              << mesh->memory_bytes() / 1e6 << " MB), " << double(count) * mesh->triangle_count() / 1e6
+              << "M triangles in all\n";
+    std::cout << "  copying the mesh per instance would take " << count * (mesh->memory_bytes() / 1e6) << " MB\n";
+
+    bvh_options options;
+    options.layout = bvh_layout::linear;
+    options.split = bvh_split::sah;
+    camera cam;
+    cam.lookfrom = point3(1000, 1000, -1500);
+    cam.lookat = point3(1000, 1000, 1000);
+    auto rays = camera_rays(cam, 200000);
+
+    auto start = bench_clock::now();
+    instance_bvh top_level(instances, options);
+    double build_seconds = seconds_since(start);
+    std::cout << "  instance_bvh          build " << std::setw(6) << build_seconds * 1e3 << " ms  "
+              << std::setw(6) << top_level.memory_bytes() / 1e6 << " MB  " << std::setw(5)
+              << cast_rays(top_level, rays) << " Mrays/s\n";
+
+    start = bench_clock::now();
+    auto object_bvh = make_bvh(objects, options);
+    build_seconds = seconds_since(start);
+    std::cout << "  linear_bvh of objects build " << std::setw(6) << build_seconds * 1e3 << " ms  "
+              << std::setw(15) << cast_rays(*object_bvh, rays) << " Mrays/s\n";
+}
+
+static void count_self_hits(const hittable& object, const point3& target, double distance, bool closed,
+                            long& self_hits, long& spawned){
+    // Shoots rays at target from distance away, then four rays off every hit in random directions
+    // (only outwards for closed surfaces), and counts those that find the object again
+    for(int k = 0; k < 5000; k++){
+        vec3 direction = random_unit_vector();
+        ray r(target - distance * direction + 0.003 * distance * vec3::random(-1, 1), direction, 0);
+        hit_record rec;
+        if(!object.hit(r, interval(0, infinity), rec)) continue;
+        vec3 outward = rec.front_face ? rec.normal : -rec.normal;
+        for(int s = 0; s < 4; s++){
+            vec3 d = random_unit_vector();
+            if(closed && dot(d, outward) < 0) d = -d;
+            hit_record again;
+            spawned++;
+            if(object.hit(rec.spawn_ray(d, 0), interval(0, infinity), again)) self_hits++;
+        }
+    }
+}
+
+static void bench_precision(){
+    // Sizes and throughput of the geometry in this build's precision. Compare a default build
+    // with one configured with -DRT_SINGLE_PRECISION=ON.
+    std::cout << "precision: real is " << (sizeof(real) == sizeof(float) ? "float" : "double") << '\n';
+    std::cout << "  bytes: vec3 " << sizeof(vec3) << ", ray " << sizeof(ray) << ", hit_record "
+              << sizeof(hit_record) << ", sphere " << sizeof(sphere) << ", quad " << sizeof(quad)
+              << ", cache_sphere " << sizeof(cache_sphere) << ", cache_quad " << sizeof(cache_quad) << '\n';
+
+    // Spheres, quads and triangles 0.01 to 1000 units in size up to 1000 units from the origin, and
+    // spheres and triangles placed by instances up to 10000 units away
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    long self_hits = 0, spawned = 0, instance_self_hits = 0, instance_spawned = 0;
+    seed_random(0);
+    for(double size : {0.01, 1.0, 100.0, 1000.0}){
+        for(double offset : {0.0, 10.0, 1000.0, 10000.0}){
+            point3 c(offset, -0.7 * offset, 0.3 * offset);
+            double distance = 3 * size + 1;
+            mesh_data triangle;
+            triangle.positions = {point3(0, 0, 0), point3(1, 0.3, 0), point3(0.1, 0.2, 1)};
+            triangle.indices = {0, 1, 2};
+            auto unit_triangle = make_shared<triangle_mesh>(triangle, mat);
+            if(offset <= 1000){
+                for(auto& p : triangle.positions) p = c + size * p;
+                count_self_hits(sphere(c, size, mat), c, distance, true, self_hits, spawned);
+                count_self_hits(quad(c, vec3(size, 0.1 * size, 0), vec3(0.2 * size, 0.3 * size, size), mat),
+                                c + vec3(0.6 * size, 0.2 * size, 0.5 * size), distance, false, self_hits, spawned);
+                count_self_hits(triangle_mesh(triangle, mat), c + size * vec3(0.35, 0.17, 0.35), distance, false,
+                                self_hits, spawned);
+            }
+            auto place = affine_transform::translation(c) * affine_transform::rotation(vec3(1, 2, 3), 30)
+                       * affine_transform::scaling(vec3(size, 0.5 * size, 2 * size));
+            count_self_hits(instance(make_shared<sphere>(point3(0, 0, 0), 1, mat), place), c, 2 * distance, true,
+                            instance_self_hits, instance_spawned);
+            count_self_hits(instance(unit_triangle, place), place.point(point3(0.35, 0.17, 0.35)), 2 * distance,
+                            false, instance_self_hits, instance_spawned);
+        }
+    }
+    std::cout << "  spawned rays finding their own surface again: " << self_hits << " of " << spawned
+              << ", under instances " << instance_self_hits << " of " << instance_spawned << '\n';
+
+    triangle_mesh mesh(bumpy_sphere_mesh(400, 400), mat);
+    camera cam;
+    cam.lookfrom = point3(0, 0, -30);
+    cam.lookat = point3(0, 0, 0);
+    cam.vfov = 40;
+    seed_random(0);
+    std::cout << "  mesh of " << mesh.triangle_count() << " triangles: " << mesh.memory_bytes() / 1e6 << " MB, "
+              << cast_rays(mesh, camera_rays(cam, 1000000)) << " Mrays/s\n";
+
+    bvh_options options;
+    options.layout = bvh_layout::linear;
+    options.split = bvh_split::sah;
+    seed_random(0);
+    auto s = final_scene(200, 8, 50, options);
+    seed_random(0);
+    std::cout << "  final_scene camera rays: " << cast_rays(s.world, camera_rays(s.cam, 1000000)) << " Mrays/s\n";
+
+    s.cam.image_width = 200;
+    s.cam.samples_per_pixel = 8;
+    s.cam.thread_count = 1;
+    s.cam.show_progress = false;
+    s.cam.render_image(s.world);
+    std::cout << "  final_scene render, 200 px, 8 spp, one thread: " << s.cam.stats.rays_per_second() / 1e6
+              << " Mrays/s\n";
+}
+
+// ---------------------------------------------------------------------------------------------
+// packed: SoA leaves with batch sphere and quad kernels against a linear BVH of objects
+
+static std::vector<ray> rays_into_box(const aabb& box, int count){
+    // Rays from random points around the box towards random points inside it
+    std::vector<ray> rays;
+    rays.reserve(count);
+    point3 center(box.x.min + box.x.size() / 2, box.y.min + box.y.size() / 2, box.z.min + box.z.size() / 2);
+    double reach = 2 * std::max(box.x.size(), std::max(box.y.size(), box.z.size()));
+    for(int i = 0; i < count; i++){
+        point3 origin = center + reach * random_unit_vector();
+        point3 target(random_double(box.x.min, box.x.max), random_double(box.y.min, box.y.max),
+                      random_double(box.z.min, box.z.max));
+        rays.push_back(ray(origin, target - origin, random_double()));
+    }
+    return rays;
+}
+
+static void bench_packed(){
+    struct packed_config {
+        const char* name;
+        bvh_layout layout;
+        simd_level simd;
+    };
+    const packed_config configs[] = {
+        {"linear", bvh_layout::linear, simd_level::automatic},
+        {"packed scalar", bvh_layout::packed, simd_level::scalar},
+        {"packed sse", bvh_layout::packed, simd_level::sse},
+        {"packed avx2", bvh_layout::packed, simd_level::avx2},
+    };
+    const int count = 500000;
+
+    std::cout << "packed: single-thread closest-hit rays, SAH leaf<=4 builds, " << real_block_width
+              << " primitives per block (best kernel here: "
+              << simd_level_name(resolve_simd_level(simd_level::automatic)) << ")\n";
+    for(int set = 0; set < 3; set++){
+        const char* names[] = {"bouncing_spheres camera rays", "final_scene sphere cluster", "final_scene camera rays"};
+        std::cout << "  " << names[set] << '\n';
+        double baseline = 0;
+        for(const auto& config : configs){
+            if(resolve_simd_level(config.simd) != config.simd && config.simd != simd_level::automatic){
+                std::cout << "    " << std::left << std::setw(14) << config.name << std::right << " unsupported\n";
+                continue;
+            }
+            bvh_options options;
+            options.split = bvh_split::sah;
+            options.max_leaf_size = 4;
+            options.layout = config.layout;
+            options.simd = config.simd;
+
+            seed_random(0);
+            double mrays;
+            if(set == 0){
+                auto s = bouncing_spheres(options);
+                seed_random(1);
+                mrays = cast_rays(s.world, camera_rays(s.cam, count));
+            } else if(set == 1){
+                auto cluster = make_bvh(final_scene_sphere_cluster(), options);
+                seed_random(1);
+                mrays = cast_rays(*cluster, rays_into_box(cluster->bounding_box(), count));
+            } else {
+                auto s = final_scene(200, 8, 50, options);
+                seed_random(1);
+                mrays = cast_rays(s.world, camera_rays(s.cam, count));
+            }
+            if(baseline == 0) baseline = mrays;
+            std::cout << "    " << std::left << std::setw(14) << config.name << std::right
+                      << std::setw(7) << mrays << " Mrays/s  " << std::setw(5) << mrays / baseline << "x\n";
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// packets: camera rays of pixel blocks traced as packets against one ray at a time
+
+static std::vector<ray> pixel_block_rays(const camera& cam, int width, int block_w, int block_h){
+    // One ray through the center of every pixel of a width wide image, ordered block by block
+    // so each block_w x block_h run of rays is a packet the camera would trace
+    int height = std::max(1, int(width / cam.aspect_ratio));
+    vec3 w = unit_vector(cam.lookfrom - cam.lookat);
+    vec3 u = unit_vector(cross(cam.vup, w));
+    vec3 v = cross(w, u);
+    double viewport_height = 2 * std::tan(degrees_to_radians(cam.vfov) / 2);
+    double viewport_width = viewport_height * width / height;
+
+    std::vector<ray> rays;
+    rays.reserve(size_t(width) * height);
+    for(int block_j = 0; block_j < height; block_j += block_h)
+        for(int block_i = 0; block_i < width; block_i += block_w)
+            for(int j = block_j; j < std::min(height, block_j + block_h); j++)
+                for(int i = block_i; i < std::min(width, block_i + block_w); i++){
+                    vec3 dir = -w + ((i + 0.5) / width - 0.5) * viewport_width * u
+                                  - ((j + 0.5) / height - 0.5) * viewport_height * v;
+                    rays.push_back(ray(cam.lookfrom, dir, random_double()));
+                }
+    return rays;
+}
+
+static double cast_packets(const hittable& world, const std::vector<ray>& rays, int packet_size, int& hits){
+    // Mrays/s of rays traced packet_size at a time with hit_packet
+    ray_packet packet;
+    packet.level = resolve_simd_level(simd_level::automatic);
+    hits = 0;
+    auto start = bench_clock::now();
+    for(size_t first = 0; first < rays.size(); first += packet_size){
+        packet.size = int(std::min(rays.size() - first, size_t(packet_size)));
+        for(int lane = 0; lane < packet.size; lane++)
+            packet.rays[lane] = rays[first + lane];
+        packet.start(0, infinity);
+        world.hit_packet(packet, packet.all());
+        hits += bit_count(packet.hits);
+    }
+    return rays.size() / seconds_since(start) / 1e6;
+}
+
+static int face_ray_mismatches(simd_level level, int& lanes){
+    // Packet box tests of rays that start on a plane of a box and run along it, with a zero or
+    // negative zero direction component across the plane, so their slab distances are NaN.
+    // Returns how many lanes the packet test decides differently from linear_bvh_node::hit.
+    int mismatches = 0;
+    seed_random(2);
+    for(int round = 0; round < 2000; round++){
+        linear_bvh_node node;
+        node.set_bounds(aabb(point3::random(-2, -0.1), point3::random(0.1, 2)));
+        real lo[3] = {node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]};
+        real hi[3] = {node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]};
+
+        ray_packet packet;
+        packet.level = level;
+        packet.size = max_packet_size;
+        for(int lane = 0; lane < packet.size; lane++){
+            int axis = random_int(0, 2);
+            point3 origin = point3::random(-3, 3);
+            origin[axis] = random_int(0, 1) ? lo[axis] : hi[axis];
+            vec3 direction = random_unit_vector();
+            direction[axis] = random_int(0, 1) ? real(0) : -real(0);
+            packet.rays[lane] = ray(origin, direction, 0);
+        }
+        packet.start(0, infinity);
+        uint32_t mask = packet_box_hits(packet, lo, hi, packet.all());
+
+        for(int lane = 0; lane < packet.size; lane++){
+            const ray& r = packet.rays[lane];
+            int dir_is_neg[3] = {r.dir_is_neg(0), r.dir_is_neg(1), r.dir_is_neg(2)};
+            bool single = node.hit(r.origin(), r.inv_direction(), dir_is_neg, packet.lane_interval(lane));
+            if(single != bool((mask >> lane) & 1)) mismatches++;
+            lanes++;
+        }
+    }
+    return mismatches;
+}
+
+static void bench_packets(){
+    const scene_entry scenes[] = {
+        {"quads", quads},
+        {"cornell_box", cornell_box},
+        {"bouncing_spheres", []() { return bouncing_spheres(); }},
+        {"final_scene", []() { return final_scene(400, 8, 50); }},
+    };
+    const int sizes[] = {4, 8, 16};
+    const int width = 800;
+
+    std::cout << "packets: single-thread camera rays of an " << width << " px wide frame, "
+              << simd_level_name(resolve_simd_level(simd_level::automatic)) << " box tests\n";
+    std::cout << "  rays along box faces, packet box tests deciding otherwise than single rays:";
+    for(simd_level level : {simd_level::scalar, simd_level::sse, simd_level::avx2}){
+        if(resolve_simd_level(level) != level) continue;
+        int lanes = 0;
+        int mismatches = face_ray_mismatches(level, lanes);
+        std::cout << ' ' << simd_level_name(level) << ' ' << mismatches << " of " << lanes;
+    }
+    std::cout << '\n';
+    for(const auto& entry : scenes){
+        seed_random(0);
+        scene s = entry.make();
+        bvh_options options;
+        options.layout = bvh_layout::linear;
+        options.split = bvh_split::sah;
+        options.max_leaf_size = 4;
+        auto top = make_bvh(s.world, options);
+        const std::pair<const char*, const hittable*> worlds[] = {
+            {"as built", &s.world},
+            {"linear top", top.get()},
+        };
+
+        std::cout << "  " << entry.name << '\n';
+        for(const auto& world : worlds){
+            seed_random(1);
+            auto single_rays = pixel_block_rays(s.cam, width, 1, 1);
+            double single = cast_rays(*world.second, single_rays);
+            std::cout << "    " << std::left << std::setw(11) << world.first << std::right
+                      << " single " << std::setw(6) << single << " Mrays/s";
+            for(int size : sizes){
+                seed_random(1);
+                auto rays = pixel_block_rays(s.cam, width, size >= 8 ? 4 : 2, size >= 16 ? 4 : 2);
+                int hits;
+                double mrays = cast_packets(*world.second, rays, size, hits);
+                std::cout << "  " << std::setw(2) << size << ": " << std::setw(6) << mrays
+                          << " (" << mrays / single << "x)";
+            }
+            std::cout << '\n';
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// wavefront: whole renders with the recursive and the wavefront integrator per batch size
+
+static bool same_image(const framebuffer& a, const framebuffer& b){
+    for(size_t i = 0; i < a.pixel_count(); i++)
+        if(a.pixel(i).x() != b.pixel(i).x() || a.pixel(i).y() != b.pixel(i).y() || a.pixel(i).z() != b.pixel(i).z())
+            return false;
+    return true;
+}
+
+static void bench_wavefront(){
+    const scene_entry scenes[] = {
+        {"quads", quads},
+        {"cornell_box", cornell_box},
+        {"cornell_smoke", cornell_smoke},
+        {"bouncing_spheres", []() { return bouncing_spheres(); }},
+        {"final_scene", []() { return final_scene(400, 8, 50); }},
+    };
+    struct config {
+        const char* name;
+        int size;
+        bool sort;
+        int packets;
+    };
+    const config configs[] = {
+        {"1k", 1 << 10, true, 0},
+        {"4k", 1 << 12, true, 0},
+        {"16k", 1 << 14, true, 0},
+        {"64k", 1 << 16, true, 0},
+        {"4k unsorted", 1 << 12, false, 0},
+        {"4k pkt 8", 1 << 12, true, 8},
+        {"4k pkt 8 uns.", 1 << 12, false, 8},
+    };
+
+    std::cout << "wavefront: single thread, 200 px, 16 spp, speedup over the recursive integrator\n"
+              << "  " << std::setw(17) << "" << " recursive";
+    for(const auto& c : configs)
+        std::cout << std::setw(14) << c.name;
+    std::cout << '\n';
+    for(const auto& entry : scenes){
+        seed_random(0);
+        auto s = entry.make();
+        s.cam.image_width = 200;
+        s.cam.samples_per_pixel = 16;
+        s.cam.thread_count = 1;
+        s.cam.show_progress = false;
+        auto lights = gather_lights(s.world);
+
+        auto reference = s.cam.render_image(s.world, lights);
+        double recursive = s.cam.stats.rays_per_second() / 1e6;
+        std::cout << "  " << std::left << std::setw(17) << entry.name << std::right
+                  << std::setw(5) << recursive << " Mr/s";
+        for(const auto& c : configs){
+            s.cam.wavefront_size = c.size;
+            s.cam.wavefront_sort = c.sort;
+            s.cam.packet_size = c.packets;
+            auto image = s.cam.render_image(s.world, lights);
+            // Only media may change the image, and only with packets
+            std::cout << std::setw(12) << s.cam.stats.rays_per_second() / 1e6 / recursive << 'x'
+                      << (same_image(image, reference) ? ' ' : '*');
+        }
+        std::cout << '\n';
+    }
+    std::cout << "  * image differs from the recursive one\n";
+}
+
+// ---------------------------------------------------------------------------------------------
+// materials: a bounce's material and texture calls through the kind switches against the same
+// materials behind custom_material and custom_texture wrappers, one virtual call per level as
+// before the switches
+
+template <typename Texture>
+class virtual_texture : public custom_texture {
+    public:
+        template <typename... Args>
+        virtual_texture(Args&&... args) : inner(std::forward<Args>(args)...) {}
+        color value(double u, double v, const point3& p) const override { return inner.value(u, v, p); }
+
+    private:
+        Texture inner;
+};
+
+template <typename Material>
+class virtual_material : public custom_material {
+    public:
+        template <typename... Args>
+        virtual_material(Args&&... args) : inner(std::forward<Args>(args)...) {}
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override{
+            return inner.scatter(r_in, rec, attenuation, scattered);
+        }
+        color emitted(double u, double v, const point3& p) const override { return inner.material::emitted(u, v, p); }
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override{
+            return inner.material::scattering_pdf(r_in, rec, scattered);
+        }
+        bool is_emissive() const override { return inner.material::is_emissive(); }
+
+    private:
+        Material inner;
+};
+
+static double shade_hits(const std::vector<hit_record>& hits, const std::vector<ray>& rays, int rounds){
+    // Mrays/s of one bounce's material work: emission, scattering and its density
+    auto start = bench_clock::now();
+    double sum = 0;
+    for(int round = 0; round < rounds; round++){
+        for(size_t i = 0; i < hits.size(); i++){
+            const hit_record& rec = hits[i];
+            color attenuation;
+            ray scattered;
+            sum += rec.mat->emitted(rec.u, rec.v, rec.p).x();
+            if(rec.mat->scatter(rays[i], rec, attenuation, scattered))
+                sum += attenuation.y() + rec.mat->scattering_pdf(rays[i], rec, scattered);
+        }
+    }
+    bench_sink = sum;
+    return double(hits.size()) * rounds / seconds_since(start) / 1e6;
+}
+
+static void bench_materials(){
+    // The materials of checkered_spheres, perlin_spheres and bouncing_spheres, and a light
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    auto nested_checker = make_shared<checker_texture>(0.5, checker, make_shared<solid_color>(0.8, 0.2, 0.1));
+    auto noise = make_shared<noise_texture>(4);
+    std::vector<shared_ptr<material>> tagged = {
+        make_shared<lambertian>(checker),
+        make_shared<lambertian>(nested_checker),
+        make_shared<lambertian>(noise),
+        make_shared<lambertian>(color(0.4, 0.2, 0.1)),
+        make_shared<metal>(color(0.7, 0.6, 0.5), 0.1),
+        make_shared<dielectric>(1.5),
+        make_shared<diffuse_light>(color(4, 4, 4)),
+    };
+
+    auto v_checker = make_shared<virtual_texture<checker_texture>>(0.32,
+        make_shared<virtual_texture<solid_color>>(color(.2, .3, .1)), make_shared<virtual_texture<solid_color>>(color(.9, .9, .9)));
+    auto v_nested_checker = make_shared<virtual_texture<checker_texture>>(0.5, v_checker,
+        make_shared<virtual_texture<solid_color>>(color(0.8, 0.2, 0.1)));
+    std::vector<shared_ptr<material>> virtuals = {
+        make_shared<virtual_material<lambertian>>(v_checker),
+        make_shared<virtual_material<lambertian>>(v_nested_checker),
+        make_shared<virtual_material<lambertian>>(make_shared<virtual_texture<noise_texture>>(4)),
+        make_shared<virtual_material<lambertian>>(make_shared<virtual_texture<solid_color>>(color(0.4, 0.2, 0.1))),
+        make_shared<virtual_material<metal>>(color(0.7, 0.6, 0.5), 0.1),
+        make_shared<virtual_material<dielectric>>(1.5),
+        make_shared<virtual_material<diffuse_light>>(make_shared<virtual_texture<solid_color>>(color(4, 4, 4))),
+    };
+
+    const int count = 1 << 16;
+    const int rounds = 20;
+    seed_random(5);
+    std::vector<ray> rays;
+    std::vector<int> choice;
+    std::vector<hit_record> hits(count);
+    for(int i = 0; i < count; i++){
+        hit_record& rec = hits[i];
+        rec.p = point3::random(-10, 10);
+        rec.normal = random_unit_vector();
+        rec.t = 1;
+        rec.scale = 0;
+        rec.u = random_double();
+        rec.v = random_double();
+        rays.push_back(ray(rec.p - rec.normal, rec.normal - 0.5 * random_unit_vector()));
+        rec.front_face = dot(rays.back().direction(), rec.normal) < 0;
+        choice.push_back(random_int(0, int(tagged.size()) - 1));
+    }
+
+    std::cout << "materials: emitted, scatter and scattering_pdf of " << count << " hits, single thread\n";
+    for(int mixed = 0; mixed < 2; mixed++){
+        double tagged_rate = 0;
+        for(int variant = 0; variant < 2; variant++){
+            const auto& set = variant == 0 ? tagged : virtuals;
+            for(int i = 0; i < count; i++)
+                hits[i].mat = set[mixed ? choice[i] : i * int(set.size()) / count].get();
+            seed_random(6);
+            double rate = shade_hits(hits, rays, rounds);
+            if(variant == 0){
+                tagged_rate = rate;
+                std::cout << "  " << std::left << std::setw(22) << (mixed ? "shuffled materials" : "materials in runs")
+                          << std::right << "kind switch " << std::setw(6) << rate << " M/s";
+            } else {
+                std::cout << "  virtual " << std::setw(6) << rate << " M/s  (switch " << tagged_rate / rate << "x)\n";
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// bvh_build: build time of random sphere scenes of 100k, 1M and 10M spheres per build thread
+// count, checking that every count builds the same tree
+
+static std::vector<aabb> random_sphere_bounds(size_t count){
+    // Spheres of radius 0.2 to 0.5 at a density that doesn't change with the count
+    double half = 0.5 * std::cbrt(double(count));
+    std::vector<aabb> bounds;
+    bounds.reserve(count);
+    for(size_t i = 0; i < count; i++){
+        point3 center = point3::random(-half, half);
+        double radius = random_double(0.2, 0.5);
+        bounds.push_back(aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius)));
+    }
+    return bounds;
+}
+
+static uint64_t tree_hash(const bvh_builder& builder){
+    // FNV-1a over the node links, leaf ranges and primitive order
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](uint64_t value){ hash = (hash ^ value) * 1099511628211ull; };
+    for(const auto& node : builder.nodes){
+        add(uint64_t(uint32_t(node.right)));
+        add(node.first);
+        add(node.count);
+    }
+    for(uint32_t prim : builder.prim_order)
+        add(prim);
+    return hash;
+}
+
+static void bench_bvh_build(){
+    // 1, 2, 4... threads up to the hardware threads, and at least 4 to check the trees match
+    int hardware = std::max(int(std::thread::hardware_concurrency()), 4);
+    std::vector<int> counts;
+    for(int threads = 1; threads < hardware; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(hardware);
+
+    struct split_config {
+        const char* name;
+        bvh_split split;
+        int max_leaf_size;
+    };
+    const split_config splits[] = {
+        {"median", bvh_split::median, 1},
+        {"sah", bvh_split::sah, 4},
+    };
+
+    std::cout << "bvh_build: bvh_builder over random sphere bounds per thread count ("
+              << std::thread::hardware_concurrency() << " hardware threads)\n";
+    const size_t sizes[] = {100000, 1000000, 10000000};
+    for(size_t size : sizes){
+        seed_random(0);
+        auto bounds = random_sphere_bounds(size);
+        std::cout << "  " << size << " spheres\n";
+        for(const auto& config : splits){
+            std::cout << "    " << std::left << std::setw(7) << config.name << std::right;
+            bvh_options options;
+            options.split = config.split;
+            options.max_leaf_size = config.max_leaf_size;
+            uint64_t serial_hash = 0;
+            double serial_ms = 0;
+            bool same = true;
+            for(int threads : counts){
+                options.build_threads = threads;
+                int builds = size <= 100000 ? 10 : 1;
+                uint64_t hash = 0;
+                auto start = bench_clock::now();
+                for(int i = 0; i < builds; i++){
+                    bvh_builder builder(bounds, options);
+                    hash = tree_hash(builder);
+                }
+                double ms = seconds_since(start) * 1000 / builds;
+                if(threads == 1){
+                    serial_hash = hash;
+                    serial_ms = ms;
+                }
+                same = same && hash == serial_hash;
+                std::cout << "  " << threads << "t " << std::setw(8) << ms << " ms ("
+                          << serial_ms / ms << "x)";
+            }
+            std::cout << (same ? "  same tree\n" : "  * trees differ\n");
+        }
+    }
+
+    // The tree layout also creates its bvh_node objects in parallel
+    seed_random(0);
+    hittable_list spheres;
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    for(const auto& box : random_sphere_bounds(1000000))
+        spheres.add(make_shared<sphere>(box.centroid(), 0.5 * box.x.size(), mat));
+    std::cout << "  make_bvh tree layout, 1000000 spheres, median split\n   ";
+    double serial_ms = 0;
+    for(int threads : counts){
+        bvh_options options;
+        options.build_threads = threads;
+        auto start = bench_clock::now();
+        auto tree = make_bvh(spheres, options);
+        double ms = seconds_since(start) * 1000;
+        if(threads == 1) serial_ms = ms;
+        std::cout << "  " << threads << "t " << std::setw(8) << ms << " ms (" << serial_ms / ms << "x)";
+    }
+    std::cout << '\n';
+}
+
+// ---------------------------------------------------------------------------------------------
+
+struct benchmark {
+    const char* name;
+    void (*run)();
+};
+
+static const benchmark benchmarks[] = {
+    {"rng", bench_rng},
+    {"bvh", bench_bvh},
+    {"aabb", bench_aabb},
+    {"wide", bench_wide},
+    {"occlusion", bench_occlusion},
+    {"integrator", bench_integrator},
+    {"render", bench_render},
+    {"image", bench_image},
+    {"progressive", bench_progressive},
+    {"adaptive", bench_adaptive},
+    {"nee", bench_nee},
+    {"sampler", bench_sampler},
+    {"warp", bench_warp},
+    {"scene_file", bench_scene_file},
+    {"scene_cache", bench_scene_cache},
+    {"mesh", bench_mesh},
+    {"instances", bench_instances},
+    {"precision", bench_precision},
+    {"packed", bench_packed},
+    {"packets", bench_packets},
+    {"wavefront", bench_wavefront},
+    {"materials", bench_materials},
+    {"bvh_build", bench_bvh_build},
+};
+
+int main(int argc, char** argv){
+    std::cout << std::fixed << std::setprecision(2);
+
+    for(const auto& b : benchmarks){
+        bool selected = (argc == 1);
+        for(int i = 1; i < argc; i++)
+            if(std::strcmp(argv[i], b.name) == 0) selected = true;
+        if(selected) b.run();
+    }
+}
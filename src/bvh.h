@@ -4,40 +4,35 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
-#include <algorithm>
+#include "bvh_builder.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include "packed_bvh.h"
 
 class bvh_node: public hittable {
     public:
-        bvh_node(hittable_list list): bvh_node(list.objects, 0, list.objects.size()) {
-            // Creates an implicit copy of the hittable list to be modified
-        }
-
-        bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end){
-            bbox = aabb::empty;
-            for(size_t i = start; i < end; i++){
-                bbox = aabb(bbox, objects[i]->bounding_box());
+        bvh_node(const hittable_list& list, const bvh_options& options = bvh_options(), bvh_stats* stats = nullptr){
+            // Builds the tree over a copy of the list's objects. If stats is given, it receives
+            // the node counts and SAH cost of the finished tree.
+            std::vector<aabb> bounds;
+            bounds.reserve(list.objects.size());
+            for(const auto& object : list.objects)
+                bounds.push_back(object->bounding_box());
+
+            if(bounds.empty()){
+                left = right = make_shared<hittable_list>();
+                bbox = aabb::empty;
+                return;
             }
 
-            int axis = bbox.longest_axis();
-            auto comparator = (axis == 0) ? box_x_compare
-                            : (axis == 1) ? box_y_compare
-                                          : box_z_compare;
-            size_t object_span = end - start;
-
-            if(object_span == 1){
-                left = right = objects[start];
-            } else if(object_span == 2){
-                left = objects[start];
-                right = objects[start+1];
-            } else {
-                std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
-
-                auto mid = start + object_span/2;
-                left = make_shared<bvh_node>(objects, start, mid);
-                right = make_shared<bvh_node>(objects, mid, end);
-            }
+            bvh_builder builder(bounds, options);
+            if(stats) *stats = builder.stats();
+            init(builder, list.objects, 0, int(builder.nodes.size()), bvh_build_thread_count(options));
+        }
 
-            
+        bvh_node(const bvh_builder& builder, const std::vector<shared_ptr<hittable>>& objects, int index, int end, int threads){
+            // The node for builder.nodes[index], whose subtree ends before node end
+            init(builder, objects, index, end, threads);
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
@@ -49,6 +44,24 @@ class bvh_node: public hittable {
             return hit_left || hit_right;
         }
 
+        void hit_packet(ray_packet& packet, uint32_t active) const override{
+            // The rays overlapping the box go on to the children together, in the order hit
+            // takes, until too few are left and they go on one at a time
+            active = packet_box_hits(packet, bbox, active);
+            if(!active) return;
+            if(packet_diverged(packet, active)){
+                hittable::hit_packet(packet, active);
+                return;
+            }
+            left->hit_packet(packet, active);
+            if(right != left) right->hit_packet(packet, active);
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            if(!bbox.hit(r, ray_t)) return false;
+            return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+        }
+
         aabb bounding_box() const override {return bbox;}
 
     private:
@@ -56,23 +69,54 @@ class bvh_node: public hittable {
         shared_ptr<hittable> right;
         aabb bbox;
 
-        static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis){
-            auto a_axis_interval = a->bounding_box().axis_interval(axis);
-            auto b_axis_interval = b->bounding_box().axis_interval(axis);
-            return a_axis_interval.min < b_axis_interval.min;
+        void init(const bvh_builder& builder, const std::vector<shared_ptr<hittable>>& objects, int index, int end, int threads){
+            const auto& node = builder.nodes[index];
+            bbox = node.bbox;
+
+            if(node.is_leaf()){
+                left = right = leaf(builder, objects, node);
+            } else if(threads > 1 && size_t(end - index) >= bvh_parallel_size){
+                // Large subtrees create the right child's nodes on another thread, sharing the
+                // threads by node count like the builder does
+                int right_threads = int(double(threads) * (end - node.right) / (end - index) + 0.5);
+                right_threads = std::min(std::max(right_threads, 1), threads - 1);
+                std::thread right_task([&]{ right = child(builder, objects, node.right, end, right_threads); });
+                left = child(builder, objects, index + 1, node.right, threads - right_threads);
+                right_task.join();
+            } else {
+                left = child(builder, objects, index + 1, node.right, threads);
+                right = child(builder, objects, node.right, end, threads);
+            }
         }
 
-        static bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-            return box_compare(a, b, 0);
+        static shared_ptr<hittable> child(const bvh_builder& builder, const std::vector<shared_ptr<hittable>>& objects,
+                                          int index, int end, int threads){
+            const auto& node = builder.nodes[index];
+            if(node.is_leaf()) return leaf(builder, objects, node);
+            return make_shared<bvh_node>(builder, objects, index, end, threads);
         }
 
-        static bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-            return box_compare(a, b, 1);
-        }
+        static shared_ptr<hittable> leaf(const bvh_builder& builder, const std::vector<shared_ptr<hittable>>& objects, const bvh_build_node& node){
+            // Single primitives are stored directly, larger leaves become a list
+            if(node.count == 1) return objects[builder.prim_order[node.first]];
 
-        static bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-            return box_compare(a, b, 2);
+            auto list = make_shared<hittable_list>();
+            for(uint32_t i = 0; i < node.count; i++)
+                list->add(objects[builder.prim_order[node.first + i]]);
+            return list;
         }
-
 };
+
+inline shared_ptr<hittable> make_bvh(const hittable_list& list, const bvh_options& options = bvh_options(), bvh_stats* stats = nullptr){
+    // Builds the acceleration structure selected by options.layout over the list
+    if(options.layout == bvh_layout::linear)
+        return make_shared<linear_bvh>(list, options, stats);
+    if(options.layout == bvh_layout::wide4)
+        return make_shared<wide_bvh<4>>(list, options, stats);
+    if(options.layout == bvh_layout::wide8)
+        return make_shared<wide_bvh<8>>(list, options, stats);
+    if(options.layout == bvh_layout::packed)
+        return make_shared<packed_bvh>(list, options, stats);
+    return make_shared<bvh_node>(list, options, stats);
+}
 #endif // BVH_H
\ No newline at end of file
@@ -0,0 +1,386 @@
+#ifndef BVH_BUILDER_H
+#define BVH_BUILDER_H
+
+#include "aabb.h"
+#include "simd.h"
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+enum class bvh_split {
+    median, // Split at the object median along the longest axis
+    sah     // Binned surface area heuristic
+};
+
+const int bvh_max_depth = 64; // Depth bound of any built tree (for at most 2^31 primitives)
+const int sah_max_depth = 32;
+
+// Ranges of at least this many primitives are bounded, binned and partitioned in parallel chunks,
+// and their two subtrees are built as separate tasks. The cutoff doesn't depend on the thread
+// count, so every thread count builds the same tree.
+const size_t bvh_parallel_size = size_t(1) << 15;
+
+enum class bvh_layout {
+    tree,   // bvh_node: one heap object per node
+    linear, // linear_bvh: nodes flattened into one array
+    wide4,  // wide_bvh<4>: 4 children per node tested together with SIMD
+    wide8,  // wide_bvh<8>: 8 children per node
+    packed  // packed_bvh: linear nodes over leaves of SoA spheres and quads tested with SIMD
+};
+
+struct bvh_options {
+    bvh_layout layout = bvh_layout::tree; // Which acceleration structure make_bvh creates
+    bvh_split split = bvh_split::median; // How interior nodes are split
+    int sah_bins = 16; // Number of centroid bins evaluated per axis by the SAH split
+    int max_leaf_size = 1; // Largest number of primitives stored in one leaf
+    double traversal_cost = 1.0; // Cost of visiting an interior node relative to one primitive test
+    simd_level simd = simd_level::automatic; // SIMD kernel of the wide and packed layouts
+    int build_threads = 0; // Threads building the tree, 0 for one per hardware thread
+};
+
+inline int bvh_build_thread_count(const bvh_options& options){
+    int threads = options.build_threads;
+    if(threads <= 0) threads = int(std::thread::hardware_concurrency());
+    return threads > 0 ? threads : 1;
+}
+
+template <typename Body>
+void parallel_chunks(size_t start, size_t end, int chunks, const Body& body){
+    // Calls body(chunk, chunk_start, chunk_end) for chunks equal slices of [start, end), the
+    // first on the calling thread and the others on threads of their own
+    size_t count = end - start;
+    std::vector<std::thread> workers;
+    for(int c = 1; c < chunks; c++)
+        workers.emplace_back([&, c]{ body(c, start + count * c / chunks, start + count * (c + 1) / chunks); });
+    body(0, start, start + count / chunks);
+    for(auto& worker : workers) worker.join();
+}
+
+struct bvh_stats {
+    int node_count = 0; // Interior nodes and leaves
+    int leaf_count = 0;
+    int max_depth = 0;
+    double sah_cost = 0; // Expected cost of a random ray, in units of primitive tests
+};
+
+struct bvh_build_node {
+    aabb bbox;
+    int right = -1; // Index of the right child, or -1 for a leaf. The left child is the next node.
+    int axis = 0; // Split axis of interior nodes
+    uint32_t first = 0; // Leaves: first entry in prim_order
+    uint32_t count = 0; // Leaves: number of primitives
+
+    bool is_leaf() const { return right < 0; }
+};
+
+class bvh_builder {
+    // Builds a binary BVH over primitive bounding boxes. Nodes are stored depth first so each
+    // left child directly follows its parent, and leaves refer to a range of prim_order.
+    public:
+        std::vector<bvh_build_node> nodes;
+        std::vector<uint32_t> prim_order; // Indices into the input bounds, grouped by leaf
+
+        bvh_builder(const std::vector<aabb>& bounds, const bvh_options& options)
+            : options(options), bounds(bounds) {
+            int threads = bvh_build_thread_count(options);
+            prim_order.resize(bounds.size());
+            centroids.resize(bounds.size());
+            parallel_chunks(0, bounds.size(), task_count(bounds.size(), threads), [&](int, size_t start, size_t end){
+                for(size_t i = start; i < end; i++){
+                    prim_order[i] = uint32_t(i);
+                    centroids[i] = bounds[i].centroid();
+                }
+            });
+
+            if(!bounds.empty()){
+                nodes.reserve(2 * bounds.size());
+                build(0, bounds.size(), 0, nodes, threads);
+            }
+        }
+
+        bvh_stats stats() const{
+            bvh_stats s;
+            if(nodes.empty()) return s;
+            double root_area = nodes[0].bbox.surface_area();
+            if(root_area <= 0) root_area = 1;
+            accumulate_stats(0, 1, root_area, s);
+            return s;
+        }
+
+    private:
+        const bvh_options options;
+        const std::vector<aabb>& bounds;
+        std::vector<point3> centroids;
+
+        struct bin {
+            aabb bbox;
+            int count = 0;
+        };
+
+        static int task_count(size_t count, int threads){
+            // Small ranges take longer to hand out than to do on one thread
+            return count >= bvh_parallel_size ? threads : 1;
+        }
+
+        int build(size_t start, size_t end, int depth, std::vector<bvh_build_node>& out, int threads){
+            // Appends the subtree over prim_order[start, end) to out, whose right links count from
+            // out's first node. Up to threads threads work on it.
+            int index = int(out.size());
+            out.emplace_back();
+            int tasks = task_count(end - start, threads);
+
+            aabb bbox = aabb::empty;
+            if(tasks == 1){
+                bbox = range_bounds(start, end);
+            } else {
+                std::vector<aabb> chunk_boxes(tasks);
+                parallel_chunks(start, end, tasks, [&](int chunk, size_t first, size_t last){
+                    chunk_boxes[chunk] = range_bounds(first, last);
+                });
+                for(const auto& box : chunk_boxes)
+                    bbox = aabb(bbox, box);
+            }
+            out[index].bbox = bbox;
+
+            // Below sah_max_depth only median splits are made, which bounds the tree depth by
+            // sah_max_depth + log2(n) so traversal stacks of bvh_max_depth entries always suffice.
+            int axis = 0;
+            size_t mid = (options.split == bvh_split::sah && depth < sah_max_depth)
+                ? split_sah(start, end, bbox, axis, tasks)
+                : split_median(start, end, bbox, axis);
+
+            if(mid == start || mid == end){
+                out[index].first = uint32_t(start);
+                out[index].count = uint32_t(end - start);
+                return index;
+            }
+
+            int right;
+            if(tasks > 1){
+                // The right subtree is built into a vector of its own on another thread, with a
+                // share of the threads matching its share of the primitives, then appended
+                int right_threads = int(double(threads) * double(end - mid) / double(end - start) + 0.5);
+                right_threads = std::min(std::max(right_threads, 1), threads - 1);
+                std::vector<bvh_build_node> right_nodes;
+                std::thread right_task([&]{
+                    right_nodes.reserve(2 * (end - mid));
+                    build(mid, end, depth + 1, right_nodes, right_threads);
+                });
+                build(start, mid, depth + 1, out, threads - right_threads);
+                right_task.join();
+
+                right = int(out.size());
+                for(auto& node : right_nodes){
+                    if(!node.is_leaf()) node.right += right;
+                    out.push_back(node);
+                }
+            } else {
+                build(start, mid, depth + 1, out, threads);
+                right = build(mid, end, depth + 1, out, threads);
+            }
+            out[index].right = right;
+            out[index].axis = axis;
+            return index;
+        }
+
+        size_t split_median(size_t start, size_t end, const aabb& bbox, int& axis){
+            // Returns start to make a leaf, otherwise the first primitive of the right child
+            size_t count = end - start;
+            if(count <= size_t(std::max(options.max_leaf_size, 1))) return start;
+
+            axis = bbox.longest_axis();
+            size_t mid = start + count / 2;
+            std::nth_element(prim_order.begin() + start, prim_order.begin() + mid, prim_order.begin() + end,
+                [&](uint32_t a, uint32_t b) {
+                    return bounds[a].axis_interval(axis).min < bounds[b].axis_interval(axis).min;
+                });
+            return mid;
+        }
+
+        size_t split_sah(size_t start, size_t end, const aabb& bbox, int& split_axis, int tasks){
+            size_t count = end - start;
+            if(count == 1) return start;
+
+            // Centroid bounds and bins are gathered per chunk and merged. Boxes merge exactly, so
+            // the result is the same however the range is chunked.
+            interval centroid_bounds[3];
+            if(tasks == 1){
+                centroid_range(start, end, centroid_bounds);
+            } else {
+                std::vector<interval> chunk_extents(3 * tasks);
+                parallel_chunks(start, end, tasks, [&](int chunk, size_t first, size_t last){
+                    centroid_range(first, last, &chunk_extents[3 * chunk]);
+                });
+                for(int chunk = 0; chunk < tasks; chunk++)
+                    for(int axis = 0; axis < 3; axis++)
+                        centroid_bounds[axis] = interval(centroid_bounds[axis], chunk_extents[3 * chunk + axis]);
+            }
+
+            int bin_count = std::max(options.sah_bins, 2);
+            double scale[3];
+            for(int axis = 0; axis < 3; axis++){
+                double size = centroid_bounds[axis].size();
+                scale[axis] = size > 0 ? bin_count / size : 0;
+            }
+
+            // Bins of every axis, filled in one pass over the primitives
+            std::vector<bin> chunk_bins(size_t(tasks) * 3 * bin_count);
+            parallel_chunks(start, end, tasks, [&](int chunk, size_t first, size_t last){
+                bin* bins = &chunk_bins[size_t(chunk) * 3 * bin_count];
+                for(size_t i = first; i < last; i++){
+                    uint32_t prim = prim_order[i];
+                    for(int axis = 0; axis < 3; axis++){
+                        auto& b = bins[axis * bin_count + bin_index(centroids[prim][axis], centroid_bounds[axis].min, scale[axis], bin_count)];
+                        b.bbox = aabb(b.bbox, bounds[prim]);
+                        b.count++;
+                    }
+                }
+            });
+            for(int chunk = 1; chunk < tasks; chunk++){
+                for(int b = 0; b < 3 * bin_count; b++){
+                    const auto& from = chunk_bins[size_t(chunk) * 3 * bin_count + b];
+                    chunk_bins[b].bbox = aabb(chunk_bins[b].bbox, from.bbox);
+                    chunk_bins[b].count += from.count;
+                }
+            }
+
+            std::vector<double> right_area(bin_count);
+            std::vector<int> right_count(bin_count);
+
+            double best_cost = infinity;
+            int best_axis = -1;
+            int best_split = 0;
+
+            for(int axis = 0; axis < 3; axis++){
+                if(scale[axis] <= 0) continue;
+                const bin* bins = &chunk_bins[axis * bin_count];
+
+                // Sweep from the right to get the area and count of every right-hand side
+                aabb right_box = aabb::empty;
+                int right_prims = 0;
+                for(int b = bin_count - 1; b > 0; b--){
+                    right_box = aabb(right_box, bins[b].bbox);
+                    right_prims += bins[b].count;
+                    right_area[b] = right_prims ? right_box.surface_area() : 0;
+                    right_count[b] = right_prims;
+                }
+
+                // Then sweep from the left, splitting in front of bin b
+                aabb left_box = aabb::empty;
+                int left_prims = 0;
+                for(int b = 1; b < bin_count; b++){
+                    left_box = aabb(left_box, bins[b-1].bbox);
+                    left_prims += bins[b-1].count;
+                    if(left_prims == 0 || right_count[b] == 0) continue;
+
+                    double cost = left_prims * left_box.surface_area() + right_count[b] * right_area[b];
+                    if(cost < best_cost){
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_split = b;
+                    }
+                }
+            }
+
+            bool fits_leaf = count <= size_t(std::max(options.max_leaf_size, 1));
+            if(best_axis < 0){
+                // All centroids coincide, no bin split separates them
+                return fits_leaf ? start : split_median(start, end, bbox, split_axis);
+            }
+
+            double area = bbox.surface_area();
+            best_cost = options.traversal_cost + (area > 0 ? best_cost / area : double(count));
+            if(fits_leaf && double(count) <= best_cost) return start;
+
+            split_axis = best_axis;
+            double min = centroid_bounds[best_axis].min, axis_scale = scale[best_axis];
+            return partition(start, end, tasks, [&](uint32_t prim) {
+                return bin_index(centroids[prim][best_axis], min, axis_scale, bin_count) < best_split;
+            });
+        }
+
+        template <typename Predicate>
+        size_t partition(size_t start, size_t end, int tasks, const Predicate& goes_left){
+            // Moves the primitives of prim_order[start, end) that go left in front of the others
+            // and returns where the others begin. Large ranges are partitioned stably, in chunks:
+            // each chunk counts its left primitives, then scatters them to offsets that follow
+            // from the counts. Being stable, the order doesn't depend on the chunking.
+            if(end - start < bvh_parallel_size){
+                auto mid = std::partition(prim_order.begin() + start, prim_order.begin() + end, goes_left);
+                return size_t(mid - prim_order.begin());
+            }
+
+            std::vector<size_t> left_counts(tasks), chunk_sizes(tasks);
+            parallel_chunks(start, end, tasks, [&](int chunk, size_t first, size_t last){
+                size_t lefts = 0;
+                for(size_t i = first; i < last; i++)
+                    lefts += goes_left(prim_order[i]) ? 1 : 0;
+                left_counts[chunk] = lefts;
+                chunk_sizes[chunk] = last - first;
+            });
+            size_t total_left = 0;
+            for(size_t lefts : left_counts) total_left += lefts;
+
+            std::vector<size_t> left_offsets(tasks), right_offsets(tasks);
+            size_t left_offset = 0, right_offset = total_left;
+            for(int chunk = 0; chunk < tasks; chunk++){
+                left_offsets[chunk] = left_offset;
+                right_offsets[chunk] = right_offset;
+                left_offset += left_counts[chunk];
+                right_offset += chunk_sizes[chunk] - left_counts[chunk];
+            }
+
+            std::vector<uint32_t> sorted(end - start);
+            parallel_chunks(start, end, tasks, [&](int chunk, size_t first, size_t last){
+                size_t left = left_offsets[chunk], right = right_offsets[chunk];
+                for(size_t i = first; i < last; i++){
+                    uint32_t prim = prim_order[i];
+                    sorted[goes_left(prim) ? left++ : right++] = prim;
+                }
+            });
+            parallel_chunks(start, end, tasks, [&](int, size_t first, size_t last){
+                std::copy(sorted.begin() + (first - start), sorted.begin() + (last - start), prim_order.begin() + first);
+            });
+            return start + total_left;
+        }
+
+        aabb range_bounds(size_t start, size_t end) const{
+            aabb box = aabb::empty;
+            for(size_t i = start; i < end; i++)
+                box = aabb(box, bounds[prim_order[i]]);
+            return box;
+        }
+
+        void centroid_range(size_t start, size_t end, interval* extent) const{
+            // Grows extent[0..2] to the centroids of prim_order[start, end)
+            for(size_t i = start; i < end; i++){
+                const point3& c = centroids[prim_order[i]];
+                for(int axis = 0; axis < 3; axis++)
+                    extent[axis] = interval(extent[axis], interval(c[axis], c[axis]));
+            }
+        }
+
+        static int bin_index(double centroid, double min, double scale, int bin_count){
+            int b = int((centroid - min) * scale);
+            return b < 0 ? 0 : (b >= bin_count ? bin_count - 1 : b);
+        }
+
+        void accumulate_stats(int index, int depth, double root_area, bvh_stats& s) const{
+            const auto& node = nodes[index];
+            double relative_area = node.bbox.surface_area() / root_area;
+            s.node_count++;
+            s.max_depth = std::max(s.max_depth, depth);
+
+            if(node.is_leaf()){
+                s.leaf_count++;
+                s.sah_cost += relative_area * node.count;
+                return;
+            }
+            s.sah_cost += relative_area * options.traversal_cost;
+            accumulate_stats(index + 1, depth + 1, root_area, s);
+            accumulate_stats(node.right, depth + 1, root_area, s);
+        }
+};
+
+#endif // BVH_BUILDER_H
@@ -1,13 +1,44 @@
 #ifndef CAMERA_H
 #define CAMERA_H
+#include "checkpoint.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "hittable_list.h"
+#include "image_writer.h"
 #include "material.h"
+#include "wavefront.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
+struct render_stats {
+    // Work done by the last render
+    uint64_t paths = 0; // Camera samples traced
+    std::vector<uint32_t> pixel_samples; // Samples taken per pixel, row-major (varies with adaptive sampling)
+    uint64_t rays = 0; // Rays cast into the world, i.e. path segments
+    double seconds = 0; // Wall time of the render
+
+    double average_path_length() const { return paths ? double(rays) / paths : 0; }
+    double average_samples() const { return pixel_samples.empty() ? 0 : double(paths) / pixel_samples.size(); }
+    double rays_per_second() const { return seconds > 0 ? rays / seconds : 0; }
+};
+
 class camera{
     public:
     double aspect_ratio = 1.0; // Ratio of image width over image height
     int image_width = 100; // Rendered image width in pixel count
     int samples_per_pixel = 10; // Number of samples per pixel for anti-aliasing
-    int max_depth = 10; // Maximum recursion depth for ray tracing
+    int max_depth = 10; // Maximum number of bounces of a path
+    int russian_roulette_depth = 3; // Bounces after which Russian roulette may end dim paths (< 0 disables it)
     double vfov = 90.0; // Vertical field of view in degrees
     point3 lookfrom = point3(0, 0, 0); // Camera position in world space
     point3 lookat = point3(0,0, -1); // Point in world space the camera is looking at
@@ -16,32 +47,117 @@ class camera{
     double focus_dist = 10; // Focus distance for depth of field effect (not implemented)
     color background = color(0,0,0); // Background color for rays that miss all objects
 
-    void render(const hittable& world){
+    int thread_count = 0; // Number of render threads (0 uses the hardware concurrency)
+    int tile_size = 16; // Edge length in pixels of the square tiles handed to render threads
+    int packet_size = 0; // Camera rays of 4, 8 or 16 neighbouring pixels traced together (0 traces each alone)
+    int wavefront_size = 0; // Paths in flight per render thread for the wavefront integrator (0 traces each path alone)
+    bool wavefront_sort = true; // Sort the wavefront's rays by direction and origin, and its hits by material
+    uint64_t seed = 0; // Base seed, each pixel sample draws from its own stream derived from it
+    bool sample_lights = false; // Next event estimation: sample the lights at diffuse bounces, combined with MIS
+    sampler_type sampling = sampler_type::sobol; // Sequence behind the pixel, lens, time and path vertex samples
+
+    // Adaptive sampling: once a pixel has adaptive_min_samples, it stops when the standard error
+    // of its luminance, carried through the gamma 2 output encoding, falls below
+    // adaptive_threshold. samples_per_pixel is the upper bound. Pixels are checked between passes,
+    // which hold adaptive_min_samples samples unless samples_per_pass is set.
+    double adaptive_threshold = 0; // Error target in output values of 0..1 (0 disables adaptive sampling)
+    int adaptive_min_samples = 16; // Samples every pixel takes before it may stop
+
+    int samples_per_pass = 0; // Samples added to every pixel per progressive pass (0 renders all in one pass)
+    std::string checkpoint_path; // If set, progress is saved here after passes and resumed from here
+    double checkpoint_interval = 60; // Minimum seconds between checkpoints (the last pass always saves one)
+
+    std::string output_path; // Image file written by render(), format by extension (.png, .pfm, .ppm); empty writes PPM to stdout
+    bool show_progress = true; // Report remaining tiles on std::clog while rendering
+    render_stats stats; // Filled in by every render
 
+    bool render(const hittable& world, const hittable_list& lights = hittable_list()){
+        // Renders and writes the image to output_path, returns false if writing failed
+        auto image = render_image(world, lights);
+
+        bool written;
+        if(output_path.empty()){
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            written = write_ppm(std::cout, image);
+        } else {
+            written = write_image(output_path, image);
+        }
+
+        if(show_progress){
+            std::clog << "\rDone. " << stats.rays << " rays, average path length "
+                      << stats.average_path_length() << ", " << stats.rays_per_second() / 1e6
+                      << " Mrays/s";
+            if(adaptive_threshold > 0) std::clog << ", " << stats.average_samples() << " samples per pixel";
+            std::clog << '\n';
+        }
+        return written;
+    };
+
+    framebuffer render_image(const hittable& world, const hittable_list& lights = hittable_list()){
+        // Renders the image into a framebuffer of linear colors. lights lists the
+        // emitters to sample when sample_lights is set, see gather_lights.
         initialize();
-        std::cout<<"P3\n" << image_width << ' ' << image_height << "\n255\n";
+        auto start = std::chrono::steady_clock::now();
+        auto last_checkpoint = start;
+        stats = render_stats();
 
-        for (int j=0; j < image_height; j++){
+        // Samples are summed per pixel and added in passes of samples_per_pass. With a
+        // checkpoint_path the sums are saved after passes, and a matching checkpoint found
+        // there at the start is resumed instead of starting over.
+        render_checkpoint state;
+        std::string checkpoint_error;
+        if(!checkpoint_path.empty() && state.load(checkpoint_path, checkpoint_error)
+           && (checkpoint_error = resume_mismatch(state)).empty()){
+            if(show_progress)
+                std::clog << "Resuming " << checkpoint_path << " at " << state.samples << " samples\n";
+        } else {
+            if(!checkpoint_error.empty())
+                std::cerr << "Not resuming " << checkpoint_path << ": " << checkpoint_error << ".\n";
+            state.reset(image_width, image_height, seed, int32_t(sampling), samples_per_pixel);
+        }
 
-            std::clog << "\rScanlines remaining: " << (image_height-j) << ' ' << std::flush;
+        // Adaptive renders need passes to check the pixels between
+        int pass_size = samples_per_pixel;
+        if(samples_per_pass > 0) pass_size = samples_per_pass;
+        else if(adaptive_threshold > 0) pass_size = std::max(1, adaptive_min_samples);
 
-            for (int i=0; i<image_width; i++){
-                color pixel_color(0,0,0);
-                for(int sample = 0; sample < samples_per_pixel; sample++){
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r,max_depth, world);
-                }
-                write_color(std::cout, pixel_color * pixel_sample_scale);
+        // Pixels still sampling. Those behind the checkpoint's sample count stopped earlier.
+        std::vector<uint8_t> active(state.pixel_samples.size());
+        for(size_t p = 0; p < active.size(); p++)
+            active[p] = state.pixel_samples[p] == uint32_t(state.samples);
+
+        while(state.samples < samples_per_pixel){
+            if(adaptive_threshold > 0) stop_converged_pixels(state, active);
+            int pass_end = std::min(samples_per_pixel, state.samples + pass_size);
+            render_pass(world, lights, state, active, state.samples, pass_end);
+            state.samples = pass_end;
+
+            auto now = std::chrono::steady_clock::now();
+            bool finished = state.samples == samples_per_pixel;
+            if(!checkpoint_path.empty()
+               && (finished || std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval)){
+                if(!state.save(checkpoint_path))
+                    std::cerr << "Could not write checkpoint " << checkpoint_path << ".\n";
+                last_checkpoint = now;
             }
-    }
+        }
 
-    std::clog << "\rDone.           \n";
-    };
+        framebuffer image(image_width, image_height);
+        for(size_t p = 0; p < image.pixel_count(); p++){
+            auto n = state.pixel_samples[p];
+            image.set_pixel(p, n > 0 ? state.accum[p] / double(n) : color(0,0,0));
+        }
+        stats.pixel_samples = std::move(state.pixel_samples);
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return image;
+    }
 
     private:
     int image_height; // Rendered image height in pixel count
     point3 center; // Camera position in world space
-    double pixel_sample_scale; // Scale factor for pixel sampling
     point3 pixel00_loc; // World space location of the center of the upper left pixel
     vec3 pixel_delta_u; // World space vector to move one pixel right
     vec3 pixel_delta_v; // World space vector to move one pixel down
@@ -49,11 +165,452 @@ class camera{
     vec3 defocus_u; // Defocus vectors for depth of field effect (not implemented)
     vec3 defocus_v; // Defocus vectors for depth of field effect (not implemented)
 
+    // Sampler dimensions taken by the camera (pixel 2, lens 2, time 1), then by each path vertex
+    static const int camera_dimensions = 5;
+    static const int vertex_dimensions = 8;
+
+    std::string resume_mismatch(const render_checkpoint& state) const{
+        // Why this camera can't continue the checkpoint's render, empty if it can
+        if(state.width != image_width || state.height != image_height) return "it has another image size";
+        if(state.seed != seed) return "it has another seed";
+        if(state.sampler != int32_t(sampling)) return "it was rendered with another sampler";
+        if(state.samples > samples_per_pixel) return "it has more samples than requested";
+        if((sampling == sampler_type::stratified || sampling == sampler_type::halton)
+           && state.sampler_samples != samples_per_pixel)
+            return "stratified and Halton renders only resume at the samples per pixel they started with ("
+                   + std::to_string(state.sampler_samples) + ")";
+        return "";
+    }
+
+    int render_thread_count(int tile_count) const{
+        // Use the configured thread count, or one thread per hardware thread by default
+        int threads = thread_count;
+        if(threads <= 0) threads = int(std::thread::hardware_concurrency());
+        if(threads <= 0) threads = 1;
+        return (threads < tile_count) ? threads : tile_count;
+    }
+
+    void render_pass(const hittable& world, const hittable_list& lights, render_checkpoint& state,
+                     const std::vector<uint8_t>& active, int sample_begin, int sample_end){
+        // Adds samples [sample_begin, sample_end) to every pixel that is still sampling. The
+        // image is split into tiles which worker threads claim one at a time, and every pixel is
+        // written to its own slot of the state. Pixel samples reseed the thread's generator,
+        // which makes the image independent of the thread count, tile schedule and pass size.
+        std::atomic<uint64_t> total_paths(0);
+        std::atomic<uint64_t> total_rays(0);
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        int tiles_y = (image_height + tile_size - 1) / tile_size;
+        int tile_count = tiles_x * tiles_y;
+
+        std::atomic<int> next_tile(0);
+        std::atomic<int> tiles_done(0);
+        std::mutex log_mutex;
+
+        auto tile_done = [&]() {
+            int done = ++tiles_done;
+            if(!show_progress) return;
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::clog << "\rSamples " << sample_end << '/' << samples_per_pixel
+                      << ", tiles remaining: " << (tile_count - done) << ' ' << std::flush;
+        };
+
+        auto worker = [&]() {
+            render_stats local;
+            auto pixel_sampler = make_sampler(sampling, seed, samples_per_pixel);
+            active_sampler() = pixel_sampler.get();
+            if(wavefront_size > 0){
+                auto claim_tile = [&]() {
+                    int tile = next_tile++;
+                    return tile < tile_count ? tile : -1;
+                };
+                render_wavefront(world, lights, state, active, sample_begin, sample_end, *pixel_sampler, local,
+                                 claim_tile, tile_done);
+            } else {
+                for(int tile = next_tile++; tile < tile_count; tile = next_tile++){
+                    render_tile(world, lights, tile % tiles_x, tile / tiles_x, state, active, sample_begin, sample_end,
+                                *pixel_sampler, local);
+                    tile_done();
+                }
+            }
+            active_sampler() = nullptr;
+            total_paths += local.paths;
+            total_rays += local.rays;
+        };
+
+        int threads = render_thread_count(tile_count);
+        std::vector<std::thread> workers;
+        for(int t = 1; t < threads; t++)
+            workers.emplace_back(worker);
+        worker();
+        for(auto& w : workers)
+            w.join();
+
+        stats.paths += total_paths;
+        stats.rays += total_rays;
+    }
+
+    void render_tile(const hittable& world, const hittable_list& lights, int tile_x, int tile_y,
+                     render_checkpoint& state, const std::vector<uint8_t>& active,
+                     int sample_begin, int sample_end, sampler& pixel_sampler, render_stats& tile_stats){
+        const hittable_list* light_list = (sample_lights && !lights.objects.empty()) ? &lights : nullptr;
+        int i_end = std::min(image_width, (tile_x + 1) * tile_size);
+        int j_end = std::min(image_height, (tile_y + 1) * tile_size);
+
+        if(packet_size > 0){
+            render_tile_packets(world, light_list, tile_x, tile_y, state, active, sample_begin, sample_end,
+                                pixel_sampler, tile_stats);
+            return;
+        }
+
+        for (int j = tile_y * tile_size; j < j_end; j++){
+            for (int i = tile_x * tile_size; i < i_end; i++){
+                uint64_t pixel_index = uint64_t(j) * image_width + i;
+                if(!active[pixel_index]) continue;
+                uint32_t n = state.pixel_samples[pixel_index];
+
+                color pixel_color = state.accum[pixel_index];
+                double mean = state.luminance_mean[pixel_index];
+                double m2 = state.luminance_m2[pixel_index];
+                for(int sample = sample_begin; sample < sample_end; sample++){
+                    ray r = start_pixel_sample(pixel_index, sample, pixel_sampler);
+                    add_sample(ray_color(r, world, light_list, tile_stats), pixel_color, n, mean, m2);
+                }
+                state.accum[pixel_index] = pixel_color;
+                state.pixel_samples[pixel_index] = n;
+                state.luminance_mean[pixel_index] = mean;
+                state.luminance_m2[pixel_index] = m2;
+            }
+        }
+    }
+
+    void render_tile_packets(const hittable& world, const hittable_list* light_list, int tile_x, int tile_y,
+                             render_checkpoint& state, const std::vector<uint8_t>& active,
+                             int sample_begin, int sample_end, sampler& pixel_sampler, render_stats& tile_stats){
+        // render_tile with the camera rays of blocks of 2x2, 4x2 or 4x4 pixels traced as one
+        // packet per sample. Every lane then replays its pixel sample's camera ray to leave the
+        // generators where a single ray would have them and follows its path from the packet's
+        // hit, so the image is the same as without packets. The exception is media, whose hits
+        // draw random numbers and so take other draws in a packet.
+        int block_w = packet_size >= 8 ? 4 : 2;
+        int block_h = packet_size >= 16 ? 4 : 2;
+        int i_end = std::min(image_width, (tile_x + 1) * tile_size);
+        int j_end = std::min(image_height, (tile_y + 1) * tile_size);
+
+        ray_packet packet;
+        packet.level = resolve_simd_level(simd_level::automatic);
+        uint64_t pixels[max_packet_size];
+        color pixel_color[max_packet_size];
+        double mean[max_packet_size], m2[max_packet_size];
+        uint32_t n[max_packet_size];
+
+        for(int block_j = tile_y * tile_size; block_j < j_end; block_j += block_h){
+            for(int block_i = tile_x * tile_size; block_i < i_end; block_i += block_w){
+                int lanes = 0;
+                for(int j = block_j; j < std::min(j_end, block_j + block_h); j++){
+                    for(int i = block_i; i < std::min(i_end, block_i + block_w); i++){
+                        uint64_t pixel_index = uint64_t(j) * image_width + i;
+                        if(!active[pixel_index]) continue;
+                        pixels[lanes] = pixel_index;
+                        pixel_color[lanes] = state.accum[pixel_index];
+                        mean[lanes] = state.luminance_mean[pixel_index];
+                        m2[lanes] = state.luminance_m2[pixel_index];
+                        n[lanes] = state.pixel_samples[pixel_index];
+                        lanes++;
+                    }
+                }
+                if(lanes == 0) continue;
+
+                packet.size = lanes;
+                for(int sample = sample_begin; sample < sample_end; sample++){
+                    for(int lane = 0; lane < lanes; lane++)
+                        packet.rays[lane] = start_pixel_sample(pixels[lane], sample, pixel_sampler);
+                    packet.start(0, infinity);
+                    world.hit_packet(packet, packet.all());
+
+                    for(int lane = 0; lane < lanes; lane++){
+                        ray r = start_pixel_sample(pixels[lane], sample, pixel_sampler);
+                        add_sample(ray_color(r, world, light_list, tile_stats, &packet, lane),
+                                   pixel_color[lane], n[lane], mean[lane], m2[lane]);
+                    }
+                }
+
+                for(int lane = 0; lane < lanes; lane++){
+                    state.accum[pixels[lane]] = pixel_color[lane];
+                    state.pixel_samples[pixels[lane]] = n[lane];
+                    state.luminance_mean[pixels[lane]] = mean[lane];
+                    state.luminance_m2[pixels[lane]] = m2[lane];
+                }
+            }
+        }
+    }
+
+    template <typename ClaimTile, typename TileDone>
+    void render_wavefront(const hittable& world, const hittable_list& lights, render_checkpoint& state,
+                          const std::vector<uint8_t>& active, int sample_begin, int sample_end,
+                          sampler& pixel_sampler, render_stats& thread_stats,
+                          ClaimTile&& claim_tile, TileDone&& tile_done){
+        // The wavefront integrator: the paths of the tiles this thread claims, wavefront_size at
+        // a time, advanced one stage at a time over the whole batch. Camera rays fill the slots of
+        // finished paths, then the batch's rays are intersected, their hits shaded and the shadow
+        // rays of the light samples taken while shading traced. Each stage runs one kind of code
+        // over many rays, with wavefront_sort binned by direction and origin, or by material
+        // kind for shading. With packet_size set, consecutive rays are intersected as packets.
+        //
+        // Paths restore their own generators in every stage, so they draw what ray_color would
+        // and the image is the same. The exceptions are media traced in packets, and media with
+        // the independent sampler, where a blocked shadow ray's draws move behind the Russian
+        // roulette draw. A tile's samples are added to the state in order once all its paths
+        // have finished.
+        const hittable_list* light_list = (sample_lights && !lights.objects.empty()) ? &lights : nullptr;
+        int samples = sample_end - sample_begin;
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        aabb bounds = world.bounding_box();
+
+        struct tile_work {
+            std::vector<uint64_t> pixels; // Pixels still sampling
+            std::vector<color> colors; // Sample colors, all of a pixel's in a row
+            size_t started = 0; // Samples given to paths
+            size_t remaining = 0; // Samples whose paths haven't finished
+        };
+        std::vector<tile_work> tiles;
+        std::vector<uint32_t> free_tiles;
+        int open_tile = -1; // Tile new paths are taken from
+        bool tiles_left = true;
+
+        std::vector<wavefront_path> paths(wavefront_size);
+        std::vector<uint32_t> free_paths;
+        for(int i = wavefront_size - 1; i >= 0; i--)
+            free_paths.push_back(uint32_t(i));
+        std::vector<uint32_t> finished;
+
+        ray_queue rays, next_rays, shadow_rays;
+        std::vector<uint32_t> keys, order, scratch;
+        ray_packet packet;
+        packet.level = resolve_simd_level(simd_level::automatic);
+        auto sort_queue = [&](const ray_queue& queue){
+            if(wavefront_sort){
+                bin_by_direction(queue, bounds, keys, order, scratch);
+            } else {
+                order.resize(queue.size());
+                for(size_t i = 0; i < order.size(); i++) order[i] = uint32_t(i);
+            }
+        };
+
+        for(;;){
+            // Generate: camera rays for the free slots, from the open tile or a newly claimed one
+            while(!free_paths.empty() && (open_tile >= 0 || tiles_left)){
+                if(open_tile < 0){
+                    int tile = claim_tile();
+                    if(tile < 0){
+                        tiles_left = false;
+                        break;
+                    }
+                    uint32_t slot = uint32_t(tiles.size());
+                    if(free_tiles.empty()){
+                        tiles.emplace_back();
+                    } else {
+                        slot = free_tiles.back();
+                        free_tiles.pop_back();
+                    }
+                    tile_work& work = tiles[slot];
+                    work.pixels.clear();
+                    int tile_x = tile % tiles_x, tile_y = tile / tiles_x;
+                    int i_end = std::min(image_width, (tile_x + 1) * tile_size);
+                    int j_end = std::min(image_height, (tile_y + 1) * tile_size);
+                    for(int j = tile_y * tile_size; j < j_end; j++){
+                        for(int i = tile_x * tile_size; i < i_end; i++){
+                            uint64_t pixel_index = uint64_t(j) * image_width + i;
+                            if(active[pixel_index]) work.pixels.push_back(pixel_index);
+                        }
+                    }
+                    work.colors.assign(work.pixels.size() * samples, color(0,0,0));
+                    work.started = 0;
+                    work.remaining = work.colors.size();
+                    if(work.remaining == 0){
+                        free_tiles.push_back(slot);
+                        tile_done();
+                        continue;
+                    }
+                    open_tile = int(slot);
+                }
+
+                tile_work& work = tiles[open_tile];
+                uint32_t index = free_paths.back();
+                free_paths.pop_back();
+                wavefront_path& p = paths[index];
+                p.pixel_index = work.pixels[work.started / samples];
+                p.sample = sample_begin + int(work.started % samples);
+                p.tile = uint32_t(open_tile);
+                p.tile_sample = uint32_t(work.started);
+                p.depth = 0;
+                p.state = path_state();
+                ray r = start_pixel_sample(p.pixel_index, p.sample, pixel_sampler);
+                p.rng = thread_rng();
+                thread_stats.paths++;
+                if(max_depth > 0) rays.push(r, infinity, index);
+                else finished.push_back(index);
+                if(++work.started == work.colors.size()) open_tile = -1;
+            }
+            if(rays.size() == 0 && finished.empty()) break;
+
+            // Intersect: the closest hit of every ray
+            sort_queue(rays);
+            if(packet_size > 0){
+                for(size_t first = 0; first < order.size(); first += size_t(packet.size)){
+                    packet.size = int(std::min(order.size() - first, size_t(std::min(packet_size, max_packet_size))));
+                    for(int lane = 0; lane < packet.size; lane++)
+                        packet.rays[lane] = rays.get(order[first + lane]);
+                    packet.start(0, infinity);
+                    world.hit_packet(packet, packet.all());
+                    for(int lane = 0; lane < packet.size; lane++){
+                        wavefront_path& p = paths[rays.path[order[first + lane]]];
+                        p.found = (packet.hits >> lane) & 1;
+                        if(p.found) p.rec = packet.recs[lane];
+                    }
+                }
+            } else {
+                for(uint32_t i : order){
+                    wavefront_path& p = paths[rays.path[i]];
+                    thread_rng() = p.rng;
+                    p.found = world.hit(rays.get(i), interval(0, rays.tmax[i]), p.rec);
+                    p.rng = thread_rng();
+                }
+            }
+            thread_stats.rays += rays.size();
+
+            // Shade: one bounce at every hit, queueing the paths' next rays and shadow rays
+            if(wavefront_sort){
+                keys.resize(rays.size());
+                for(size_t i = 0; i < rays.size(); i++){
+                    // Materials of one kind run the same scatter code, misses come first
+                    const wavefront_path& p = paths[rays.path[i]];
+                    keys[i] = p.found ? uint32_t(p.rec.mat->kind) + 1 : 0;
+                }
+                radix_sort(keys, 8, order, scratch);
+            }
+            for(uint32_t i : order){
+                uint32_t index = rays.path[i];
+                wavefront_path& p = paths[index];
+                ray r = rays.get(i);
+                thread_rng() = p.rng;
+                pixel_sampler.start_pixel_sample(p.pixel_index, uint32_t(p.sample));
+                pixel_sampler.set_dimension(camera_dimensions + p.depth * vertex_dimensions);
+
+                ray scattered;
+                bool alive = p.found;
+                if(!p.found){
+                    p.state.radiance += p.state.throughput * background;
+                } else {
+                    alive = shade_hit(r, p.rec, light_list, p.depth, p.state, scattered, thread_stats,
+                                      [&](const ray& to_light, real distance, const color& light){
+                        p.light_sample = light;
+                        shadow_rays.push(to_light, distance, index);
+                    });
+                }
+                p.rng = thread_rng();
+                if(alive && ++p.depth < max_depth) next_rays.push(scattered, infinity, index);
+                else finished.push_back(index);
+            }
+
+            // Shadow: light samples whose shadow rays get through are added
+            sort_queue(shadow_rays);
+            for(uint32_t i : order){
+                wavefront_path& p = paths[shadow_rays.path[i]];
+                thread_rng() = p.rng;
+                if(!world.occluded(shadow_rays.get(i), interval(0, shadow_rays.tmax[i])))
+                    p.state.radiance += p.light_sample;
+                p.rng = thread_rng();
+            }
+
+            // Finish: ended paths hand their color to their tile, and finished tiles go to the state
+            for(uint32_t index : finished){
+                const wavefront_path& p = paths[index];
+                tile_work& work = tiles[p.tile];
+                work.colors[p.tile_sample] = p.state.radiance;
+                free_paths.push_back(index);
+                if(--work.remaining > 0) continue;
+
+                for(size_t k = 0; k < work.pixels.size(); k++){
+                    uint64_t pixel_index = work.pixels[k];
+                    color pixel_color = state.accum[pixel_index];
+                    uint32_t n = state.pixel_samples[pixel_index];
+                    double mean = state.luminance_mean[pixel_index];
+                    double m2 = state.luminance_m2[pixel_index];
+                    for(int s = 0; s < samples; s++)
+                        add_sample(work.colors[k * samples + s], pixel_color, n, mean, m2);
+                    state.accum[pixel_index] = pixel_color;
+                    state.pixel_samples[pixel_index] = n;
+                    state.luminance_mean[pixel_index] = mean;
+                    state.luminance_m2[pixel_index] = m2;
+                }
+                free_tiles.push_back(p.tile);
+                tile_done();
+            }
+            finished.clear();
+
+            std::swap(rays, next_rays);
+            next_rays.clear();
+            shadow_rays.clear();
+        }
+    }
+
+    static void add_sample(const color& sample_color, color& pixel_color, uint32_t& n, double& mean, double& m2){
+        // Adds a sample to a pixel's sum and to the running mean and M2 of its luminance (Welford)
+        pixel_color += sample_color;
+        double y = luminance(sample_color);
+        double delta = y - mean;
+        mean += delta / ++n;
+        m2 += delta * (y - mean);
+    }
+
+    ray start_pixel_sample(uint64_t pixel_index, int sample, sampler& pixel_sampler){
+        // Seeds the generators for one sample of a pixel and returns its camera ray
+        seed_random(seed, pixel_index, sample);
+        pixel_sampler.start_pixel_sample(pixel_index, uint32_t(sample));
+        return get_ray(int(pixel_index % image_width), int(pixel_index / image_width));
+    }
+
+    void stop_converged_pixels(const render_checkpoint& state, std::vector<uint8_t>& active) const{
+        // A pixel's luminance variance is taken as the larger of its own and the average over
+        // its 5x5 neighbourhood. Paths that rarely find a light often give a pixel only zero
+        // samples at first, and its own zero variance alone would stop it far too early.
+        const int radius = 2;
+        std::vector<double> variance(state.pixel_samples.size(), 0.0);
+        for(size_t p = 0; p < variance.size(); p++){
+            uint32_t n = state.pixel_samples[p];
+            if(n > 1) variance[p] = state.luminance_m2[p] / (n - 1);
+        }
+
+        for(int j = 0; j < image_height; j++){
+            for(int i = 0; i < image_width; i++){
+                size_t p = size_t(j) * image_width + i;
+                uint32_t n = state.pixel_samples[p];
+                if(!active[p] || n < 2 || int(n) < adaptive_min_samples) continue;
+
+                double neighbourhood = 0;
+                int count = 0;
+                for(int y = std::max(0, j - radius); y <= std::min(image_height - 1, j + radius); y++){
+                    for(int x = std::max(0, i - radius); x <= std::min(image_width - 1, i + radius); x++){
+                        neighbourhood += variance[size_t(y) * image_width + x];
+                        count++;
+                    }
+                }
+
+                // The output stores sqrt(luminance), whose error is the luminance error times
+                // the slope 1 / (2 sqrt(luminance)), limited for near-black pixels
+                double pixel_variance = std::max(variance[p], neighbourhood / count);
+                double standard_error = std::sqrt(pixel_variance / n);
+                double slope = 0.5 / std::sqrt(std::max(state.luminance_mean[p], 1e-3));
+                if(standard_error * slope <= adaptive_threshold)
+                    active[p] = 0;
+            }
+        }
+    }
+
     void initialize(){
         // Calculate the image height based on the aspect ratio
         image_height = int(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1: image_height;
-        pixel_sample_scale = 1.0 / samples_per_pixel;
         center = lookfrom;
 
         // Camera
@@ -86,34 +643,132 @@ class camera{
     }
 
 
-    color ray_color(const ray& r, int depth, const hittable& world){
+    static double power_heuristic(double pdf, double other_pdf){
+        // MIS weight of a sample drawn with pdf when other_pdf could also have produced it
+        auto p2 = pdf * pdf;
+        auto sum = p2 + other_pdf * other_pdf;
+        return sum > 0 ? p2 / sum : 0;
+    }
+
+    color ray_color(ray r, const hittable& world, const hittable_list* lights, render_stats& path_stats,
+                    const ray_packet* primary = nullptr, int lane = 0){
+        // Follows one path iteratively, carrying the product of the attenuations so far as its
+        // throughput. Once past russian_roulette_depth a path survives each bounce with a
+        // probability that follows its throughput, and survivors are reweighted to stay unbiased.
+        //
+        // With lights, every diffuse bounce also casts a shadow ray towards a sampled point on a
+        // light. Emitters are then reachable both by that light sample and by the scattered ray,
+        // and the power heuristic weights the two estimates so they sum to one.
+        //
+        // If primary is given, the camera ray r was traced as its ray lane already.
+        path_state path;
+        path_stats.paths++;
 
-        if(depth <= 0){
-            return color(0,0,0);
+        for(int depth = 0; depth < max_depth; depth++){
+            if(sampler* s = active_sampler())
+                s->set_dimension(camera_dimensions + depth * vertex_dimensions);
+            path_stats.rays++;
+            hit_record rec;
+            bool found;
+            if(depth == 0 && primary){
+                found = (primary->hits >> lane) & 1;
+                if(found) rec = primary->recs[lane];
+            } else {
+                found = world.hit(r, interval(0, infinity), rec);
+            }
+            if(!found){
+                path.radiance += path.throughput * background;
+                break;
+            }
+
+            ray scattered;
+            bool alive = shade_hit(r, rec, lights, depth, path, scattered, path_stats,
+                                   [&](const ray& to_light, real distance, const color& light){
+                // The light point is visible if nothing in the world lies in front of it
+                if(!world.occluded(to_light, interval(0, distance)))
+                    path.radiance += light;
+            });
+            if(!alive)
+                break;
+            r = scattered;
         }
-        hit_record rec;
-        if(!world.hit(r, interval(0.001, infinity), rec)){
-            return background;
+
+        return path.radiance;
+    }
+
+    template <typename TraceShadow>
+    bool shade_hit(const ray& r, const hit_record& rec, const hittable_list* lights, int depth,
+                   path_state& path, ray& scattered, render_stats& path_stats, TraceShadow&& trace_shadow){
+        // One bounce of a path at the hit rec of r: adds the light emitted there and scatters,
+        // returning false if the path ends. A light sample's contribution is passed to
+        // trace_shadow(to_light, distance, light), to be added if nothing blocks to_light before
+        // distance. Russian roulette is played here too.
+        // Emitters that aren't in lights are never light sampled and keep their full weight
+        color emitted = rec.mat->emitted(rec.u, rec.v, rec.p);
+        if(lights && path.scatter_pdf > 0 && rec.mat->is_emissive()
+           && lights->occluded(r, interval(0, rec.t * (1 + shadow_epsilon)))){
+            auto light_pdf = lights->pdf_value(path.scatter_origin, r.direction());
+            emitted = emitted * power_heuristic(path.scatter_pdf, light_pdf);
         }
+        path.radiance += path.throughput * emitted;
 
-        ray scattered;
         color attenuation;
-        color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+        if(!rec.mat->scatter(r, rec, attenuation, scattered))
+            return false;
+
+        path.scatter_pdf = lights ? rec.mat->scattering_pdf(r, rec, scattered) : 0;
+        if(path.scatter_pdf > 0){
+            path_stats.rays++;
+            ray to_light;
+            real distance;
+            color light;
+            if(light_sample(r, rec, attenuation, *lights, to_light, distance, light))
+                trace_shadow(to_light, distance, path.throughput * light);
+            path.scatter_origin = scattered.origin();
+        }
+        path.throughput = path.throughput * attenuation;
 
-        if(!rec.mat->scatter(r, rec, attenuation, scattered)){
-            return color_from_emission;
+        if(russian_roulette_depth >= 0 && depth >= russian_roulette_depth){
+            double survival = std::fmin(std::fmax(path.throughput.x(), std::fmax(path.throughput.y(), path.throughput.z())), 0.95);
+            if(sample_1d() >= survival)
+                return false;
+            path.throughput /= survival;
         }
-        
-        color color_from_scatter = attenuation * ray_color(scattered, depth -1, world);
-        return color_from_emission + color_from_scatter;
+        return true;
+    }
+
+    bool light_sample(const ray& r_in, const hit_record& rec, const color& attenuation, const hittable_list& lights,
+                      ray& to_light, real& distance, color& light) const{
+        // Direct light at a diffuse hit from one light sample, if nothing blocks the shadow ray
+        // to_light before distance. Returns false if the sample brings no light either way. The
+        // BSDF times cosine is attenuation * scattering_pdf, as diffuse materials scatter
+        // proportional to it. Diffuse scattered rays leave on the normal's side, so they start
+        // from the same point.
+        point3 origin = rec.spawn_origin(rec.normal);
+        to_light = ray(origin, lights.random(origin), r_in.time());
+        hit_record light_rec;
+        if(!lights.hit(to_light, interval(0, infinity), light_rec))
+            return false;
+
+        auto light_pdf = lights.pdf_value(origin, to_light.direction());
+        auto bsdf_pdf = rec.mat->scattering_pdf(r_in, rec, to_light);
+        if(light_pdf <= 0 || bsdf_pdf <= 0)
+            return false;
+
+        distance = light_rec.t * (1 - shadow_epsilon);
+        color emitted = light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.p);
+        light = attenuation * bsdf_pdf * emitted * (power_heuristic(light_pdf, bsdf_pdf) / light_pdf);
+        return true;
     }
 
     ray get_ray(int i, int j){
+        // Takes the camera's sampler dimensions in a fixed order, whether or not they are used
         auto offset = sample_square();
+        auto lens = defocus_disk_sample();
         auto pixel_sample = pixel00_loc + (i + offset.x()) * pixel_delta_u + (j + offset.y()) * pixel_delta_v;
-        auto ray_origin = (defocus_angle <= 0.0) ? center : defocus_disk_sample();
+        auto ray_origin = (defocus_angle <= 0.0) ? center : lens;
         auto ray_direction = pixel_sample - ray_origin;
-        auto ray_time = random_double();
+        auto ray_time = sample_1d();
         return ray(ray_origin, ray_direction, ray_time);
     }
 
@@ -123,7 +778,8 @@ class camera{
     }
 
     vec3 sample_square(){
-        return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+        auto u = sample_2d();
+        return vec3(u.x - 0.5, u.y - 0.5, 0);
     }
 
 };
@@ -0,0 +1,151 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "color.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct render_checkpoint {
+    // State of a progressive render after a number of complete passes. Every pixel sample
+    // reseeds its sampler from (seed, pixel, sample index), so the seed, the sampler and the
+    // sample counts are the whole RNG state: resuming continues with exactly the samples an
+    // uninterrupted run would take next. Stratified and Halton samples also depend on the
+    // samples per pixel the sampler was built for, so those renders only resume at that count.
+    int width = 0;
+    int height = 0;
+    uint64_t seed = 0;
+    int samples = 0; // Passes are complete up to this sample index
+    int32_t sampler = 0; // sampler_type the samples were drawn with
+    int sampler_samples = 0; // Samples per pixel the sampler was built for
+    std::vector<color> accum; // Per pixel sum of the sample radiances, row-major
+
+    // Per pixel sample count and running luminance mean and sum of squared deviations
+    // (Welford), for adaptive sampling. Pixels that stopped early have fewer than samples.
+    std::vector<uint32_t> pixel_samples;
+    std::vector<double> luminance_mean;
+    std::vector<double> luminance_m2;
+
+    void reset(int w, int h, uint64_t s, int32_t sampler_kind, int sampler_count){
+        width = w;
+        height = h;
+        seed = s;
+        samples = 0;
+        sampler = sampler_kind;
+        sampler_samples = sampler_count;
+        size_t count = size_t(w) * h;
+        accum.assign(count, color(0,0,0));
+        pixel_samples.assign(count, 0);
+        luminance_mean.assign(count, 0.0);
+        luminance_m2.assign(count, 0.0);
+    }
+
+    bool save(const std::string& path) const{
+        // Writes to a temporary file first, so a crash while saving keeps the previous checkpoint
+        std::string temp_path = path + ".tmp";
+        {
+            std::ofstream out(temp_path, std::ios::binary);
+            if(!out) return false;
+
+            out.write(magic(), 4);
+            put(out, format_version());
+            put(out, uint32_t(sizeof(color)));
+            put(out, int32_t(width));
+            put(out, int32_t(height));
+            put(out, seed);
+            put(out, int32_t(samples));
+            put(out, sampler);
+            put(out, int32_t(sampler_samples));
+            put_array(out, accum);
+            put_array(out, pixel_samples);
+            put_array(out, luminance_mean);
+            put_array(out, luminance_m2);
+            if(!out) return false;
+        }
+
+        // rename doesn't replace an existing file everywhere
+        if(std::rename(temp_path.c_str(), path.c_str()) != 0){
+            std::remove(path.c_str());
+            if(std::rename(temp_path.c_str(), path.c_str()) != 0) return false;
+        }
+        return true;
+    }
+
+    bool load(const std::string& path, std::string& error){
+        // Returns false if the file is missing, leaving error empty, or if it can't be resumed,
+        // saying why in error
+        std::ifstream in(path, std::ios::binary);
+        if(!in) return false;
+
+        char file_magic[4];
+        uint32_t file_version, color_size;
+        int32_t w, h, n, kind, count;
+        in.read(file_magic, 4);
+        if(!in || std::string(file_magic, 4) != magic()){
+            error = "not a checkpoint";
+            return false;
+        }
+        if(!get(in, file_version) || file_version != format_version()){
+            error = "from another version";
+            return false;
+        }
+        if(!get(in, color_size) || color_size != sizeof(color)){
+            error = "from a build with another color type";
+            return false;
+        }
+        if(!get(in, w) || !get(in, h) || !get(in, seed) || !get(in, n) || !get(in, kind) || !get(in, count)
+           || w <= 0 || h <= 0 || n < 0){
+            error = "not a checkpoint";
+            return false;
+        }
+
+        // The pixel arrays must fill the rest of the file exactly
+        auto data_start = in.tellg();
+        in.seekg(0, std::ios::end);
+        auto data_size = in.tellg() - data_start;
+        in.seekg(data_start);
+        size_t pixel_bytes = sizeof(color) + sizeof(uint32_t) + 2 * sizeof(double);
+        if(data_size < 0 || uint64_t(data_size) != uint64_t(w) * uint64_t(h) * pixel_bytes){
+            error = "truncated or of the wrong size";
+            return false;
+        }
+
+        reset(w, h, seed, kind, count);
+        samples = n;
+        if(!get_array(in, accum) || !get_array(in, pixel_samples)
+           || !get_array(in, luminance_mean) || !get_array(in, luminance_m2)){
+            error = "truncated or of the wrong size";
+            return false;
+        }
+        return true;
+    }
+
+    private:
+    static const char* magic() { return "RTCK"; }
+    static uint32_t format_version() { return 4; }
+
+    template <typename T>
+    static void put(std::ostream& out, const T& value){
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static bool get(std::istream& in, T& value){
+        return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    template <typename T>
+    static void put_array(std::ostream& out, const std::vector<T>& values){
+        out.write(reinterpret_cast<const char*>(values.data()), std::streamsize(values.size() * sizeof(T)));
+    }
+
+    template <typename T>
+    static bool get_array(std::istream& in, std::vector<T>& values){
+        // values is already sized for the image
+        return bool(in.read(reinterpret_cast<char*>(values.data()), std::streamsize(values.size() * sizeof(T))));
+    }
+};
+
+#endif // CHECKPOINT_H
@@ -4,7 +4,7 @@
 #include "interval.h"
 #include "vec3.h"
 
-using color = vec3;
+using color = basic_vec3<double>; // Double in either precision, for the sums of many samples
 
 inline double linear_to_gamma(double linear_component){
     if(linear_component > 0)
@@ -13,23 +13,24 @@ inline double linear_to_gamma(double linear_component){
     return 0.0;
 }
 
-void write_color(std::ostream& out, const color& pixel_color){
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-    // Apply gamma correction with gamma=2.0.   
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
+inline double luminance(const color& c){
+    // Rec. 709 luminance of a linear color
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
 
-    // Write the translated [0,255] value of each color component.
+inline void color_to_bytes(const color& pixel_color, unsigned char bytes[3]){
+    // Gamma corrects (gamma=2.0) and quantizes a linear color to 8 bits per component
     static const interval intensity(0.0, 0.999);
-    int rbyte = int(256 * intensity.clamp(r));
-    int gbyte = int(256 * intensity.clamp(g));
-    int bbyte = int(256 * intensity.clamp(b));
+    for(int i = 0; i < 3; i++)
+        bytes[i] = (unsigned char)(256 * intensity.clamp(linear_to_gamma(pixel_color[i])));
+}
 
-    // Write the color values to the output stream.
-    out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+void write_color(std::ostream& out, const color& pixel_color){
+    unsigned char bytes[3];
+    color_to_bytes(pixel_color, bytes);
+
+    // Write the translated [0,255] value of each color component.
+    out << int(bytes[0]) << ' ' << int(bytes[1]) << ' ' << int(bytes[2]) << '\n';
 }
 
 #endif // COLOR_H
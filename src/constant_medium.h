@@ -18,6 +18,32 @@ class constant_medium : public hittable {
     {}
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        double t;
+        if (!scatter_distance(r, ray_t, t))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(rec.t);
+        rec.scale = 0;
+
+        rec.normal = vec3(1,0,0);  // arbitrary
+        rec.front_face = true;     // also arbitrary
+        rec.mat = phase_function.get();
+
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        // The medium blocks a shadow ray when it would scatter it inside the interval
+        double t;
+        return scatter_distance(r, ray_t, t);
+    }
+
+    aabb bounding_box() const override { return boundary->bounding_box(); }
+
+  private:
+    bool scatter_distance(const ray& r, interval ray_t, double& t) const {
+        // Samples where the ray scatters inside the boundary, false if it passes through
         hit_record rec1, rec2;
 
         if (!boundary->hit(r, interval::universe, rec1))
@@ -42,19 +68,10 @@ class constant_medium : public hittable {
         if (hit_distance > distance_inside_boundary)
             return false;
 
-        rec.t = rec1.t + hit_distance / ray_length;
-        rec.p = r.at(rec.t);
-
-        rec.normal = vec3(1,0,0);  // arbitrary
-        rec.front_face = true;     // also arbitrary
-        rec.mat = phase_function;
-
+        t = rec1.t + hit_distance / ray_length;
         return true;
     }
 
-    aabb bounding_box() const override { return boundary->bounding_box(); }
-
-  private:
     shared_ptr<hittable> boundary;
     double neg_inv_density;
     shared_ptr<material> phase_function;
@@ -1,16 +1,31 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include "rng.h"
+#include "sampler.h"
 
 // Usings
 using std::make_shared;
 using std::shared_ptr;
 using std::sqrt;
 
+// Scalar type of the geometry: vectors, boxes, ray intervals and intersection math. Single
+// precision halves the size of points and primitives; build with -DRT_SINGLE_PRECISION=ON.
+// shadow_epsilon is how much shorter than the distance to a light shadow rays are, relative to
+// it, so they don't find the light itself.
+#ifdef RT_SINGLE_PRECISION
+typedef float real;
+const real shadow_epsilon = 1e-4f;
+#else
+typedef double real;
+const real shadow_epsilon = 1e-6;
+#endif
+
 // Constants
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
@@ -20,8 +35,8 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 inline double random_double() {
-    // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0,1) from the calling thread's generator.
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
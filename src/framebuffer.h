@@ -0,0 +1,45 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+#include <vector>
+
+class framebuffer {
+    // Linear RGB image held as 32-bit floats, rows from top to bottom, the format the image
+    // writers take as a whole
+    public:
+        framebuffer() {}
+
+        framebuffer(int width, int height)
+            : w(width), h(height), pixels(size_t(width) * height * 3, 0.0f) {}
+
+        int width() const { return w; }
+        int height() const { return h; }
+        size_t pixel_count() const { return size_t(w) * h; }
+
+        color pixel(size_t index) const {
+            const float* p = &pixels[index * 3];
+            return color(p[0], p[1], p[2]);
+        }
+
+        color pixel(int x, int y) const { return pixel(size_t(y) * w + x); }
+
+        void set_pixel(size_t index, const color& c){
+            float* p = &pixels[index * 3];
+            p[0] = float(c.x());
+            p[1] = float(c.y());
+            p[2] = float(c.z());
+        }
+
+        void set_pixel(int x, int y, const color& c){ set_pixel(size_t(y) * w + x, c); }
+
+        // Interleaved RGB floats of row y
+        const float* row(int y) const { return &pixels[size_t(y) * w * 3]; }
+
+    private:
+        int w = 0;
+        int h = 0;
+        std::vector<float> pixels;
+};
+
+#endif // FRAMEBUFFER_H
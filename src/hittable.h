@@ -2,30 +2,118 @@
 #define HITTABLE_H
 # include "interval.h"
 # include "aabb.h"
+# include "simd.h"
+# include <algorithm>
 class material;
 class hit_record{
     public:
         point3 p; // Point of intersection
         vec3 normal; // Normal at the intersection point
-        double t; // Parameter t for the ray equation
+        real t; // Parameter t for the ray equation
+        real scale; // Magnitude of the surface parameters p came from, 0 if no larger than p
         double u; // U texture coordinate
         double v; // V texture coordinate
-        shared_ptr<material> mat; // Pointer to the material of the object hit
+        const material* mat; // Material of the object hit, owned by the object itself
         bool front_face; // Indicates if the ray hit the front or back face of the object
 
         void set_face_normal(const ray& r, const vec3& outward_normal) {
             front_face = dot(r.direction(), outward_normal) < 0;
             normal = front_face ? outward_normal : -outward_normal;
         }
+
+        point3 spawn_origin(const vec3& direction) const {
+            // Origin for a ray leaving p in direction: p moved off the surface on the side the
+            // ray goes to, so rays can start at t = 0 without finding the surface again
+            return offset_ray_origin(p, dot(direction, normal) < 0 ? -normal : normal, scale);
+        }
+
+        ray spawn_ray(const vec3& direction, double time) const {
+            return ray(spawn_origin(direction), direction, time);
+        }
+};
+
+const int max_packet_size = 16;
+
+struct ray_packet {
+    // Up to max_packet_size rays traced together, each with its closest hit so far. The
+    // origins and inverse directions are repeated in structure of arrays form for the SIMD box
+    // tests of packet traversal (ray_packet.h). Lanes from size on are unused.
+    int size = 0;
+    ray rays[max_packet_size];
+    hit_record recs[max_packet_size];
+    uint32_t hits = 0; // Bit mask of the rays that hit something
+    real tmin = 0;
+    alignas(32) real tmax[max_packet_size]; // Shrinks to each ray's closest hit
+    alignas(32) real origin[3][max_packet_size];
+    alignas(32) real inv_dir[3][max_packet_size];
+    simd_level level = simd_level::scalar; // Box test kernel
+
+    void start(real t_min, real t_max){
+        // Resets the hits and fills the arrays from rays[0, size). Unused lanes up to the next
+        // multiple of 8 are zeroed, since box tests load whole SIMD chunks.
+        hits = 0;
+        tmin = t_min;
+        int filled = std::min(max_packet_size, (size + 7) & ~7);
+        for(int lane = 0; lane < filled; lane++){
+            bool used = lane < size;
+            tmax[lane] = t_max;
+            for(int axis = 0; axis < 3; axis++){
+                origin[axis][lane] = used ? rays[lane].origin()[axis] : 0;
+                inv_dir[axis][lane] = used ? rays[lane].inv_direction()[axis] : 0;
+            }
+        }
+    }
+
+    uint32_t all() const { return (uint32_t(1) << size) - 1; }
+    interval lane_interval(int lane) const { return interval(tmin, tmax[lane]); }
+
+    void record_hit(int lane){
+        hits |= uint32_t(1) << lane;
+        tmax[lane] = recs[lane].t;
+    }
 };
 
 class hittable {
     public:
         virtual ~hittable() = default;
 
+        // Finds the closest hit inside ray_t. rec is only written when true is returned.
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
+        // Occlusion query for shadow rays: true if anything is hit inside ray_t. Unlike hit it may
+        // stop at the first intersection found and doesn't compute the hit record.
+        virtual bool occluded(const ray& r, interval ray_t) const {
+            hit_record rec;
+            return hit(r, ray_t, rec);
+        }
+
+        // Closest hits of the packet rays in the active bit mask, recorded in the packet. This
+        // traces them one by one; BVHs share their node visits between the rays.
+        virtual void hit_packet(ray_packet& packet, uint32_t active) const {
+            for(; active; active &= active - 1){
+                int lane = lowest_bit(active);
+                if(hit(packet.rays[lane], packet.lane_interval(lane), packet.recs[lane]))
+                    packet.record_hit(lane);
+            }
+        }
+
         virtual aabb bounding_box() const = 0;
+
+        // Light sampling. pdf_value is the solid angle density of random() directions from origin
+        // towards the object, random returns an (unnormalized) direction from origin to a point on it.
+        virtual double pdf_value(const point3& origin, const vec3& direction) const {
+            (void)origin;
+            (void)direction;
+            return 0.0;
+        }
+
+        virtual vec3 random(const point3& origin) const {
+            (void)origin;
+            return vec3(1,0,0);
+        }
+
+        // True if the object's material emits light, used to gather lights for light sampling
+        virtual bool is_emissive() const { return false; }
 };
 
 class translate: public hittable {
@@ -35,8 +123,8 @@ class translate: public hittable {
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-            // Move ray by offset backwards
-            ray offset_r(r.origin() - offset, r.direction(), r.time());
+            // Move ray by offset backwards, the direction and its inverse are unchanged
+            ray offset_r = r.with_origin(r.origin() - offset);
             // Check for intersectio on offset ray
             if(!object->hit(offset_r, ray_t, rec)) return false;
             // Mobe intersection forward by offset
@@ -44,6 +132,10 @@ class translate: public hittable {
             return true;
         }
 
+        bool occluded(const ray& r, interval ray_t) const override {
+            return object->occluded(r.with_origin(r.origin() - offset), ray_t);
+        }
+
         aabb bounding_box() const override {return bbox; }
     private:
         shared_ptr<hittable> object;
@@ -87,17 +179,7 @@ class rotate_y: public hittable {
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-            auto origin = point3(cos_theta * r.origin().x() - sin_theta * r.origin().z(),
-                                r.origin().y(),
-                                sin_theta * r.origin().x() + cos_theta * r.origin().z());
-            
-            auto direction = vec3(cos_theta * r.direction().x() - sin_theta * r.direction().z(),
-                                r.direction().y(),
-                                sin_theta * r.direction().x() + cos_theta * r.direction().z());
-
-            ray rotated_r(origin, direction, r.time());
-
-            if(!object->hit(rotated_r, ray_t, rec)) return false;
+            if(!object->hit(object_ray(r), ray_t, rec)) return false;
 
             rec.p = point3(cos_theta * rec.p.x() + sin_theta * rec.p.z(),
                             rec.p.y(),
@@ -110,8 +192,25 @@ class rotate_y: public hittable {
             return true;
         }
 
+        bool occluded(const ray& r, interval ray_t) const override {
+            return object->occluded(object_ray(r), ray_t);
+        }
+
         aabb bounding_box() const override { return bbox; }
     private:
+        ray object_ray(const ray& r) const {
+            // Rotates a world space ray into object space
+            auto origin = point3(cos_theta * r.origin().x() - sin_theta * r.origin().z(),
+                                r.origin().y(),
+                                sin_theta * r.origin().x() + cos_theta * r.origin().z());
+
+            auto direction = vec3(cos_theta * r.direction().x() - sin_theta * r.direction().z(),
+                                r.direction().y(),
+                                sin_theta * r.direction().x() + cos_theta * r.direction().z());
+
+            return ray(origin, direction, r.time());
+        }
+
         shared_ptr<hittable> object;
         double cos_theta;
         double sin_theta;
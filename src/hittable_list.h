@@ -2,6 +2,7 @@
 #define HITTABLE_LIST_H
 #include "hittable.h"
 #include<memory>
+#include <vector>
 #include "interval.h"
 #include "aabb.h"
 
@@ -18,23 +19,67 @@ class hittable_list: public hittable {
             }
 
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
-            hit_record temp_rec;
             bool hit_anything = false;
             double closest_so_far = ray_t.max;
 
+            // Objects only write rec on a hit, which is always closer than the previous one
             for (const auto& object : objects) {
-                if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+                if (object->hit(r, interval(ray_t.min, closest_so_far), rec)) {
                     hit_anything = true;
-                    closest_so_far = temp_rec.t;
-                    rec = temp_rec; // Update the record with the closest hit
+                    closest_so_far = rec.t;
                 }
             }
             return hit_anything; // Return true if any object was hit
         }
 
+        void hit_packet(ray_packet& packet, uint32_t active) const override{
+            // Each object sees the packet with the hits of the ones before
+            for (const auto& object : objects)
+                object->hit_packet(packet, active);
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            for (const auto& object : objects) {
+                if (object->occluded(r, ray_t)) return true;
+            }
+            return false;
+        }
+
         aabb bounding_box() const override {return bbox;}
+
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            // Objects are picked uniformly by random(), so the density is the average
+            if(objects.empty()) return 0.0;
+            auto sum = 0.0;
+            for(const auto& object : objects)
+                sum += object->pdf_value(origin, direction);
+            return sum / objects.size();
+        }
+
+        vec3 random(const point3& origin) const override {
+            auto index = random_int(0, int(objects.size()) - 1);
+            return objects[index]->random(origin);
+        }
     private:
         aabb bbox;
 };
 
+inline void gather_lights(const hittable_list& world, hittable_list& lights){
+    // Adds the emissive objects of world to lights, descending into nested lists. Objects inside
+    // BVHs and transforms are not visited.
+    for(const auto& object : world.objects){
+        if(object->is_emissive()){
+            lights.add(object);
+        } else if(auto list = std::dynamic_pointer_cast<hittable_list>(object)){
+            gather_lights(*list, lights);
+        }
+    }
+}
+
+inline hittable_list gather_lights(const hittable_list& world){
+    hittable_list lights;
+    gather_lights(world, lights);
+    return lights;
+}
+
 #endif // HITTABLE_LIST_H
\ No newline at end of file
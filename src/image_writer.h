@@ -0,0 +1,319 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+// Writers that take a whole framebuffer at once: binary PPM (P6) and PNG for 8-bit gamma
+// corrected output, PFM for linear HDR floats. PNGs are compressed with the small deflate
+// encoder below, so no image library is needed.
+
+#include "framebuffer.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+inline std::vector<unsigned char> framebuffer_bytes(const framebuffer& image){
+    // Gamma corrected 8-bit RGB, rows top to bottom
+    std::vector<unsigned char> bytes(image.pixel_count() * 3);
+    for(size_t i = 0; i < image.pixel_count(); i++)
+        color_to_bytes(image.pixel(i), &bytes[i * 3]);
+    return bytes;
+}
+
+inline bool write_ppm(std::ostream& out, const framebuffer& image){
+    auto bytes = framebuffer_bytes(image);
+    out << "P6\n" << image.width() << ' ' << image.height() << "\n255\n";
+    out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+    return bool(out);
+}
+
+inline bool write_pfm(std::ostream& out, const framebuffer& image){
+    // PFM stores rows bottom to top, and the sign of the scale gives the float byte order
+    const uint16_t probe = 1;
+    bool little_endian = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    out << "PF\n" << image.width() << ' ' << image.height() << '\n' << (little_endian ? "-1.0" : "1.0") << '\n';
+    for(int y = image.height() - 1; y >= 0; y--)
+        out.write(reinterpret_cast<const char*>(image.row(y)), std::streamsize(sizeof(float) * 3 * image.width()));
+    return bool(out);
+}
+
+class deflate_encoder {
+    // zlib stream of a single fixed-Huffman deflate block (RFC 1950/1951). Matches are found
+    // with LZ77 hash chains over the 32 KiB window; this gives most of the ratio of a full
+    // encoder for rendered images at a fraction of the code.
+    public:
+        static std::vector<unsigned char> compress(const std::vector<unsigned char>& data){
+            deflate_encoder encoder;
+            encoder.out.push_back(0x78); // 32 KiB window, deflate
+            encoder.out.push_back(0x01); // Fastest compression level, no dictionary
+            encoder.encode(data);
+
+            uint32_t adler = adler32(data);
+            for(int shift = 24; shift >= 0; shift -= 8)
+                encoder.out.push_back((unsigned char)(adler >> shift));
+            return encoder.out;
+        }
+
+        static uint32_t adler32(const std::vector<unsigned char>& data){
+            uint32_t a = 1, b = 0;
+            size_t i = 0;
+            while(i < data.size()){
+                // 5552 bytes is the most that can be summed before b could overflow
+                size_t end = std::min(data.size(), i + 5552);
+                for(; i < end; i++){
+                    a += data[i];
+                    b += a;
+                }
+                a %= 65521;
+                b %= 65521;
+            }
+            return (b << 16) | a;
+        }
+
+    private:
+        static const int window_size = 32768;
+        static const int hash_bits = 15;
+        static const int max_chain = 32;
+        static const int min_match = 3;
+        static const int max_match = 258;
+
+        std::vector<unsigned char> out;
+        uint32_t bit_buffer = 0;
+        int bit_count = 0;
+
+        void write_bits(uint32_t bits, int count){
+            // Deflate packs bits starting at the least significant bit of each byte
+            bit_buffer |= bits << bit_count;
+            bit_count += count;
+            while(bit_count >= 8){
+                out.push_back((unsigned char)bit_buffer);
+                bit_buffer >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        void write_code(uint32_t code, int length){
+            // Huffman codes are defined most significant bit first
+            uint32_t reversed = 0;
+            for(int i = 0; i < length; i++)
+                reversed |= ((code >> i) & 1) << (length - 1 - i);
+            write_bits(reversed, length);
+        }
+
+        void write_literal(int symbol){
+            // Fixed literal/length code of RFC 1951, 3.2.6
+            if(symbol < 144) write_code(0x30 + symbol, 8);
+            else if(symbol < 256) write_code(0x190 + symbol - 144, 9);
+            else if(symbol < 280) write_code(symbol - 256, 7);
+            else write_code(0xc0 + symbol - 280, 8);
+        }
+
+        void write_match(int length, int distance){
+            static const int length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+            static const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            static const int distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                                  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                                  8193, 12289, 16385, 24577};
+            static const int distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                                   7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+            int l = 28;
+            while(length_base[l] > length) l--;
+            write_literal(257 + l);
+            write_bits(uint32_t(length - length_base[l]), length_extra[l]);
+
+            int d = 29;
+            while(distance_base[d] > distance) d--;
+            write_code(uint32_t(d), 5);
+            write_bits(uint32_t(distance - distance_base[d]), distance_extra[d]);
+        }
+
+        static uint32_t hash(const unsigned char* p){
+            uint32_t v = uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+            return (v * 2654435761u) >> (32 - hash_bits);
+        }
+
+        void encode(const std::vector<unsigned char>& data){
+            write_bits(1, 1); // Final block
+            write_bits(1, 2); // Fixed Huffman codes
+
+            const int n = int(data.size());
+            std::vector<int> head(1 << hash_bits, -1);
+            std::vector<int> prev(n > 0 ? n : 1, -1);
+
+            auto insert = [&](int pos) {
+                if(pos + min_match > n) return;
+                uint32_t h = hash(&data[pos]);
+                prev[pos] = head[h];
+                head[h] = pos;
+            };
+
+            int pos = 0;
+            while(pos < n){
+                // Longest match among the most recent positions with the same hash
+                int best_length = 0;
+                int best_distance = 0;
+                if(pos + min_match <= n){
+                    int limit = (n - pos < max_match) ? n - pos : max_match;
+                    int candidate = head[hash(&data[pos])];
+                    for(int chain = 0; candidate >= 0 && chain < max_chain; chain++){
+                        int distance = pos - candidate;
+                        if(distance > window_size) break;
+                        int length = 0;
+                        while(length < limit && data[candidate + length] == data[pos + length])
+                            length++;
+                        if(length > best_length){
+                            best_length = length;
+                            best_distance = distance;
+                            if(length == limit) break;
+                        }
+                        candidate = prev[candidate];
+                    }
+                }
+
+                if(best_length >= min_match){
+                    write_match(best_length, best_distance);
+                    for(int i = 0; i < best_length; i++)
+                        insert(pos + i);
+                    pos += best_length;
+                } else {
+                    write_literal(data[pos]);
+                    insert(pos);
+                    pos++;
+                }
+            }
+
+            write_literal(256); // End of block
+            if(bit_count > 0) write_bits(0, 8 - bit_count);
+        }
+};
+
+inline uint32_t png_crc32(const unsigned char* data, size_t length, uint32_t crc = 0){
+    static const struct crc_table {
+        uint32_t entries[256];
+        crc_table(){
+            for(uint32_t n = 0; n < 256; n++){
+                uint32_t c = n;
+                for(int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                entries[n] = c;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++)
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline void write_png_chunk(std::ostream& out, const char type[4], const std::vector<unsigned char>& data){
+    auto put_u32 = [&](uint32_t v) {
+        unsigned char b[4] = {(unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char)v};
+        out.write(reinterpret_cast<const char*>(b), 4);
+    };
+
+    put_u32(uint32_t(data.size()));
+    out.write(type, 4);
+    out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+    uint32_t crc = png_crc32(reinterpret_cast<const unsigned char*>(type), 4);
+    crc = png_crc32(data.data(), data.size(), crc);
+    put_u32(crc);
+}
+
+inline bool write_png(std::ostream& out, const framebuffer& image){
+    const int width = image.width();
+    const int height = image.height();
+    const size_t stride = size_t(width) * 3;
+    auto bytes = framebuffer_bytes(image);
+
+    // Filter every row with the PNG filter that minimizes the sum of absolute residuals, the
+    // heuristic libpng uses, then compress all rows as one zlib stream
+    std::vector<unsigned char> filtered;
+    filtered.reserve((stride + 1) * height);
+    std::vector<unsigned char> candidate(stride);
+    std::vector<unsigned char> best(stride);
+    const std::vector<unsigned char> zero_row(stride, 0);
+
+    for(int y = 0; y < height; y++){
+        const unsigned char* row = &bytes[y * stride];
+        const unsigned char* up = y > 0 ? &bytes[(y - 1) * stride] : zero_row.data();
+
+        long best_cost = -1;
+        int best_filter = 0;
+        for(int filter = 0; filter < 5; filter++){
+            long cost = 0;
+            for(size_t i = 0; i < stride; i++){
+                int a = i >= 3 ? row[i - 3] : 0;
+                int b = up[i];
+                int c = i >= 3 ? up[i - 3] : 0;
+                int predicted = 0;
+                switch(filter){
+                    case 1: predicted = a; break;
+                    case 2: predicted = b; break;
+                    case 3: predicted = (a + b) / 2; break;
+                    case 4: {
+                        int p = a + b - c;
+                        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                        predicted = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                        break;
+                    }
+                }
+                candidate[i] = (unsigned char)(row[i] - predicted);
+                cost += std::abs((signed char)candidate[i]);
+            }
+            if(best_cost < 0 || cost < best_cost){
+                best_cost = cost;
+                best_filter = filter;
+                best.swap(candidate);
+            }
+        }
+
+        filtered.push_back((unsigned char)best_filter);
+        filtered.insert(filtered.end(), best.begin(), best.end());
+    }
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.write(reinterpret_cast<const char*>(signature), 8);
+
+    std::vector<unsigned char> header = {
+        (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+        (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+        8, // Bit depth
+        2, // Color type: RGB
+        0, 0, 0 // Deflate compression, adaptive filtering, no interlace
+    };
+    write_png_chunk(out, "IHDR", header);
+    write_png_chunk(out, "IDAT", deflate_encoder::compress(filtered));
+    write_png_chunk(out, "IEND", std::vector<unsigned char>());
+    return bool(out);
+}
+
+inline std::string image_extension(const std::string& path){
+    auto dot = path.find_last_of('.');
+    if(dot == std::string::npos) return "";
+    std::string ext = path.substr(dot + 1);
+    for(auto& ch : ext) ch = char(std::tolower((unsigned char)ch));
+    return ext;
+}
+
+inline bool write_image(const std::string& path, const framebuffer& image){
+    // Picks the format from the file extension: .png, .pfm, anything else is written as PPM
+    std::ofstream out(path, std::ios::binary);
+    if(!out){
+        std::cerr << "Could not open " << path << " for writing.\n";
+        return false;
+    }
+
+    std::string ext = image_extension(path);
+    bool ok = (ext == "png") ? write_png(out, image)
+            : (ext == "pfm") ? write_pfm(out, image)
+            : write_ppm(out, image);
+    if(!ok) std::cerr << "Failed to write " << path << ".\n";
+    return ok;
+}
+
+#endif // IMAGE_WRITER_H
@@ -0,0 +1,116 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "transform.h"
+#include <vector>
+
+class instance final: public hittable {
+    // One placement of a shared object under an affine transform. The object, usually a BVH or a
+    // mesh, is referenced rather than copied, so any number of instances share its geometry.
+    // Rays are moved into object space without normalizing the direction, which keeps t the same
+    // in both spaces. Instances aren't sampled as lights.
+    public:
+        instance(shared_ptr<hittable> object, const affine_transform& to_world)
+            : object(object), to_world(to_world), to_object(to_world.inverse()),
+              bbox(to_world.box(object->bounding_box())) {
+            linear_norm = translation_norm = 0;
+            for(int i = 0; i < 3; i++){
+                linear_norm = std::max(linear_norm, std::fabs(to_world.m[i][0]) + std::fabs(to_world.m[i][1])
+                                                    + std::fabs(to_world.m[i][2]));
+                translation_norm = std::max(translation_norm, std::fabs(to_world.m[i][3]));
+            }
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
+            if(!object->hit(object_ray(r), ray_t, rec)) return false;
+            // The object's hit point is mapped rather than r.at(t) taken, which would lose the
+            // object's refinement to t's error. Its error, at the object's scale, grows by the
+            // norm of the linear part, and the mapping rounds at the translation's magnitude.
+            real object_scale = std::max(std::max(max_abs(rec.p), rec.scale), real(1));
+            rec.p = to_world.point(rec.p);
+            rec.scale = real(linear_norm * object_scale + translation_norm);
+            rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+            return true;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            return object->occluded(object_ray(r), ray_t);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+    private:
+        shared_ptr<hittable> object;
+        affine_transform to_world; // The placement
+        affine_transform to_object; // Its inverse
+        aabb bbox;
+        double linear_norm; // Max norm of the placement's linear part
+        double translation_norm; // Largest coordinate of its translation
+
+        ray object_ray(const ray& r) const{
+            return ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+        }
+};
+
+class instance_bvh: public hittable {
+    // Top-level BVH over instances. The instances are held by value in leaf order next to the
+    // flattened nodes, so a scene of many copies is two arrays plus the shared objects.
+    public:
+        instance_bvh(std::vector<instance> list, const bvh_options& options = bvh_options(), bvh_stats* stats = nullptr){
+            std::vector<aabb> bounds;
+            bounds.reserve(list.size());
+            for(const auto& inst : list)
+                bounds.push_back(inst.bounding_box());
+
+            bvh_options build_options = options;
+            if(build_options.max_leaf_size > 0xffff) build_options.max_leaf_size = 0xffff;
+            bvh_builder builder(bounds, build_options);
+            if(stats) *stats = builder.stats();
+
+            bbox = builder.nodes.empty() ? aabb::empty : builder.nodes[0].bbox;
+            nodes.resize(builder.nodes.size());
+            flatten_bvh_nodes(builder, nodes.data());
+            instances.reserve(list.size());
+            for(uint32_t i : builder.prim_order)
+                instances.push_back(list[i]);
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
+            if(nodes.empty()) return false;
+            return traverse_linear_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count, interval& t){
+                bool hit_leaf = false;
+                for(uint32_t i = first; i < first + count; i++){
+                    if(instances[i].hit(r, t, rec)){
+                        hit_leaf = true;
+                        t.max = rec.t;
+                    }
+                }
+                return hit_leaf;
+            });
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            if(nodes.empty()) return false;
+            return traverse_linear_bvh_any(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count){
+                for(uint32_t i = first; i < first + count; i++)
+                    if(instances[i].occluded(r, ray_t)) return true;
+                return false;
+            });
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        size_t memory_bytes() const{
+            // Bytes of the instance and node arrays, not counting the shared objects
+            return instances.size() * sizeof(instance) + nodes.size() * sizeof(linear_bvh_node);
+        }
+
+    private:
+        std::vector<instance> instances;
+        aligned_vector<linear_bvh_node> nodes;
+        aabb bbox;
+};
+
+#endif // INSTANCE_H
@@ -5,31 +5,31 @@
 class interval {
     public:
         interval() : min(+infinity), max(-infinity) {}
-        interval(double min, double max) : min(min), max(max) {}
+        interval(real min, real max) : min(min), max(max) {}
         interval(const interval& a, const interval& b){
             min = a.min <= b.min ? a.min : b.min;
             max = a.max >= b.max ? a.max : b.max;
         }
-        double min;
-        double max;
+        real min;
+        real max;
 
-        double size() const{
+        real size() const{
             return max-min;
         }
 
-        bool contains(double x) const{
+        bool contains(real x) const{
             return x >= min && x <= max;
         }
 
-        bool surrounds(double x) const{
+        bool surrounds(real x) const{
             return x > min && x < max;
         }
-        double clamp(double x) const{
+        real clamp(real x) const{
             if(x < min) return min;
             if(x > max) return max;
             return x;
         }
-        interval expand(double delta) const{
+        interval expand(real delta) const{
             auto padding = delta/2;
             return interval(min - padding, max + padding);
         }
@@ -39,10 +39,10 @@ class interval {
 const interval interval::empty = interval(+infinity, -infinity);
 const interval interval::universe = interval(-infinity, +infinity);
 
-interval operator+(const interval& ival, double displacement){
+interval operator+(const interval& ival, real displacement){
     return interval(ival.min + displacement, ival.max + displacement);
 }
-interval operator+(double displacement, const interval& ival){
+interval operator+(real displacement, const interval& ival){
     return ival + displacement;
 }
 # endif // INTERVAL_H
\ No newline at end of file
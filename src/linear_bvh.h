@@ -0,0 +1,260 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh_builder.h"
+#include "aligned_allocator.h"
+#include "ray_packet.h"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+struct alignas(32) linear_bvh_node {
+    // Bounds are rounded outwards to float, so they always contain the double precision box
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset; // Leaves: first entry of prim_indices. Interior nodes: index of the right child.
+    uint16_t prim_count; // Number of primitives in a leaf, 0 for interior nodes
+    uint8_t axis; // Split axis of interior nodes
+    uint8_t pad;
+
+    bool is_leaf() const { return prim_count > 0; }
+
+    void set_bounds(const aabb& bbox){
+        for(int axis = 0; axis < 3; axis++){
+            const interval& ax = bbox.axis_interval(axis);
+            bounds_min[axis] = float_round_down(ax.min);
+            bounds_max[axis] = float_round_up(ax.max);
+        }
+    }
+
+    bool hit(const point3& origin, const vec3& inv_dir, const int dir_is_neg[3], interval ray_t) const{
+        // Slab test against the near and far planes picked by the ray direction signs. NaNs
+        // from rays grazing a slab fail both comparisons and leave the interval unchanged.
+        // The math is in real, as converting a float ray to double costs more than the test;
+        // far distances are scaled up by 1 + 2 gamma(3), more than the rounding of the
+        // subtraction and product can shrink them, so rays touching a box don't miss it.
+        const real far_scale = 1 + 3 * std::numeric_limits<real>::epsilon();
+        for(int axis = 0; axis < 3; axis++){
+            real near = dir_is_neg[axis] ? bounds_max[axis] : bounds_min[axis];
+            real far = dir_is_neg[axis] ? bounds_min[axis] : bounds_max[axis];
+            real t0 = (near - origin[axis]) * inv_dir[axis];
+            real t1 = (far - origin[axis]) * inv_dir[axis] * far_scale;
+            if(t0 > ray_t.min) ray_t.min = t0;
+            if(t1 < ray_t.max) ray_t.max = t1;
+        }
+        return ray_t.min <= ray_t.max;
+    }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+inline void flatten_bvh_nodes(const bvh_builder& builder, linear_bvh_node* nodes){
+    // The builder already lays nodes out depth first, so they convert one to one
+    for(size_t i = 0; i < builder.nodes.size(); i++){
+        const auto& src = builder.nodes[i];
+        auto& dst = nodes[i];
+        dst.set_bounds(src.bbox);
+        dst.offset = src.is_leaf() ? src.first : uint32_t(src.right);
+        dst.prim_count = uint16_t(src.is_leaf() ? src.count : 0);
+        dst.axis = uint8_t(src.axis);
+        dst.pad = 0;
+    }
+}
+
+template <typename LeafHit>
+inline bool traverse_linear_bvh(const linear_bvh_node* nodes, const ray& r, interval ray_t, LeafHit&& leaf_hit,
+                                uint32_t root = 0){
+    // Closest hit walk over the subtree at root of the flattened nodes. leaf_hit(first, count,
+    // ray_t) tests the leaf's entries, shrinks ray_t.max to any hit and returns whether there
+    // was one.
+    const point3& origin = r.origin();
+    const vec3& inv_dir = r.inv_direction();
+    int dir_is_neg[3] = {r.dir_is_neg(0), r.dir_is_neg(1), r.dir_is_neg(2)};
+
+    uint32_t stack[bvh_max_depth];
+    int stack_size = 0;
+    uint32_t current = root;
+    bool hit_anything = false;
+
+    while(true){
+        const auto& node = nodes[current];
+        if(node.hit(origin, inv_dir, dir_is_neg, ray_t)){
+            if(node.is_leaf()){
+                if(leaf_hit(node.offset, uint32_t(node.prim_count), ray_t))
+                    hit_anything = true;
+            } else {
+                // Visit the child on the side the ray comes from first, so closer hits
+                // shrink the interval before the far child is tested
+                if(dir_is_neg[node.axis]){
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if(stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+template <typename LeafTest>
+inline bool traverse_linear_bvh_any(const linear_bvh_node* nodes, const ray& r, interval ray_t, LeafTest&& leaf_test){
+    // Same walk, but the first leaf for which leaf_test(first, count) is true ends it and the
+    // interval never shrinks
+    const point3& origin = r.origin();
+    const vec3& inv_dir = r.inv_direction();
+    int dir_is_neg[3] = {r.dir_is_neg(0), r.dir_is_neg(1), r.dir_is_neg(2)};
+
+    uint32_t stack[bvh_max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while(true){
+        const auto& node = nodes[current];
+        if(node.hit(origin, inv_dir, dir_is_neg, ray_t)){
+            if(node.is_leaf()){
+                if(leaf_test(node.offset, uint32_t(node.prim_count)))
+                    return true;
+            } else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if(stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+
+    return false;
+}
+
+template <typename LeafHit, typename TraceSingle>
+inline void traverse_linear_bvh_packet(const linear_bvh_node* nodes, ray_packet& packet, uint32_t active,
+                                       LeafHit&& leaf_hit, TraceSingle&& trace_single){
+    // Closest hit walk of the active rays of a packet together: each node is fetched once and
+    // its box tested against all of them. leaf_hit(node, mask) tests a leaf for the rays in
+    // mask. Where the packet has diverged so few rays still overlap a node,
+    // trace_single(node, lane) finishes the subtree at node for one ray. Children are visited
+    // in the order the first active ray would take.
+    const ray& lead = packet.rays[lowest_bit(active)];
+    int dir_is_neg[3] = {lead.dir_is_neg(0), lead.dir_is_neg(1), lead.dir_is_neg(2)};
+
+    struct entry {
+        uint32_t node;
+        uint32_t active; // Rays that overlapped the parent
+    };
+    entry stack[bvh_max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while(true){
+        const auto& node = nodes[current];
+        real lo[3] = {node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]};
+        real hi[3] = {node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]};
+        uint32_t mask = packet_box_hits(packet, lo, hi, active);
+        if(mask){
+            if(node.is_leaf()){
+                leaf_hit(current, mask);
+            } else if(packet_diverged(packet, mask)){
+                for(; mask; mask &= mask - 1)
+                    trace_single(current, lowest_bit(mask));
+            } else {
+                if(dir_is_neg[node.axis]){
+                    stack[stack_size++] = entry{current + 1, mask};
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = entry{node.offset, mask};
+                    current = current + 1;
+                }
+                active = mask;
+                continue;
+            }
+        }
+        if(stack_size == 0) break;
+        stack_size--;
+        current = stack[stack_size].node;
+        active = stack[stack_size].active;
+    }
+}
+
+class linear_bvh: public hittable {
+    // A BVH flattened into one array of nodes in depth-first order. The left child of a node is
+    // the next node and the right child is found by offset, so traversal needs no pointers.
+    public:
+        linear_bvh(const hittable_list& list, const bvh_options& options = bvh_options(), bvh_stats* stats = nullptr)
+            : objects(list.objects) {
+            std::vector<aabb> bounds;
+            bounds.reserve(objects.size());
+            for(const auto& object : objects)
+                bounds.push_back(object->bounding_box());
+
+            bvh_options build_options = options;
+            if(build_options.max_leaf_size > 0xffff) build_options.max_leaf_size = 0xffff;
+
+            bvh_builder builder(bounds, build_options);
+            if(stats) *stats = builder.stats();
+            prim_indices = builder.prim_order;
+            bbox = builder.nodes.empty() ? aabb::empty : builder.nodes[0].bbox;
+            nodes.resize(builder.nodes.size());
+            flatten_bvh_nodes(builder, nodes.data());
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
+            if(nodes.empty()) return false;
+            return hit_subtree(0, r, ray_t, rec);
+        }
+
+        void hit_packet(ray_packet& packet, uint32_t active) const override{
+            if(nodes.empty()) return;
+            // Leaf objects get the packet, so nested BVHs carry on with it
+            auto trace_single = [&](uint32_t node, int lane){
+                if(hit_subtree(node, packet.rays[lane], packet.lane_interval(lane), packet.recs[lane]))
+                    packet.record_hit(lane);
+            };
+            traverse_linear_bvh_packet(nodes.data(), packet, active, [&](uint32_t node, uint32_t mask){
+                for(uint32_t i = nodes[node].offset; i < nodes[node].offset + nodes[node].prim_count; i++)
+                    objects[prim_indices[i]]->hit_packet(packet, mask);
+            }, trace_single);
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            if(nodes.empty()) return false;
+            return traverse_linear_bvh_any(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count){
+                for(uint32_t i = first; i < first + count; i++)
+                    if(objects[prim_indices[i]]->occluded(r, ray_t)) return true;
+                return false;
+            });
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+    private:
+        aligned_vector<linear_bvh_node> nodes;
+        std::vector<uint32_t> prim_indices; // Indices into objects, grouped by leaf
+        std::vector<shared_ptr<hittable>> objects;
+        aabb bbox;
+
+        bool hit_subtree(uint32_t root, const ray& r, interval ray_t, hit_record& rec) const{
+            return traverse_linear_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count, interval& t){
+                bool hit_leaf = false;
+                for(uint32_t i = first; i < first + count; i++){
+                    if(objects[prim_indices[i]]->hit(r, t, rec)){
+                        hit_leaf = true;
+                        t.max = rec.t;
+                    }
+                }
+                return hit_leaf;
+            }, root);
+        }
+};
+
+#endif // LINEAR_BVH_H
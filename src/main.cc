@@ -1,408 +1,103 @@
-# include "constants.h"
-# include "hittable.h"
-# include "hittable_list.h"
-# include "constant_medium.h"
-# include "material.h"
-# include "sphere.h"
-# include "interval.h"
-# include "camera.h"
-# include "bvh.h"
-# include "quad.h"
-
-void bouncing_spheres(){
-    hittable_list world;
-    
-    // World materials
-    auto checker = std::make_shared<checker_texture>(0.1, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-    // auto material_ground = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(std::make_shared<sphere>(point3(0.0, -1000, 0), 1000.0, make_shared<lambertian>(checker)));
-
-    for (int a = -11; a < 11; a++){
-        for (int b = -11; b < 11; b++){
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9){
-                std::shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8){
-                    // Diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = std::make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0, 0.5), 0);
-                    world.add(std::make_shared<sphere>(center, center2, 0.2, sphere_material));
-                } else if (choose_mat < 0.95){
-                    // Metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = std::make_shared<metal>(albedo, fuzz);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // Glass
-                    sphere_material = std::make_shared<dielectric>(1.5);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(0,1,0), 1.0, material1));
-
-    auto material2 = std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<sphere>(point3(-4,1,0), 1.0, material2));
-
-    auto material3 = std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<sphere>(point3(4,1,0), 1.0, material3));
-    
-    // BVH
-    world = hittable_list(std::make_shared<bvh_node>(world));
-    
-    // Camera
-    camera cam;
-    
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.vfov = 20.0;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat = point3(0,0,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
-    cam.background = color(0.7, 0.8, 1.0);
-    // Render
-    cam.render(world);
-
-}
-
-void checkered_spheres(){
-    hittable_list world;
-    
-    auto checker = std::make_shared<checker_texture>(0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-    world.add(std::make_shared<sphere>(point3(0.0, -10, 0), 10.0, make_shared<lambertian>(checker)));
-    world.add(std::make_shared<sphere>(point3(0.0, 10, 0), 10.0, make_shared<lambertian>(checker)));
-
-    // Camera
-    camera cam;
-    
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.vfov = 20.0;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat = point3(0,0,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0.0;
-    cam.background = color(0.7, 0.8, 1.0);
-    // Render
-    cam.render(world);
-}
-
-void earth(){
-    hittable_list world;
-
-    auto earth_texture = make_shared<image_texture>("images/earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    world.add(make_shared<sphere>(point3(0,0,0), 2.0, earth_surface));
-
-    // Camera
-    camera cam;
-    
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.vfov = 20.0;
-    cam.lookfrom = point3(0,0,12);
-    cam.lookat = point3(0,0,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0.0;
-    cam.background = color(0.7, 0.8, 1.0);
-    // Render
-    cam.render(world);
-}
-
-void perlin_spheres(){
-    hittable_list world;
-
-    auto perlin_texture = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(perlin_texture)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(perlin_texture)));
-
-    camera cam;
-    
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.vfov = 20.0;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat = point3(0,0,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0.0;
-    cam.background = color(0.7, 0.8, 1.0);
-    // Render
-    cam.render(world);
+# include "scene_cache.h"
+
+static void print_usage(){
+    std::cerr <<
+        "Usage: raytracer [options] [scene]\n"
+        "  scene                   a scene file, or one of the built-in scenes: bouncing_spheres,\n"
+        "                          checkered_spheres, earth, perlin_spheres, quads, simple_light,\n"
+        "                          cornell_box, cornell_smoke, final_scene (the default)\n"
+        "  -o, --output FILE       image to write, format by extension (.png, .pfm, .ppm);\n"
+        "                          PPM goes to stdout without one\n"
+        "  -w, --width N           image width in pixels, the aspect ratio is kept\n"
+        "  -s, --spp N             samples per pixel\n"
+        "  -c, --checkpoint FILE   render in passes, saving to FILE and resuming from it\n"
+        "  -t, --threads N         render threads (default: one per hardware thread)\n"
+        "  -p, --packets N         trace camera rays in packets of N = 4, 8 or 16 neighbouring pixels\n"
+        "  -W, --wavefront N       wavefront integrator with N paths in flight per thread\n"
+        "  --cache                 load a scene file from a binary cache next to it (FILE.cache),\n"
+        "                          writing the cache first when it is missing or out of date\n";
 }
 
-void quads(){
-    hittable_list world;
-
-    auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    world.add(make_shared<quad>(point3(-3,-2,5), vec3(0,0,-4), vec3(0,4,0), left_red));
-    world.add(make_shared<quad>(point3(-2,-2,0), vec3(4,0,0), vec3(0,4,0), back_green));
-    world.add(make_shared<quad>(point3(3,-2,1), vec3(0,0,4), vec3(0,4,0), right_blue));
-    world.add(make_shared<quad>(point3(-2,3,1), vec3(4,0,0), vec3(0,0,4), upper_orange));
-    world.add(make_shared<quad>(point3(-2,-3,5), vec3(4,0,0), vec3(0,0,-4), lower_teal));
-
-    // Camera
-    camera cam;
-    
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.vfov = 80.0;
-    cam.lookfrom = point3(0,0,9);
-    cam.lookat = point3(0,0,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0.0;
-    cam.background = color(0.7, 0.8, 1.0);
-
-    // Render
-    cam.render(world);
+static bool builtin_scene(const std::string& name, scene& s){
+    if(name == "bouncing_spheres") s = bouncing_spheres();
+    else if(name == "checkered_spheres") s = checkered_spheres();
+    else if(name == "earth") s = earth();
+    else if(name == "perlin_spheres") s = perlin_spheres();
+    else if(name == "quads") s = quads();
+    else if(name == "simple_light") s = simple_light();
+    else if(name == "cornell_box") s = cornell_box();
+    else if(name == "cornell_smoke") s = cornell_smoke();
+    else if(name == "final_scene") s = final_scene(600, 200, 50);
+    else return false;
+    return true;
 }
 
-void simple_light(){
-    hittable_list world;
-
-    auto perlin_texture = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(perlin_texture)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(perlin_texture)));
-
-    auto difflight = make_shared<diffuse_light>(color(4,4,4));
-    world.add(make_shared<quad>(point3(3,1,-2), vec3(2,0,0), vec3(0,2,0), difflight));
-    world.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
-
-    // Camera
-    camera cam;
-    
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.vfov = 20.0;
-    cam.lookfrom = point3(26,3,6);
-    cam.lookat = point3(0,2,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0.0;
-    cam.background = color(0.0, 0.0, 0.0);
-    // Render
-    cam.render(world);
-}
-void cornell_box() {
-    hittable_list world;
-
-    auto red = make_shared<lambertian>(color(0.65,0.05,0.05));
-    auto white = make_shared<lambertian>(color(0.73,0.73,0.73));
-    auto green = make_shared<lambertian>(color(0.12,0.45,0.15));
-    auto light = make_shared<diffuse_light>(color(15,15,15));
-
-    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
-    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-    world.add(make_shared<quad>(point3(343,554,332), vec3(-130,0,0), vec3(0,0,-105), light));
-
-    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-    world.add(box1);
-
-    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-    world.add(box2);
-
-    // Camera
-    camera cam;
-    
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth = 50;
-    cam.vfov = 40.0;
-    cam.lookfrom = point3(278,278,-800);
-    cam.lookat = point3(278,278,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0.0;
-    cam.background = color(0.0, 0.0, 0.0);
-
-    // Render
-    cam.render(world);
-}
-void cornell_smoke() {
-    hittable_list world;
-
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-
-    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(make_shared<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
-    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-
-    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-void final_scene(int image_width, int samples_per_pixel, int max_depth) {
-    hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
-
-    int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++) {
-        for (int j = 0; j < boxes_per_side; j++) {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i*w;
-            auto z0 = -1000.0 + j*w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1,101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+int main(int argc, char** argv){
+    std::string scene_name = "final_scene";
+    std::string output_path, checkpoint_path;
+    int width = 0, spp = 0, threads = 0, packets = 0, wavefront = 0;
+    bool use_cache = false;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(arg == "-h" || arg == "--help"){
+            print_usage();
+            return 0;
+        } else if((arg == "-o" || arg == "--output") && has_value){
+            output_path = argv[++i];
+        } else if((arg == "-w" || arg == "--width") && has_value){
+            width = std::atoi(argv[++i]);
+        } else if((arg == "-s" || arg == "--spp") && has_value){
+            spp = std::atoi(argv[++i]);
+        } else if((arg == "-c" || arg == "--checkpoint") && has_value){
+            checkpoint_path = argv[++i];
+        } else if((arg == "-t" || arg == "--threads") && has_value){
+            threads = std::atoi(argv[++i]);
+        } else if((arg == "-p" || arg == "--packets") && has_value){
+            packets = std::atoi(argv[++i]);
+        } else if((arg == "-W" || arg == "--wavefront") && has_value){
+            wavefront = std::atoi(argv[++i]);
+        } else if(arg == "--cache"){
+            use_cache = true;
+        } else if(arg.size() > 1 && arg[0] == '-'){
+            std::cerr << "Unknown or incomplete option " << arg << ".\n";
+            print_usage();
+            return 1;
+        } else {
+            scene_name = arg;
         }
     }
 
-    hittable_list world;
-
-    world.add(make_shared<bvh_node>(boxes1));
-
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quad>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light));
-
-    auto center1 = point3(400, 400, 200);
-    auto center2 = center1 + vec3(30,0,0);
-    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
-
-    world.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(
-        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
-    ));
-
-    auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(point3(0,0,0), 5000, make_shared<dielectric>(1.5));
-    world.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
-
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    world.add(make_shared<sphere>(point3(400,200,400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.2);
-    world.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
-
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
+    scene s;
+    if(!builtin_scene(scene_name, s)){
+        std::string error;
+        bool cached = false;
+        if(use_cache){
+            // A cache that can't be written, for a scene it can't hold, falls back to parsing
+            std::string cache_path = scene_name + ".cache";
+            cached = load_scene_cache(cache_path, scene_name, s, error);
+            if(!cached){
+                if(build_scene_cache(scene_name, cache_path, error))
+                    cached = load_scene_cache(cache_path, scene_name, s, error);
+                if(!cached) std::cerr << "Not using a scene cache: " << error << '\n';
+            }
+        }
+        if(!cached && !load_scene_file(scene_name, s, error)){
+            std::cerr << error << '\n';
+            return 1;
+        }
     }
 
-    world.add(make_shared<translate>(
-        make_shared<rotate_y>(
-            make_shared<bvh_node>(boxes2), 15),
-            vec3(-100,270,395)
-        )
-    );
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = image_width;
-    cam.samples_per_pixel = samples_per_pixel;
-    cam.max_depth         = max_depth;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 40;
-    cam.lookfrom = point3(478, 278, -600);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-int main(){
-    switch(9){
-        case 1:
-            bouncing_spheres();
-            break;
-        case 2:
-            checkered_spheres();
-            break;
-        case 3:
-            earth();
-            break;
-        case 4:
-            perlin_spheres();
-            break;
-        case 5:
-            quads();
-            break;
-        case 6:
-            simple_light();
-            break;
-        case 7:
-            cornell_box();
-            break;
-        case 8:
-            cornell_smoke();
-            break;
-        case 9:
-            final_scene(600, 200, 50);
-            break;
-        default:
-            std::cerr << "Invalid scene selection." << std::endl;
-            break;
+    if(width > 0) s.cam.image_width = width;
+    if(spp > 0) s.cam.samples_per_pixel = spp;
+    if(threads > 0) s.cam.thread_count = threads;
+    if(packets > 0) s.cam.packet_size = packets;
+    if(wavefront > 0) s.cam.wavefront_size = wavefront;
+    s.cam.output_path = output_path;
+    if(!checkpoint_path.empty()){
+        s.cam.checkpoint_path = checkpoint_path;
+        s.cam.samples_per_pass = 1;
     }
+    return s.cam.render(s.world, gather_lights(s.world)) ? 0 : 1;
 }
@@ -3,39 +3,41 @@
 #include "hittable.h"
 #include "texture.h"
 
+// The built-in materials, and custom for the ones deriving from custom_material
+enum class material_kind : uint32_t { lambertian, metal, dielectric, diffuse_light, isotropic, custom };
+
 class material {
+    // Materials are told apart by their kind, and the functions below switch over the built-in
+    // ones, so every bounce makes direct calls the compiler can inline instead of virtual ones.
+    // Materials beyond those derive from custom_material, whose functions are virtual.
     public:
+        const material_kind kind;
+
         virtual ~material() = default;
 
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const {
-            // Suppress unused parameter warnings
-            (void)r_in;
-            (void)rec;
-            (void)attenuation;
-            (void)scattered;
-            return false;
-        };
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const;
 
-        virtual color emitted(double u, double v, const point3& p) const {
-            // Suppress unused parameter warnings
-            (void)u;
-            (void)v;
-            (void)p;
-            return color(0,0,0);
-        }
+        color emitted(double u, double v, const point3& p) const;
+
+        // Density with which scatter() picks the direction of scattered. Zero marks materials
+        // whose directions can't be evaluated (mirrors, glass), which skip light sampling.
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const;
+
+        bool is_emissive() const;
 
+    protected:
+        explicit material(material_kind kind) : kind(kind) {}
 };
 
 class metal: public material {
     public:
-        metal(const color& albedo, double fuzz): albedo(albedo), fuzz (fuzz < 1 ? fuzz : 1) {}
+        metal(const color& albedo, double fuzz)
+            : material(material_kind::metal), albedo(albedo), fuzz (fuzz < 1 ? fuzz : 1) {}
 
-        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override{
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const{
             vec3 reflected = reflect(r_in.direction(), rec.normal);
             reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
-            scattered = ray(rec.p, reflected, r_in.time());
+            scattered = rec.spawn_ray(reflected, r_in.time());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
@@ -47,33 +49,42 @@ class metal: public material {
 };
 class lambertian: public material {
     public:
-        lambertian(const color& albedo): tex(make_shared<solid_color>(albedo)) {}
-        lambertian(shared_ptr<texture> tex): tex(tex) {}
+        lambertian(const color& albedo): material(material_kind::lambertian), tex(albedo) {}
+        lambertian(shared_ptr<texture> tex): material(material_kind::lambertian), tex(std::move(tex)) {}
 
 
-        virtual bool scatter(
+        bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override {
+        ) const {
+            // The tip of the normal plus a uniform unit vector is cosine distributed about the
+            // normal, which takes one closed-form sphere sample and no tangent frame
             auto scatter_direction = rec.normal + random_unit_vector();
             // Catch degenerate scatter direction
             if (scatter_direction.near_zero())
                 scatter_direction = rec.normal;
-            scattered = ray(rec.p, scatter_direction, r_in.time());
-            attenuation = tex->value(rec.u, rec.v, rec.p);
+            scattered = rec.spawn_ray(scatter_direction, r_in.time());
+            attenuation = tex.value(rec.u, rec.v, rec.p);
             return true;
         }
 
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+            // normal + random unit vector is cosine distributed over the hemisphere
+            (void)r_in;
+            auto cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
+            return cos_theta < 0 ? 0 : cos_theta / pi;
+        }
+
     private:
-        shared_ptr<texture> tex;
+        texture_ref tex;
 };
 
 class dielectric: public material {
     public:
-        dielectric(double refraction_index): refraction_index(refraction_index) {}
+        dielectric(double refraction_index): material(material_kind::dielectric), refraction_index(refraction_index) {}
 
-        virtual bool scatter(
+        bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override {
+        ) const {
             attenuation = color(1.0, 1.0, 1.0);
             double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
@@ -81,14 +92,14 @@ class dielectric: public material {
             double cos_theta = std::fmin(dot(-unit_direction, rec.normal), 1.0);
             double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
             bool cannot_refract = ri * sin_theta > 1.0;
-            
+
             vec3 direction;
-            if (cannot_refract || reflectance(cos_theta, ri) > random_double())
+            if (cannot_refract || reflectance(cos_theta, ri) > sample_1d())
                 direction = reflect(unit_direction, rec.normal);
             else
                 direction = refract(unit_direction, rec.normal, ri);
 
-            scattered = ray(rec.p, direction, r_in.time());
+            scattered = rec.spawn_ray(direction, r_in.time());
             return true;
         }
     private:
@@ -104,30 +115,99 @@ class dielectric: public material {
 
 class diffuse_light : public material {
     public:
-        diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
-        diffuse_light(color emit) : tex(make_shared<solid_color>(emit)) {}
+        diffuse_light(shared_ptr<texture> tex) : material(material_kind::diffuse_light), tex(std::move(tex)) {}
+        diffuse_light(color emit) : material(material_kind::diffuse_light), tex(emit) {}
 
-        color emitted(double u, double v, const point3& p) const override{
-            return tex->value(u, v, p);
+        color emitted(double u, double v, const point3& p) const{
+            return tex.value(u, v, p);
         }
 
     private:
-        shared_ptr<texture> tex;
+        texture_ref tex;
 };
 
 class isotropic : public material {
   public:
-    isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
-    isotropic(shared_ptr<texture> tex) : tex(tex) {}
+    isotropic(const color& albedo) : material(material_kind::isotropic), tex(albedo) {}
+    isotropic(shared_ptr<texture> tex) : material(material_kind::isotropic), tex(std::move(tex)) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-    const override {
-        scattered = ray(rec.p, random_unit_vector(), r_in.time());
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const{
+        scattered = rec.spawn_ray(random_unit_vector(), r_in.time());
+        attenuation = tex.value(rec.u, rec.v, rec.p);
         return true;
     }
 
   private:
-    shared_ptr<texture> tex;
+    texture_ref tex;
+};
+
+class custom_material : public material {
+    // Base of materials other than the built-in ones. By default it neither scatters nor emits.
+    public:
+        custom_material() : material(material_kind::custom) {}
+
+        virtual bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+        ) const {
+            // Suppress unused parameter warnings
+            (void)r_in;
+            (void)rec;
+            (void)attenuation;
+            (void)scattered;
+            return false;
+        };
+
+        virtual color emitted(double u, double v, const point3& p) const {
+            // Suppress unused parameter warnings
+            (void)u;
+            (void)v;
+            (void)p;
+            return color(0,0,0);
+        }
+
+        virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+            (void)r_in;
+            (void)rec;
+            (void)scattered;
+            return 0;
+        }
+
+        virtual bool is_emissive() const { return false; }
 };
-# endif // MATERIAL_H
\ No newline at end of file
+
+inline bool material::scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const{
+    switch(kind){
+        case material_kind::lambertian: return static_cast<const lambertian*>(this)->scatter(r_in, rec, attenuation, scattered);
+        case material_kind::metal: return static_cast<const metal*>(this)->scatter(r_in, rec, attenuation, scattered);
+        case material_kind::dielectric: return static_cast<const dielectric*>(this)->scatter(r_in, rec, attenuation, scattered);
+        case material_kind::diffuse_light: return false;
+        case material_kind::isotropic: return static_cast<const isotropic*>(this)->scatter(r_in, rec, attenuation, scattered);
+        default: return static_cast<const custom_material*>(this)->scatter(r_in, rec, attenuation, scattered);
+    }
+}
+
+inline color material::emitted(double u, double v, const point3& p) const{
+    switch(kind){
+        case material_kind::diffuse_light: return static_cast<const diffuse_light*>(this)->emitted(u, v, p);
+        case material_kind::custom: return static_cast<const custom_material*>(this)->emitted(u, v, p);
+        default: return color(0,0,0);
+    }
+}
+
+inline double material::scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const{
+    switch(kind){
+        case material_kind::lambertian: return static_cast<const lambertian*>(this)->scattering_pdf(r_in, rec, scattered);
+        case material_kind::custom: return static_cast<const custom_material*>(this)->scattering_pdf(r_in, rec, scattered);
+        default: return 0;
+    }
+}
+
+inline bool material::is_emissive() const{
+    switch(kind){
+        case material_kind::diffuse_light: return true;
+        case material_kind::custom: return static_cast<const custom_material*>(this)->is_emissive();
+        default: return false;
+    }
+}
+
+# endif // MATERIAL_H
@@ -0,0 +1,204 @@
+#ifndef OBJ_FILE_H
+#define OBJ_FILE_H
+
+#include "triangle_mesh.h"
+#include "parse_number.h"
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Wavefront OBJ meshes. Vertex positions (v), normals (vn), texture coordinates (vt) and faces
+// (f) are read, polygons are split into triangle fans, and everything else (groups, smoothing,
+// materials) is skipped. Face corners can be v, v/vt, v//vn or v/vt/vn, with negative indices
+// counting back from the last vertex read.
+
+class obj_reader {
+    // Streams the file through a fixed buffer, so only the mesh arrays grow with the file size
+    public:
+        obj_reader(const std::string& path): path(path) {}
+
+        bool read(mesh_data& mesh){
+            // Fills mesh, or returns false with the location and reason in error()
+            std::ifstream in(path, std::ios::binary);
+            if(!in){
+                error_text = "cannot open " + path;
+                return false;
+            }
+            target = &mesh;
+
+            std::vector<char> buffer(1 << 20);
+            size_t kept = 0; // Bytes of an incomplete line carried over from the last chunk
+            for(;;){
+                in.read(buffer.data() + kept, std::streamsize(buffer.size() - kept));
+                size_t size = kept + size_t(in.gcount());
+                bool last = !in;
+                const char* begin = buffer.data();
+                const char* end = begin + size;
+
+                // Parse up to the last complete line, all of it at the end of the file
+                const char* complete = end;
+                if(!last){
+                    while(complete > begin && complete[-1] != '\n') complete--;
+                    if(complete == begin){
+                        // A line longer than the buffer
+                        kept = size;
+                        buffer.resize(buffer.size() * 2);
+                        continue;
+                    }
+                }
+                if(!parse(begin, complete)) return false;
+                kept = size_t(end - complete);
+                std::memmove(buffer.data(), complete, kept);
+                if(last) break;
+            }
+            return finish();
+        }
+
+        const std::string& error() const { return error_text; }
+
+    private:
+        std::string path;
+        std::string error_text;
+        mesh_data* target = nullptr;
+        int line = 1;
+        std::vector<uint32_t> corners[3]; // Position, uv and normal indices of the current face
+
+        bool fail(const std::string& message){
+            error_text = path + ":" + std::to_string(line) + ": " + message;
+            return false;
+        }
+
+        static void skip_space(const char*& p, const char* end){
+            while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        }
+
+        bool numbers(const char*& p, const char* end, double* values, int count){
+            for(int i = 0; i < count; i++){
+                skip_space(p, end);
+                if(!parse_number(p, end, values[i])) return fail("expected a number");
+            }
+            return true;
+        }
+
+        bool index(const char*& p, const char* end, size_t vertex_count, uint32_t& value){
+            // A one-based index, or a negative one relative to the end, made zero-based
+            bool negative = p < end && *p == '-';
+            if(negative) p++;
+            int64_t n = 0;
+            const char* digits = p;
+            for(; p < end && *p >= '0' && *p <= '9' && n <= 0xffffffffll; p++) n = n * 10 + (*p - '0');
+            if(p == digits || n == 0) return fail("expected a vertex index");
+            n = negative ? int64_t(vertex_count) - n : n - 1;
+            if(n < 0 || n >= int64_t(vertex_count)) return fail("vertex index out of range");
+            value = uint32_t(n);
+            return true;
+        }
+
+        bool parse(const char* p, const char* end){
+            mesh_data& mesh = *target;
+            while(p < end){
+                skip_space(p, end);
+                const char* start = p;
+                while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+                size_t length = size_t(p - start);
+
+                double v[3];
+                if(length == 1 && *start == 'v'){
+                    if(!numbers(p, end, v, 3)) return false;
+                    mesh.positions.push_back(point3(v[0], v[1], v[2]));
+                } else if(length == 2 && start[0] == 'v' && start[1] == 'n'){
+                    if(!numbers(p, end, v, 3)) return false;
+                    mesh.normals.push_back(vec3(v[0], v[1], v[2]));
+                } else if(length == 2 && start[0] == 'v' && start[1] == 't'){
+                    if(!numbers(p, end, v, 2)) return false;
+                    mesh.uvs.push_back(point2{v[0], v[1]});
+                } else if(length == 1 && *start == 'f'){
+                    if(!face(p, end)) return false;
+                }
+
+                // Anything else on the line, and lines of other kinds, are skipped
+                while(p < end && *p != '\n') p++;
+                if(p < end){
+                    p++;
+                    line++;
+                }
+            }
+            return true;
+        }
+
+        bool face(const char*& p, const char* end){
+            mesh_data& mesh = *target;
+            for(auto& c : corners) c.clear();
+            bool all_uvs = true, all_normals = true;
+            for(;;){
+                skip_space(p, end);
+                if(p == end || *p == '\n' || *p == '#') break;
+                uint32_t position, uv = mesh_no_index, normal = mesh_no_index;
+                if(!index(p, end, mesh.positions.size(), position)) return false;
+                if(p < end && *p == '/'){
+                    p++;
+                    if(p < end && *p != '/' && !index(p, end, mesh.uvs.size(), uv)) return false;
+                    if(p < end && *p == '/'){
+                        p++;
+                        if(!index(p, end, mesh.normals.size(), normal)) return false;
+                    }
+                }
+                if(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                    return fail("unexpected character in a face");
+                corners[0].push_back(position);
+                corners[1].push_back(uv);
+                corners[2].push_back(normal);
+                all_uvs = all_uvs && uv != mesh_no_index;
+                all_normals = all_normals && normal != mesh_no_index;
+            }
+            if(corners[0].size() < 3) return fail("a face needs at least three vertices");
+
+            for(size_t i = 1; i + 1 < corners[0].size(); i++){
+                size_t previous = mesh.indices.size(); // Corners of the triangles before this one
+                add_corners(mesh.indices, previous, corners[0], i, true);
+                add_corners(mesh.uv_indices, previous, corners[1], i, all_uvs);
+                add_corners(mesh.normal_indices, previous, corners[2], i, all_normals);
+            }
+            return true;
+        }
+
+        static void add_corners(std::vector<uint32_t>& indices, size_t previous, const std::vector<uint32_t>& face,
+                                size_t i, bool present){
+            // Adds triangle (0, i, i + 1) of the fan. Normal and uv index arrays stay empty
+            // until a triangle has them; a triangle missing some gets mesh_no_index for all.
+            if(indices.empty() && !present) return;
+            if(indices.size() < previous) indices.resize(previous, mesh_no_index);
+            indices.push_back(present ? face[0] : mesh_no_index);
+            indices.push_back(present ? face[i] : mesh_no_index);
+            indices.push_back(present ? face[i + 1] : mesh_no_index);
+        }
+
+        bool finish(){
+            mesh_data& mesh = *target;
+            if(mesh.indices.empty()) return fail("no faces");
+            for(auto* indices : {&mesh.normal_indices, &mesh.uv_indices})
+                if(!indices->empty()) indices->resize(mesh.indices.size(), mesh_no_index);
+            mesh.positions.shrink_to_fit();
+            mesh.normals.shrink_to_fit();
+            mesh.uvs.shrink_to_fit();
+            mesh.indices.shrink_to_fit();
+            mesh.normal_indices.shrink_to_fit();
+            mesh.uv_indices.shrink_to_fit();
+            return true;
+        }
+};
+
+inline bool load_obj(const std::string& path, shared_ptr<material> mat, shared_ptr<triangle_mesh>& mesh, std::string& error){
+    // Reads an OBJ file into a mesh with material mat, returns false with a message in error
+    mesh_data data;
+    obj_reader reader(path);
+    if(!reader.read(data)){
+        error = reader.error();
+        return false;
+    }
+    mesh = make_shared<triangle_mesh>(std::move(data), mat);
+    return true;
+}
+
+#endif // OBJ_FILE_H
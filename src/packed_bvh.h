@@ -0,0 +1,399 @@
+#ifndef PACKED_BVH_H
+#define PACKED_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh_builder.h"
+#include "linear_bvh.h"
+#include "aligned_allocator.h"
+#include "simd_lanes.h"
+#include "sphere.h"
+#include "quad.h"
+#include <algorithm>
+#include <cstdint>
+#include <typeinfo>
+#include <vector>
+
+struct packed_leaf {
+    // The primitives of one leaf: a block aligned range of each SoA array, and the objects that
+    // have no batch kernel
+    uint32_t sphere_first, quad_first, object_first;
+    uint16_t sphere_count, quad_count, object_count;
+};
+
+struct packed_spheres {
+    // Sphere centers at time 0, their motion over one unit of time and radii, one array each
+    aligned_vector<real> center[3];
+    aligned_vector<real> motion[3];
+    aligned_vector<real> radius;
+    std::vector<const material*> mat;
+
+    size_t size() const { return radius.size(); }
+};
+
+struct packed_quads {
+    // The quad frames: corner Q, edges u and v, w = n / n.n for the planar coordinates, unit
+    // normal and plane constant D
+    aligned_vector<real> Q[3], u[3], v[3], w[3], normal[3];
+    aligned_vector<real> D;
+    std::vector<const material*> mat;
+
+    size_t size() const { return D.size(); }
+};
+
+// Batch kernels. Each tests lanes [i, i + Lanes::width) of a leaf's range against the ray and
+// returns a bit mask of the lanes hit inside (tmin, tmax), writing their distances to t. Lanes
+// past the end of the range hold padding and must be masked off by the caller.
+
+template <typename Lanes>
+inline int packed_sphere_hits(const packed_spheres& s, uint32_t i, const ray& r, real tmin, real tmax, real* t){
+    // sphere::intersect, one sphere per lane
+    Lanes time = Lanes(real(r.time()));
+    Lanes ox(r.origin().x()), oy(r.origin().y()), oz(r.origin().z());
+    Lanes dx(r.direction().x()), dy(r.direction().y()), dz(r.direction().z());
+    real a = r.direction().length_squared();
+    Lanes inv_a(1 / a);
+
+    Lanes ocx = Lanes::load(&s.center[0][i]) + time * Lanes::load(&s.motion[0][i]) - ox;
+    Lanes ocy = Lanes::load(&s.center[1][i]) + time * Lanes::load(&s.motion[1][i]) - oy;
+    Lanes ocz = Lanes::load(&s.center[2][i]) + time * Lanes::load(&s.motion[2][i]) - oz;
+    Lanes radius = Lanes::load(&s.radius[i]);
+    Lanes r2 = radius * radius;
+
+    Lanes h = dx * ocx + dy * ocy + dz * ocz;
+    Lanes k = h * inv_a;
+    Lanes lx = k * dx - ocx, ly = k * dy - ocy, lz = k * dz - ocz;
+    Lanes discriminant = Lanes(a) * (r2 - (lx * lx + ly * ly + lz * lz));
+    Lanes zero(0);
+    Lanes valid = zero <= discriminant;
+    if(mask_bits(valid) == 0) return 0; // Most blocks are missed entirely
+
+    Lanes q = h + copysign(sqrt(max(discriminant, zero)), h);
+    Lanes c = ocx * ocx + ocy * ocy + ocz * ocz - r2;
+    Lanes root0 = q * inv_a, root1 = c / q;
+    Lanes near = min(root0, root1), far = max(root0, root1);
+
+    Lanes lo(tmin), hi(tmax);
+    Lanes near_ok = (lo < near) & (near < hi);
+    Lanes far_ok = (lo < far) & (far < hi);
+    select(near_ok, near, far).store(t);
+    return mask_bits(valid & (near_ok | far_ok));
+}
+
+template <typename Lanes>
+inline int packed_quad_hits(const packed_quads& s, uint32_t i, const ray& r, real tmin, real tmax, real* t){
+    // quad::hit up to the interior test, one quad per lane
+    Lanes ox(r.origin().x()), oy(r.origin().y()), oz(r.origin().z());
+    Lanes dx(r.direction().x()), dy(r.direction().y()), dz(r.direction().z());
+
+    Lanes nx = Lanes::load(&s.normal[0][i]), ny = Lanes::load(&s.normal[1][i]), nz = Lanes::load(&s.normal[2][i]);
+    Lanes denom = nx * dx + ny * dy + nz * dz;
+    Lanes not_parallel = Lanes(real(1e-8)) <= abs(denom);
+    Lanes dist = (Lanes::load(&s.D[i]) - (nx * ox + ny * oy + nz * oz)) / denom;
+    Lanes in_range = (Lanes(tmin) <= dist) & (dist <= Lanes(tmax));
+
+    Lanes px = ox + dist * dx - Lanes::load(&s.Q[0][i]);
+    Lanes py = oy + dist * dy - Lanes::load(&s.Q[1][i]);
+    Lanes pz = oz + dist * dz - Lanes::load(&s.Q[2][i]);
+    Lanes ux = Lanes::load(&s.u[0][i]), uy = Lanes::load(&s.u[1][i]), uz = Lanes::load(&s.u[2][i]);
+    Lanes vx = Lanes::load(&s.v[0][i]), vy = Lanes::load(&s.v[1][i]), vz = Lanes::load(&s.v[2][i]);
+    Lanes wx = Lanes::load(&s.w[0][i]), wy = Lanes::load(&s.w[1][i]), wz = Lanes::load(&s.w[2][i]);
+
+    // alpha = w.(p x v), beta = w.(u x p)
+    Lanes alpha = wx * (py * vz - pz * vy) + wy * (pz * vx - px * vz) + wz * (px * vy - py * vx);
+    Lanes beta = wx * (uy * pz - uz * py) + wy * (uz * px - ux * pz) + wz * (ux * py - uy * px);
+    Lanes zero(0), one(1);
+    Lanes interior = (zero <= alpha) & (alpha <= one) & (zero <= beta) & (beta <= one);
+
+    dist.store(t);
+    return mask_bits(not_parallel & in_range & interior);
+}
+
+class packed_bvh: public hittable {
+    // A linear BVH whose leaves keep spheres and quads in structure of arrays form, so a leaf
+    // is tested a register of primitives at a time with the SIMD kernels above. Each leaf's
+    // range of an array starts on a block of real_block_width entries (32 bytes) and is padded
+    // to whole blocks, which keeps every load aligned whatever the lane count. Nested lists
+    // are flattened; other objects stay behind their pointers and are tested one by one.
+    public:
+        packed_bvh(const hittable_list& list, const bvh_options& options = bvh_options(), bvh_stats* stats = nullptr)
+            : level(resolve_simd_level(options.simd)) {
+            std::vector<shared_ptr<hittable>> prims;
+            gather(list, prims);
+
+            std::vector<aabb> bounds;
+            bounds.reserve(prims.size());
+            for(const auto& prim : prims)
+                bounds.push_back(prim->bounding_box());
+
+            // A block test costs about as much as one primitive test, so leaves may hold a
+            // block and node visits weigh that much more against primitives
+            bvh_options build_options = options;
+            build_options.max_leaf_size = std::min(std::max(options.max_leaf_size, real_block_width), 0xffff);
+            build_options.traversal_cost = options.traversal_cost * real_block_width;
+
+            bvh_builder builder(bounds, build_options);
+            if(stats) *stats = builder.stats();
+            bbox = builder.nodes.empty() ? aabb::empty : builder.nodes[0].bbox;
+            nodes.resize(builder.nodes.size());
+            flatten_bvh_nodes(builder, nodes.data());
+
+            for(size_t n = 0; n < builder.nodes.size(); n++){
+                const auto& node = builder.nodes[n];
+                if(!node.is_leaf()) continue;
+                nodes[n].offset = uint32_t(leaves.size());
+                leaves.push_back(pack_leaf(prims, &builder.prim_order[node.first], node.count));
+            }
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
+            if(nodes.empty()) return false;
+            return hit_subtree(0, r, ray_t, rec);
+        }
+
+        void hit_packet(ray_packet& packet, uint32_t active) const override{
+            if(nodes.empty()) return;
+            auto trace_single = [&](uint32_t node, int lane){
+                if(hit_subtree(node, packet.rays[lane], packet.lane_interval(lane), packet.recs[lane]))
+                    packet.record_hit(lane);
+            };
+            traverse_linear_bvh_packet(nodes.data(), packet, active, [&](uint32_t node, uint32_t mask){
+                for(; mask; mask &= mask - 1)
+                    trace_single(node, lowest_bit(mask));
+            }, trace_single);
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            if(nodes.empty()) return false;
+#if RT_X86
+            if(level == simd_level::avx2) return hit_avx2<true>(0, r, ray_t, nullptr);
+            if(level == simd_level::sse) return traverse<real_lanes<simd_level::sse>, true>(0, r, ray_t, nullptr);
+#endif
+            return traverse<real_lanes<simd_level::scalar>, true>(0, r, ray_t, nullptr);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        simd_level kernel() const { return level; }
+
+        size_t sphere_count() const { return sphere_total; }
+        size_t quad_count() const { return quad_total; }
+        size_t object_count() const { return objects.size(); }
+
+    private:
+        aligned_vector<linear_bvh_node> nodes;
+        std::vector<packed_leaf> leaves; // Indexed by the offset of leaf nodes
+        packed_spheres spheres;
+        packed_quads quads;
+        std::vector<shared_ptr<hittable>> objects; // Objects without a batch kernel, grouped by leaf
+        std::vector<shared_ptr<material>> materials; // Keeps the materials of packed primitives
+        size_t sphere_total = 0, quad_total = 0;
+        simd_level level;
+        aabb bbox;
+
+        bool hit_subtree(uint32_t root, const ray& r, interval ray_t, hit_record& rec) const{
+#if RT_X86
+            if(level == simd_level::avx2) return hit_avx2<false>(root, r, ray_t, &rec);
+            if(level == simd_level::sse) return traverse<real_lanes<simd_level::sse>, false>(root, r, ray_t, &rec);
+#endif
+            return traverse<real_lanes<simd_level::scalar>, false>(root, r, ray_t, &rec);
+        }
+
+#if RT_X86
+        template <bool AnyHit>
+        RT_TARGET_AVX2 RT_FLATTEN
+        bool hit_avx2(uint32_t root, const ray& r, interval ray_t, hit_record* rec) const{
+            return traverse<real_lanes<simd_level::avx2>, AnyHit>(root, r, ray_t, rec);
+        }
+#endif
+
+        template <typename Lanes, bool AnyHit>
+        bool traverse(uint32_t root, const ray& r, interval ray_t, hit_record* rec) const{
+            // Closest hit search in the subtree at root, or with AnyHit an occlusion query of
+            // the whole tree
+            if(AnyHit){
+                return traverse_linear_bvh_any(nodes.data(), r, ray_t, [&](uint32_t leaf, uint32_t){
+                    return leaf_hit<Lanes, true>(leaves[leaf], r, ray_t, rec);
+                });
+            }
+            return traverse_linear_bvh(nodes.data(), r, ray_t, [&](uint32_t leaf, uint32_t, interval& t){
+                return leaf_hit<Lanes, false>(leaves[leaf], r, t, rec);
+            }, root);
+        }
+
+        template <typename Lanes, bool AnyHit>
+        bool leaf_hit(const packed_leaf& leaf, const ray& r, interval& ray_t, hit_record* rec) const{
+            // Closest hit in the leaf, shrinking ray_t.max. Only the record of the closest
+            // sphere and then quad is filled in. With AnyHit, returns at the first hit.
+            alignas(32) real t[Lanes::width];
+            bool hit_leaf = false;
+
+            uint32_t closest = 0;
+            bool hit_sphere = false;
+            for(uint32_t i = 0; i < leaf.sphere_count; i += Lanes::width){
+                uint32_t first = leaf.sphere_first + i;
+                int mask = packed_sphere_hits<Lanes>(spheres, first, r, ray_t.min, ray_t.max, t)
+                         & lane_mask<Lanes>(leaf.sphere_count - i);
+                if(mask && AnyHit) return true;
+                for(; mask; mask &= mask - 1){
+                    int lane = lowest_bit(mask);
+                    if(t[lane] < ray_t.max){
+                        ray_t.max = t[lane];
+                        closest = first + lane;
+                        hit_sphere = true;
+                    }
+                }
+            }
+            if(hit_sphere){
+                fill_sphere_record(closest, r, ray_t.max, *rec);
+                hit_leaf = true;
+            }
+
+            bool hit_quad = false;
+            for(uint32_t i = 0; i < leaf.quad_count; i += Lanes::width){
+                uint32_t first = leaf.quad_first + i;
+                int mask = packed_quad_hits<Lanes>(quads, first, r, ray_t.min, ray_t.max, t)
+                         & lane_mask<Lanes>(leaf.quad_count - i);
+                if(mask && AnyHit) return true;
+                for(; mask; mask &= mask - 1){
+                    int lane = lowest_bit(mask);
+                    if(t[lane] < ray_t.max){
+                        ray_t.max = t[lane];
+                        closest = first + lane;
+                        hit_quad = true;
+                    }
+                }
+            }
+            if(hit_quad){
+                fill_quad_record(closest, r, ray_t.max, *rec);
+                hit_leaf = true;
+            }
+
+            for(uint32_t i = leaf.object_first; i < leaf.object_first + leaf.object_count; i++){
+                if(AnyHit){
+                    if(objects[i]->occluded(r, ray_t)) return true;
+                } else if(objects[i]->hit(r, ray_t, *rec)){
+                    hit_leaf = true;
+                    ray_t.max = rec->t;
+                }
+            }
+            return hit_leaf;
+        }
+
+        template <typename Lanes>
+        static int lane_mask(uint32_t remaining){
+            return remaining >= uint32_t(Lanes::width) ? (1 << Lanes::width) - 1 : (1 << remaining) - 1;
+        }
+
+        void fill_sphere_record(uint32_t i, const ray& r, real t, hit_record& rec) const{
+            point3 center(spheres.center[0][i], spheres.center[1][i], spheres.center[2][i]);
+            vec3 motion(spheres.motion[0][i], spheres.motion[1][i], spheres.motion[2][i]);
+            sphere::set_hit_record(center + r.time() * motion, spheres.radius[i], spheres.mat[i], r, t, rec);
+        }
+
+        void fill_quad_record(uint32_t i, const ray& r, real t, hit_record& rec) const{
+            // The planar coordinates are recomputed for the one quad that was hit
+            point3 Q(quads.Q[0][i], quads.Q[1][i], quads.Q[2][i]);
+            vec3 u(quads.u[0][i], quads.u[1][i], quads.u[2][i]);
+            vec3 v(quads.v[0][i], quads.v[1][i], quads.v[2][i]);
+            vec3 w(quads.w[0][i], quads.w[1][i], quads.w[2][i]);
+            vec3 normal(quads.normal[0][i], quads.normal[1][i], quads.normal[2][i]);
+            vec3 planar_hitpt_vector = r.at(t) - Q;
+            auto alpha = dot(w, cross(planar_hitpt_vector, v));
+            auto beta = dot(w, cross(u, planar_hitpt_vector));
+            quad::set_hit_record(Q, u, v, normal, alpha, beta, quads.mat[i], r, t, rec);
+        }
+
+        static void gather(const hittable_list& list, std::vector<shared_ptr<hittable>>& prims){
+            // The objects of list with nested lists expanded, so boxes made of quads pack too
+            for(const auto& object : list.objects){
+                if(typeid(*object) == typeid(hittable_list))
+                    gather(static_cast<const hittable_list&>(*object), prims);
+                else
+                    prims.push_back(object);
+            }
+        }
+
+        packed_leaf pack_leaf(const std::vector<shared_ptr<hittable>>& prims, const uint32_t* order, uint32_t count){
+            // Appends the leaf's spheres and quads to the arrays, each range starting on a new
+            // block, and its remaining objects to the object list. Only exact spheres and
+            // quads are packed, subclasses may change how they are hit.
+            packed_leaf leaf;
+            leaf.sphere_first = uint32_t(spheres.size());
+            leaf.quad_first = uint32_t(quads.size());
+            leaf.object_first = uint32_t(objects.size());
+            leaf.sphere_count = leaf.quad_count = leaf.object_count = 0;
+
+            for(uint32_t k = 0; k < count; k++){
+                const auto& prim = prims[order[k]];
+                if(typeid(*prim) == typeid(sphere)){
+                    add_sphere(static_cast<const sphere&>(*prim));
+                    leaf.sphere_count++;
+                } else if(typeid(*prim) == typeid(quad)){
+                    add_quad(static_cast<const quad&>(*prim));
+                    leaf.quad_count++;
+                } else {
+                    objects.push_back(prim);
+                    leaf.object_count++;
+                }
+            }
+
+            sphere_total += leaf.sphere_count;
+            quad_total += leaf.quad_count;
+            pad_sphere_block();
+            pad_quad_block();
+            return leaf;
+        }
+
+        void add_sphere(const sphere& s){
+            for(int axis = 0; axis < 3; axis++){
+                spheres.center[axis].push_back(s.center.origin()[axis]);
+                spheres.motion[axis].push_back(s.center.direction()[axis]);
+            }
+            spheres.radius.push_back(s.radius);
+            spheres.mat.push_back(s.mat.get());
+            materials.push_back(s.mat);
+        }
+
+        void add_quad(const quad& q){
+            for(int axis = 0; axis < 3; axis++){
+                quads.Q[axis].push_back(q.Q[axis]);
+                quads.u[axis].push_back(q.u[axis]);
+                quads.v[axis].push_back(q.v[axis]);
+                quads.w[axis].push_back(q.w[axis]);
+                quads.normal[axis].push_back(q.normal[axis]);
+            }
+            quads.D.push_back(q.D);
+            quads.mat.push_back(q.mat.get());
+            materials.push_back(q.mat);
+        }
+
+        void pad_sphere_block(){
+            // Zero radius spheres at the origin; their lanes are masked off anyway
+            while(spheres.size() % real_block_width != 0){
+                for(int axis = 0; axis < 3; axis++){
+                    spheres.center[axis].push_back(0);
+                    spheres.motion[axis].push_back(0);
+                }
+                spheres.radius.push_back(0);
+                spheres.mat.push_back(nullptr);
+            }
+        }
+
+        void pad_quad_block(){
+            while(quads.size() % real_block_width != 0){
+                for(int axis = 0; axis < 3; axis++){
+                    quads.Q[axis].push_back(0);
+                    quads.u[axis].push_back(0);
+                    quads.v[axis].push_back(0);
+                    quads.w[axis].push_back(0);
+                    quads.normal[axis].push_back(0);
+                }
+                quads.D.push_back(0);
+                quads.mat.push_back(nullptr);
+            }
+        }
+};
+
+#endif // PACKED_BVH_H
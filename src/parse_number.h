@@ -0,0 +1,69 @@
+#ifndef PARSE_NUMBER_H
+#define PARSE_NUMBER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+inline bool parse_number(const char*& p, const char* end, double& value){
+    // Reads the decimal number at p and moves p past it. Fails if there is no number or it runs
+    // into anything but blanks, a line end or a # comment. Numbers take a fast exact path for
+    // up to 15 significant digits, which covers any written-out file, and fall back to strtod
+    // otherwise.
+    const char* start = p;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+    uint64_t mantissa = 0;
+    int digits = 0; // Significant digits in mantissa
+    int exponent = 0;
+    bool any = false;
+    for(; p < end && *p >= '0' && *p <= '9'; p++, any = true){
+        if(digits < 19){
+            mantissa = mantissa * 10 + uint64_t(*p - '0');
+            if(mantissa) digits++;
+        } else {
+            exponent++;
+        }
+    }
+    if(p < end && *p == '.'){
+        for(p++; p < end && *p >= '0' && *p <= '9'; p++, any = true){
+            if(digits < 19){
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                if(mantissa) digits++;
+                exponent--;
+            }
+        }
+    }
+    if(any && p < end && (*p == 'e' || *p == 'E')){
+        p++;
+        bool negative_exponent = false;
+        if(p < end && (*p == '-' || *p == '+')) negative_exponent = (*p++ == '-');
+        int e = 0;
+        bool exponent_digits = false;
+        for(; p < end && *p >= '0' && *p <= '9'; p++, exponent_digits = true)
+            if(e < 100000) e = e * 10 + (*p - '0');
+        any = exponent_digits;
+        exponent += negative_exponent ? -e : e;
+    }
+    if(!any || (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#')){
+        p = start;
+        return false;
+    }
+
+    // Both the mantissa and the power of ten are exact doubles here, so one
+    // multiplication or division rounds correctly (Clinger's fast path)
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                    1e20, 1e21, 1e22};
+    if(digits <= 15 && exponent >= -22 && exponent <= 22){
+        double m = double(mantissa);
+        value = exponent < 0 ? m / powers[-exponent] : m * powers[exponent];
+        if(negative) value = -value;
+    } else {
+        value = std::strtod(std::string(start, p).c_str(), nullptr);
+    }
+    return true;
+}
+
+#endif // PARSE_NUMBER_H
@@ -2,6 +2,7 @@
 #define QUAD_H
 #include "hittable.h"
 #include "hittable_list.h"
+#include "material.h"
 
 class quad : public hittable {
     public:
@@ -11,6 +12,7 @@ class quad : public hittable {
             normal = unit_vector(n);
             D = dot(normal, Q);
             w = n / dot(n, n); // Precompute w vector
+            area = n.length();
             set_bounding_box();
         }
 
@@ -46,14 +48,59 @@ class quad : public hittable {
             }
 
             rec.t = t;
-            rec.p = intersection;
-            rec.mat = mat;
+            rec.p = Q + alpha * u + beta * v; // On the plane, whatever the rounding in r.at(t)
+            rec.scale = 0;
+            rec.mat = mat.get();
 
             rec.set_face_normal(r, normal);
 
             return true;
         }
 
+        bool occluded(const ray& r, interval ray_t) const override{
+            auto denom = dot(normal, r.direction());
+            if(std::fabs(denom) < 1e-8) return false;
+
+            auto t = (D - dot(normal, r.origin())) / denom;
+            if(!ray_t.contains(t)) return false;
+
+            hit_record rec;
+            vec3 planar_hitpt_vector = r.at(t) - Q;
+            auto alpha = dot(w, cross(planar_hitpt_vector, v));
+            auto beta = dot(w, cross(u, planar_hitpt_vector));
+            return is_interior(alpha, beta, rec);
+        }
+
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            // Converts the uniform area density 1/area to solid angle as seen from origin
+            hit_record rec;
+            if(!this->hit(ray(origin, direction), interval(0, infinity), rec))
+                return 0;
+
+            auto distance_squared = rec.t * rec.t * direction.length_squared();
+            auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+            return distance_squared / (cosine * area);
+        }
+
+        vec3 random(const point3& origin) const override {
+            auto p = Q + (random_double() * u) + (random_double() * v);
+            return p - origin;
+        }
+
+        bool is_emissive() const override { return mat->is_emissive(); }
+
+        static void set_hit_record(const point3& Q, const vec3& u, const vec3& v, const vec3& normal, real alpha, real beta,
+                                   const material* mat, const ray& r, real t, hit_record& rec){
+            // The record of a hit at planar coordinates alpha, beta, for flat copies of quads
+            rec.t = t;
+            rec.p = Q + alpha * u + beta * v;
+            rec.scale = 0;
+            rec.u = alpha;
+            rec.v = beta;
+            rec.mat = mat;
+            rec.set_face_normal(r, normal);
+        }
+
         virtual bool is_interior(double alpha, double beta, hit_record& rec) const {
             interval unit_interval = interval(0.0, 1.0);
 
@@ -66,6 +113,8 @@ class quad : public hittable {
             return true;
         }
     private:
+        friend class packed_bvh; // Copies quads into its arrays
+
         point3 Q; // One corner of the quad
         vec3 u;   // Edge vector from Q
         vec3 v;   // Edge vector from Q
@@ -73,13 +122,12 @@ class quad : public hittable {
         shared_ptr<material> mat;   // Material of the quad
         aabb bbox; // Axis-aligned bounding box
         vec3 normal; // Normal vector of the quad
-        double D; // Plane constant
+        real D; // Plane constant
+        real area; // Surface area, for light sampling
 };
 
-inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat){
-            // Return a 3D box/cube withh opposite vertices a and b
-            auto sides = make_shared<hittable_list>();
-
+inline void box_faces(const point3& a, const point3& b, point3 corners[6], vec3 edges_u[6], vec3 edges_v[6]){
+            // The six sides of the box with opposite vertices a and b, as quad corners and edges
             // Construct a and b with minimum nad maximum vertices
             auto min = point3(fmin(a.x(),b.x()), fmin(a.y(),b.y()), fmin(a.z(),b.z()));
             auto max = point3(fmax(a.x(),b.x()), fmax(a.y(),b.y()), fmax(a.z(),b.z()));
@@ -88,14 +136,25 @@ inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_pt
             auto dy = vec3(0, max.y() - min.y(), 0);
             auto dz = vec3(0, 0, max.z() - min.z());
 
-            sides->add(make_shared<quad>(point3(min.x(),min.y(),max.z()),dx,dy,mat)); //front
-            sides->add(make_shared<quad>(point3(max.x(),min.y(),max.z()),-dz,dy,mat)); //right
-            sides->add(make_shared<quad>(point3(max.x(),min.y(),min.z()),-dx,dy,mat)); //back
-            sides->add(make_shared<quad>(point3(min.x(),min.y(),min.z()),dz,dy,mat)); //left
-            sides->add(make_shared<quad>(point3(min.x(),max.y(),max.z()),dx,-dz,mat)); //top
-            sides->add(make_shared<quad>(point3(min.x(),min.y(),min.z()),dx,dz,mat)); //bottom
+            corners[0] = point3(min.x(),min.y(),max.z()); edges_u[0] = dx;  edges_v[0] = dy;  //front
+            corners[1] = point3(max.x(),min.y(),max.z()); edges_u[1] = -dz; edges_v[1] = dy;  //right
+            corners[2] = point3(max.x(),min.y(),min.z()); edges_u[2] = -dx; edges_v[2] = dy;  //back
+            corners[3] = point3(min.x(),min.y(),min.z()); edges_u[3] = dz;  edges_v[3] = dy;  //left
+            corners[4] = point3(min.x(),max.y(),max.z()); edges_u[4] = dx;  edges_v[4] = -dz; //top
+            corners[5] = point3(min.x(),min.y(),min.z()); edges_u[5] = dx;  edges_v[5] = dz;  //bottom
+        }
+
+inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat){
+            // Return a 3D box/cube withh opposite vertices a and b
+            auto sides = make_shared<hittable_list>();
+
+            point3 corners[6];
+            vec3 edges_u[6], edges_v[6];
+            box_faces(a, b, corners, edges_u, edges_v);
+            for(int i = 0; i < 6; i++)
+                sides->add(make_shared<quad>(corners[i], edges_u[i], edges_v[i], mat));
 
             return sides;
         }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,67 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+// Box tests for packet traversal: one box against every active ray of a ray_packet (see
+// hittable.h), a register of rays at a time
+
+#include "hittable.h"
+#include "simd_lanes.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+template <typename Lanes>
+inline uint32_t packet_slab_test(const ray_packet& p, const real lo[3], const real hi[3], uint32_t active){
+    // The slab test of linear_bvh_node::hit per ray, including its far distance padding, so a
+    // packet enters exactly the nodes a single ray would. Each lane's direction sign picks its
+    // near and far plane. A ray running along a plane it starts on has a NaN distance to it;
+    // max and min return their second operand when the first is NaN, so the NaN is dropped
+    // the way the single ray test's comparisons drop it.
+    const real far_scale = 1 + 3 * std::numeric_limits<real>::epsilon();
+    uint32_t mask = 0;
+    for(int first = 0; first < p.size; first += Lanes::width){
+        if(((active >> first) & ((uint32_t(1) << Lanes::width) - 1)) == 0) continue;
+        Lanes t0(p.tmin);
+        Lanes t1 = Lanes::load(&p.tmax[first]);
+        for(int axis = 0; axis < 3; axis++){
+            Lanes origin = Lanes::load(&p.origin[axis][first]);
+            Lanes inv = Lanes::load(&p.inv_dir[axis][first]);
+            Lanes neg = inv < Lanes(0);
+            Lanes near = select(neg, Lanes(hi[axis]), Lanes(lo[axis]));
+            Lanes far = select(neg, Lanes(lo[axis]), Lanes(hi[axis]));
+            t0 = max((near - origin) * inv, t0);
+            t1 = min((far - origin) * inv * Lanes(far_scale), t1);
+        }
+        mask |= uint32_t(mask_bits(t0 <= t1)) << first;
+    }
+    return mask & active;
+}
+
+#if RT_X86
+RT_TARGET_AVX2 RT_FLATTEN
+inline uint32_t packet_slab_test_avx2(const ray_packet& p, const real lo[3], const real hi[3], uint32_t active){
+    return packet_slab_test<real_lanes<simd_level::avx2>>(p, lo, hi, active);
+}
+#endif
+
+inline uint32_t packet_box_hits(const ray_packet& p, const real lo[3], const real hi[3], uint32_t active){
+    // The active rays that overlap the box inside their intervals, with p.level's kernel
+#if RT_X86
+    if(p.level == simd_level::avx2) return packet_slab_test_avx2(p, lo, hi, active);
+    if(p.level == simd_level::sse) return packet_slab_test<real_lanes<simd_level::sse>>(p, lo, hi, active);
+#endif
+    return packet_slab_test<real_lanes<simd_level::scalar>>(p, lo, hi, active);
+}
+
+inline uint32_t packet_box_hits(const ray_packet& p, const aabb& box, uint32_t active){
+    real lo[3] = {box.x.min, box.y.min, box.z.min};
+    real hi[3] = {box.x.max, box.y.max, box.z.max};
+    return packet_box_hits(p, lo, hi, active);
+}
+
+inline bool packet_diverged(const ray_packet& p, uint32_t active){
+    // Once a quarter of the packet or less still overlaps a node, its subtree is cheaper to
+    // finish one ray at a time than to keep testing boxes for the whole packet
+    return bit_count(active) <= std::max(1, p.size / 4);
+}
+
+#endif // RAY_PACKET_H
@@ -0,0 +1,57 @@
+#ifndef RNG_H
+#define RNG_H
+#include <cstdint>
+
+inline uint64_t splitmix64(uint64_t x){
+    // Scrambles a 64-bit value, used to turn structured seeds (pixel, sample) into well spread states
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+class pcg32 {
+    // PCG32 (XSH RR variant) by M.E. O'Neill: 64-bit LCG state with a permuted 32-bit output.
+    public:
+        pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+        pcg32(uint64_t init_state, uint64_t init_stream = 0xda3e39cb94b95bdbULL) { seed(init_state, init_stream); }
+
+        void seed(uint64_t init_state, uint64_t init_stream = 0xda3e39cb94b95bdbULL){
+            state = 0;
+            inc = (init_stream << 1) | 1;
+            next_uint();
+            state += init_state;
+            next_uint();
+        }
+
+        uint32_t next_uint(){
+            uint64_t old_state = state;
+            state = old_state * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = uint32_t(((old_state >> 18) ^ old_state) >> 27);
+            uint32_t rot = uint32_t(old_state >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+
+        double next_double(){
+            // Returns a random real in [0,1) with 32 bits of resolution
+            return next_uint() * (1.0 / 4294967296.0);
+        }
+
+        uint64_t state; // Current LCG state
+        uint64_t inc;   // Stream selector, always odd
+};
+
+inline pcg32& thread_rng(){
+    // Each thread owns its generator, so drawing numbers never contends on a lock. Threads
+    // start from the same default state; renders reseed per pixel sample with seed_random().
+    static thread_local pcg32 rng;
+    return rng;
+}
+
+inline void seed_random(uint64_t seed, uint64_t stream_a = 0, uint64_t stream_b = 0){
+    // Reseeds the calling thread's generator with a stream derived from a base seed and up to
+    // two indices (e.g. pixel and sample), so results don't depend on which thread draws them.
+    thread_rng().seed(splitmix64(seed ^ splitmix64(stream_a ^ splitmix64(stream_b))));
+}
+
+#endif // RNG_H
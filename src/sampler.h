@@ -0,0 +1,331 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+#include "rng.h"
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Samplers hand out the random numbers of one pixel sample as a sequence of dimensions: the
+// camera takes the first few, then every path vertex takes its own block. Sample i of a pixel
+// is a pure function of (seed, pixel, i, dimension), so renders stay independent of threads,
+// tiles, passes and checkpoints whatever sampler is used.
+
+enum class sampler_type {
+    independent, // Uniform random numbers from the thread's PCG32
+    stratified,  // Correlated multi-jittered strata over samples_per_pixel
+    sobol,       // Owen-scrambled Sobol (0,2)-sequence, padded and shuffled per dimension pair
+    halton       // Owen-scrambled Halton, one prime base per dimension
+};
+
+struct point2 {
+    double x;
+    double y;
+};
+
+inline uint32_t reverse_bits(uint32_t x){
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed){
+    // Owen scrambling of the bits of x read as a binary fraction (Burley 2020, "Practical
+    // Hash-based Owen Scrambling"): the Laine-Karras hash lets every bit depend only on the
+    // bits below it, so applied to the reversed bits each digit is permuted by its prefix.
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+inline uint32_t permutation_element(uint32_t i, uint32_t length, uint32_t seed){
+    // Element i of a pseudorandom permutation of [0, length) chosen by seed, without storing
+    // it (Kensler 2013, "Correlated Multi-Jittered Sampling")
+    uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + seed) % length;
+}
+
+inline double bits_to_unit(uint32_t bits){
+    // Maps 32 bits to [0,1), the same resolution as pcg32::next_double
+    return bits * (1.0 / 4294967296.0);
+}
+
+class sampler {
+    public:
+        sampler(uint64_t seed) : seed(seed) {}
+        virtual ~sampler() = default;
+
+        void start_pixel_sample(uint64_t pixel_index, uint32_t index){
+            // Begins sample index of a pixel at dimension 0
+            pixel_hash = splitmix64(seed ^ splitmix64(pixel_index));
+            sample_index = index;
+            dimension = 0;
+        }
+
+        // Continues the current sample at the given dimension, so every path vertex can start
+        // its block of dimensions at the same place in every sample
+        void set_dimension(int d){ dimension = d; }
+
+        virtual double get_1d() = 0;
+        virtual point2 get_2d() = 0;
+
+    protected:
+        uint32_t dimension_hash() const{
+            // Per pixel and dimension scrambling seed
+            return uint32_t(splitmix64(pixel_hash ^ uint64_t(dimension)));
+        }
+
+        uint64_t seed;
+        uint64_t pixel_hash = 0; // Seed mixed with the pixel index
+        uint32_t sample_index = 0; // Index of the sample within its pixel
+        int dimension = 0; // Next dimension to hand out
+};
+
+class independent_sampler : public sampler {
+    // Plain Monte Carlo. The camera reseeds the thread's generator for every pixel sample, so
+    // drawing from it is as deterministic as the other samplers.
+    public:
+        independent_sampler(uint64_t seed) : sampler(seed) {}
+
+        double get_1d() override { dimension++; return thread_rng().next_double(); }
+
+        point2 get_2d() override {
+            dimension += 2;
+            double x = thread_rng().next_double();
+            return point2{x, thread_rng().next_double()};
+        }
+};
+
+class stratified_sampler : public sampler {
+    // Every dimension splits [0,1) into sample_count strata and every 2D dimension pair splits
+    // the square into a grid of about sqrt(sample_count) by sqrt(sample_count) cells whose
+    // projections are stratified too (correlated multi-jittered sampling). Each pixel sample
+    // takes one stratum through a per pixel and dimension permutation, so the strata are only
+    // all covered when the pixel takes all sample_count samples.
+    public:
+        stratified_sampler(uint64_t seed, int sample_count)
+            : sampler(seed), sample_count(uint32_t(sample_count > 0 ? sample_count : 1))
+        {
+            columns = 1;
+            while((columns + 1) * (columns + 1) <= this->sample_count) columns++;
+            rows = (this->sample_count + columns - 1) / columns;
+        }
+
+        double get_1d() override {
+            uint32_t hash = dimension_hash();
+            dimension++;
+            uint32_t s = stratum(hash);
+            return (s + jitter(hash * 0x68bc21ebu)) / sample_count;
+        }
+
+        point2 get_2d() override {
+            uint32_t hash = dimension_hash();
+            dimension += 2;
+            uint32_t s = stratum(hash);
+            uint32_t sx = permutation_element(s % columns, columns, hash * 0xa511e9b3u);
+            uint32_t sy = permutation_element(s / columns, rows, hash * 0x63d83595u);
+            double jx = jitter(hash * 0xa399d265u);
+            double jy = jitter(hash * 0x711ad6a5u);
+            return point2{(s % columns + (sy + jx) / rows) / columns,
+                          (s / columns + (sx + jy) / columns) / rows};
+        }
+
+    private:
+        uint32_t stratum(uint32_t hash) const{
+            // Samples past sample_count (a resumed render with more samples) reuse the strata
+            return permutation_element(sample_index % sample_count, sample_count, hash * 0x51633e2du);
+        }
+
+        double jitter(uint32_t hash) const{
+            return bits_to_unit(uint32_t(splitmix64(uint64_t(hash) << 32 | sample_index)));
+        }
+
+        uint32_t sample_count;
+        uint32_t columns; // Grid of the 2D strata
+        uint32_t rows;
+};
+
+class sobol_sampler : public sampler {
+    // Each dimension pair is an Owen-scrambled Sobol (0,2)-sequence in two dimensions, with the
+    // sample order shuffled independently per pair (Burley 2020). Only the first two Sobol
+    // dimensions are needed, which are well distributed for any sample count and power of two
+    // prefixes, and pairs are decorrelated by the shuffling instead of a direction table.
+    public:
+        sobol_sampler(uint64_t seed) : sampler(seed) {}
+
+        double get_1d() override {
+            uint32_t hash = dimension_hash();
+            dimension++;
+            uint32_t index = nested_uniform_scramble(sample_index, hash);
+            return bits_to_unit(nested_uniform_scramble(reverse_bits(index), hash ^ 0x2b3c5a71u));
+        }
+
+        point2 get_2d() override {
+            uint32_t hash = dimension_hash();
+            dimension += 2;
+            uint32_t index = nested_uniform_scramble(sample_index, hash);
+            return point2{bits_to_unit(nested_uniform_scramble(reverse_bits(index), hash ^ 0x2b3c5a71u)),
+                          bits_to_unit(nested_uniform_scramble(sobol_dimension_1(index), hash ^ 0x9e6c63d1u))};
+        }
+
+    private:
+        static uint32_t sobol_dimension_1(uint32_t index){
+            // The second Sobol dimension, whose generator matrix is Pascal's triangle mod 2,
+            // applied a byte of the index at a time
+            const auto& t = sobol_table::get();
+            return t.bytes[0][index & 0xff] ^ t.bytes[1][(index >> 8) & 0xff]
+                 ^ t.bytes[2][(index >> 16) & 0xff] ^ t.bytes[3][index >> 24];
+        }
+
+        struct sobol_table {
+            uint32_t bytes[4][256]; // XOR of the generator columns selected by each byte value
+
+            sobol_table(){
+                uint32_t columns[32];
+                uint32_t v = 1u << 31;
+                for(int bit = 0; bit < 32; bit++, v ^= v >> 1)
+                    columns[bit] = v;
+                for(int b = 0; b < 4; b++){
+                    for(int value = 0; value < 256; value++){
+                        uint32_t x = 0;
+                        for(int bit = 0; bit < 8; bit++)
+                            if(value & (1 << bit)) x ^= columns[b * 8 + bit];
+                        bytes[b][value] = x;
+                    }
+                }
+            }
+
+            static const sobol_table& get(){
+                static const sobol_table table;
+                return table;
+            }
+        };
+};
+
+class halton_sampler : public sampler {
+    // Dimension d is the radical inverse of the sample index in the d-th prime base, with its
+    // digits Owen-scrambled per pixel and dimension, which removes the correlation between
+    // the large bases of plain Halton. Dimensions past the prime table are independent.
+    public:
+        halton_sampler(uint64_t seed, int sample_count)
+            : sampler(seed), sample_count(sample_count > 0 ? sample_count : 1) {}
+
+        double get_1d() override {
+            uint32_t hash = dimension_hash();
+            int d = dimension++;
+            if(d >= int(primes().size()))
+                return bits_to_unit(uint32_t(splitmix64(uint64_t(hash) << 32 | sample_index)));
+            return scrambled_radical_inverse(sample_index, primes()[d], hash, sample_count);
+        }
+
+        point2 get_2d() override {
+            double x = get_1d();
+            return point2{x, get_1d()};
+        }
+
+    private:
+        static const std::vector<uint32_t>& primes(){
+            // The first 1024 primes, enough for the camera and several hundred path vertices
+            static const std::vector<uint32_t> table = [] {
+                std::vector<uint32_t> p;
+                for(uint32_t n = 2; p.size() < 1024; n++){
+                    bool prime = true;
+                    for(uint32_t q : p){
+                        if(q * q > n) break;
+                        if(n % q == 0) { prime = false; break; }
+                    }
+                    if(prime) p.push_back(n);
+                }
+                return p;
+            }();
+            return table;
+        }
+
+        static double scrambled_radical_inverse(uint32_t index, uint32_t base, uint32_t hash, int sample_count){
+            // Mirrors the base-b digits of index about the radix point, permuting each digit by
+            // a permutation chosen from the digits above it. Trailing zeros are scrambled too,
+            // as deep as sample_count samples can be stratified; the digits below only add an
+            // independent uniform offset.
+            if(base == 2)
+                return bits_to_unit(nested_uniform_scramble(reverse_bits(index), hash));
+
+            const double inv_base = 1.0 / base;
+            double scale = 1;
+            double result = 0;
+            uint64_t prefix = 0;
+            while(index != 0 || scale * sample_count > 1){
+                uint32_t digit_hash = uint32_t(splitmix64(prefix ^ (uint64_t(hash) << 32)));
+                uint32_t digit = permutation_element(index % base, base, digit_hash);
+                scale *= inv_base;
+                result += digit * scale;
+                prefix = prefix * base + digit + 1;
+                index /= base;
+            }
+            result += scale * bits_to_unit(uint32_t(splitmix64(prefix ^ (uint64_t(~hash) << 32))));
+            return result < 1 ? result : 1 - std::numeric_limits<double>::epsilon() / 2;
+        }
+
+        int sample_count; // Samples per pixel, which sets how many digits get scrambled
+};
+
+inline std::unique_ptr<sampler> make_sampler(sampler_type type, uint64_t seed, int samples_per_pixel){
+    switch(type){
+        case sampler_type::stratified: return std::unique_ptr<sampler>(new stratified_sampler(seed, samples_per_pixel));
+        case sampler_type::sobol: return std::unique_ptr<sampler>(new sobol_sampler(seed));
+        case sampler_type::halton: return std::unique_ptr<sampler>(new halton_sampler(seed, samples_per_pixel));
+        default: return std::unique_ptr<sampler>(new independent_sampler(seed));
+    }
+}
+
+inline sampler*& active_sampler(){
+    // The sampler of the pixel sample the calling thread is tracing, set by the camera's render
+    // threads. Without one, samples come straight from the thread's generator.
+    static thread_local sampler* current = nullptr;
+    return current;
+}
+
+inline double sample_1d(){
+    sampler* s = active_sampler();
+    return s ? s->get_1d() : thread_rng().next_double();
+}
+
+inline point2 sample_2d(){
+    sampler* s = active_sampler();
+    if(s) return s->get_2d();
+    double x = thread_rng().next_double();
+    return point2{x, thread_rng().next_double()};
+}
+
+#endif // SAMPLER_H
@@ -0,0 +1,786 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "scene_file.h"
+#include "linear_bvh.h"
+#include "aligned_allocator.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Binary scene caches. A cache holds everything a scene file describes, with the spheres and
+// quads in flat arrays and a prebuilt linear BVH over them, laid out so the mapped file is used
+// in place: loading allocates only the textures, materials and the few objects that stay
+// separate (lights, media), never one per primitive.
+//
+// The file is a header followed by sections, each aligned to 64 bytes:
+//
+//   header          magic, version, precision, stamp of the scene file, camera settings, sections
+//   textures        cache_texture, checkers refer to earlier textures by number
+//   materials       cache_material
+//   strings         image file names, each null terminated
+//   spheres         cache_sphere
+//   quads           cache_quad
+//   nodes           linear_bvh_node over the primitive ids in prim_ids
+//   prim_ids        sphere number, or quad number with cache_quad_bit set
+//   lights          primitive ids of the emitters that stay separate objects
+//   media           cache_medium, each a range of medium_prims
+//   medium_prims    primitive ids of constant_medium boundaries
+//
+// Transforms are baked into the primitives and all blocks share the one BVH, so a cache
+// renders the scene file's geometry, not its exact object tree. Meshes, spheres under rotate_y
+// and nested constant_medium blocks can't be flattened and make building a cache fail. Caches are
+// native endian and only read back by the program that wrote them. Loading checks every number
+// the cache is indexed by once, so a damaged cache is refused instead of read out of bounds.
+
+const uint32_t cache_quad_bit = 0x80000000u;
+
+struct cache_camera {
+    // The camera settings a scene file can set
+    double aspect_ratio;
+    int32_t image_width;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t russian_roulette_depth;
+    double vfov;
+    point3 lookfrom;
+    point3 lookat;
+    vec3 vup;
+    double defocus_angle;
+    double focus_dist;
+    color background;
+    uint64_t seed;
+    int32_t sample_lights;
+    int32_t sampler;
+    double adaptive_threshold;
+    int32_t adaptive_min_samples;
+    int32_t pad;
+};
+
+struct cache_texture {
+    uint32_t kind; // texture_kind
+    int32_t even, odd;
+    uint32_t file; // Offset of the image file name in strings
+    double scale;
+    color albedo;
+};
+
+struct cache_material {
+    uint32_t kind; // material_kind
+    int32_t tex;
+    color albedo;
+    double param;
+};
+
+struct cache_sphere {
+    point3 center; // At time 0
+    vec3 motion; // Moves to center + motion at time 1
+    real radius;
+    uint32_t mat;
+    uint32_t pad;
+};
+
+struct cache_quad {
+    point3 Q;
+    vec3 u, v;
+    vec3 w; // Same as quad's precomputed members
+    vec3 normal;
+    real D;
+    real area;
+    uint32_t mat;
+    uint32_t pad;
+};
+
+struct cache_medium {
+    double density;
+    int32_t tex;
+    uint32_t first, count; // Range of medium_prims forming the boundary
+};
+
+struct cache_section {
+    uint64_t offset; // From the start of the file
+    uint64_t count; // Entries, or bytes for strings
+};
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t real_size; // sizeof(real) of the program that wrote it
+    uint32_t pad;
+    uint64_t file_size;
+    uint64_t source_size; // Size and modification time of the scene file it was built from
+    int64_t source_time;
+    cache_camera camera;
+    cache_section textures, materials, strings, spheres, quads, nodes, prim_ids, lights, media, medium_prims;
+
+    static const char* format_magic() { return "RTSC"; }
+    static uint32_t format_version() { return 3; }
+};
+
+inline bool scene_file_stamp(const std::string& path, uint64_t& size, int64_t& time){
+    // A cache is current when the scene file still has the size and time it was built from
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0) return false;
+    size = uint64_t(info.st_size);
+    time = int64_t(info.st_mtime);
+    return true;
+}
+
+class mapped_file {
+    // A whole file as read-only memory. POSIX systems map it, so pages load on first touch and
+    // are shared between runs through the page cache; elsewhere the file is read into a buffer.
+    public:
+        mapped_file() {}
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+        ~mapped_file() { close(); }
+
+        bool open(const std::string& path){
+            close();
+#ifdef _WIN32
+            std::ifstream in(path, std::ios::binary);
+            if(!in) return false;
+            in.seekg(0, std::ios::end);
+            buffer.resize(size_t(in.tellg()));
+            in.seekg(0, std::ios::beg);
+            if(!in.read(buffer.data(), std::streamsize(buffer.size()))) return false;
+            bytes = buffer.data();
+            length = buffer.size();
+            return true;
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0) return false;
+            struct stat info;
+            if(fstat(fd, &info) != 0 || info.st_size <= 0){
+                ::close(fd);
+                return false;
+            }
+            void* address = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(address == MAP_FAILED) return false;
+            bytes = static_cast<const char*>(address);
+            length = size_t(info.st_size);
+            return true;
+#endif
+        }
+
+        void close(){
+#ifdef _WIN32
+            buffer.clear();
+#else
+            if(bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+            bytes = nullptr;
+            length = 0;
+        }
+
+        const char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        const char* bytes = nullptr;
+        size_t length = 0;
+#ifdef _WIN32
+        aligned_vector<char> buffer;
+#endif
+};
+
+class cached_geometry: public hittable {
+    // The BVH, spheres and quads of a scene cache, used in place in the mapped file
+    public:
+        cached_geometry(shared_ptr<const mapped_file> file, const cache_header& header,
+                        const std::vector<shared_ptr<material>>& materials)
+            : file(file), materials(materials) {
+            const char* base = file->data();
+            nodes = reinterpret_cast<const linear_bvh_node*>(base + header.nodes.offset);
+            prim_ids = reinterpret_cast<const uint32_t*>(base + header.prim_ids.offset);
+            spheres = reinterpret_cast<const cache_sphere*>(base + header.spheres.offset);
+            quads = reinterpret_cast<const cache_quad*>(base + header.quads.offset);
+            for(const auto& mat : materials) material_ptrs.push_back(mat.get());
+
+            const auto& root = nodes[0];
+            bbox = aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+                        point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
+            return traverse_linear_bvh(nodes, r, ray_t, [&](uint32_t first, uint32_t count, interval& t){
+                bool hit_leaf = false;
+                for(uint32_t i = first; i < first + count; i++){
+                    uint32_t id = prim_ids[i];
+                    bool hit_prim = (id & cache_quad_bit)
+                        ? hit_quad(quads[id & ~cache_quad_bit], r, t, rec)
+                        : hit_sphere(spheres[id], r, t, rec);
+                    if(hit_prim){
+                        hit_leaf = true;
+                        t.max = rec.t;
+                    }
+                }
+                return hit_leaf;
+            });
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            hit_record rec;
+            return traverse_linear_bvh_any(nodes, r, ray_t, [&](uint32_t first, uint32_t count){
+                for(uint32_t i = first; i < first + count; i++){
+                    uint32_t id = prim_ids[i];
+                    if((id & cache_quad_bit) ? hit_quad(quads[id & ~cache_quad_bit], r, ray_t, rec)
+                                             : hit_sphere(spheres[id], r, ray_t, rec))
+                        return true;
+                }
+                return false;
+            });
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+    private:
+        shared_ptr<const mapped_file> file; // Keeps the arrays below mapped
+        const linear_bvh_node* nodes;
+        const uint32_t* prim_ids;
+        const cache_sphere* spheres;
+        const cache_quad* quads;
+        std::vector<shared_ptr<material>> materials;
+        std::vector<const material*> material_ptrs;
+        aabb bbox;
+
+        bool hit_sphere(const cache_sphere& s, const ray& r, interval ray_t, hit_record& rec) const{
+            // sphere::hit on the flat record
+            point3 center = s.center + r.time() * s.motion;
+            real near, far;
+            if(!sphere::intersect(center, s.radius, r, near, far)) return false;
+            auto root = near;
+            if(!ray_t.surrounds(root)){
+                root = far;
+                if(!ray_t.surrounds(root)) return false;
+            }
+            sphere::set_hit_record(center, s.radius, material_ptrs[s.mat], r, root, rec);
+            return true;
+        }
+
+        bool hit_quad(const cache_quad& q, const ray& r, interval ray_t, hit_record& rec) const{
+            // quad::hit on the flat record
+            auto denom = dot(q.normal, r.direction());
+            if(std::fabs(denom) < 1e-8) return false;
+
+            auto t = (q.D - dot(q.normal, r.origin())) / denom;
+            if(!ray_t.contains(t)) return false;
+
+            auto intersection = r.at(t);
+            vec3 planar_hitpt_vector = intersection - q.Q;
+            auto alpha = dot(q.w, cross(planar_hitpt_vector, q.v));
+            auto beta = dot(q.w, cross(q.u, planar_hitpt_vector));
+            if(!(alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1)) return false;
+
+            quad::set_hit_record(q.Q, q.u, q.v, q.normal, alpha, beta, material_ptrs[q.mat], r, t, rec);
+            return true;
+        }
+};
+
+class scene_cache_builder: public scene_builder {
+    // Flattens a scene file into the arrays of a cache, then writes them out
+    public:
+        bool add_sphere(const point3& center, double radius, int mat) override{
+            return add_moving_sphere(center, center, radius, mat);
+        }
+
+        bool add_moving_sphere(const point3& center0, const point3& center1, double radius, int mat) override{
+            const frame& f = frames.back();
+            if(f.sin_theta != 0 || f.cos_theta != 1){
+                error = "spheres under rotate_y can't be cached, their texture coordinates would change";
+                return false;
+            }
+            cache_sphere s;
+            s.center = f.to_world(center0);
+            s.motion = f.to_world(center1) - s.center;
+            s.radius = std::fmax(0, radius);
+            s.mat = uint32_t(mat);
+            s.pad = 0;
+            spheres.push_back(s);
+
+            auto rvec = vec3(s.radius, s.radius, s.radius);
+            add_prim(uint32_t(spheres.size() - 1), mat, aabb(aabb(s.center - rvec, s.center + rvec),
+                     aabb(s.center + s.motion - rvec, s.center + s.motion + rvec)));
+            return true;
+        }
+
+        bool add_quad(const point3& Q, const vec3& u, const vec3& v, int mat) override{
+            const frame& f = frames.back();
+            cache_quad q;
+            q.Q = f.to_world(Q);
+            q.u = f.rotate(u);
+            q.v = f.rotate(v);
+            auto n = cross(q.u, q.v);
+            q.normal = unit_vector(n);
+            q.D = dot(q.normal, q.Q);
+            q.w = n / dot(n, n);
+            q.area = n.length();
+            q.mat = uint32_t(mat);
+            q.pad = 0;
+            quads.push_back(q);
+
+            add_prim(uint32_t(quads.size() - 1) | cache_quad_bit, mat,
+                     aabb(aabb(q.Q, q.Q + q.u + q.v), aabb(q.Q + q.u, q.Q + q.v)));
+            return true;
+        }
+
+        bool add_box(const point3& a, const point3& b, int mat) override{
+            point3 corners[6];
+            vec3 edges_u[6], edges_v[6];
+            box_faces(a, b, corners, edges_u, edges_v);
+            for(int i = 0; i < 6; i++)
+                add_quad(corners[i], edges_u[i], edges_v[i], mat);
+            return true;
+        }
+
+        bool add_mesh(const std::string&, int) override{
+            error = "triangle meshes can't be cached";
+            return false;
+        }
+
+        void add_texture(const texture_desc& desc) override{
+            cache_texture t;
+            t.kind = uint32_t(desc.kind);
+            t.even = desc.even;
+            t.odd = desc.odd;
+            t.file = uint32_t(strings.size());
+            t.scale = desc.scale;
+            t.albedo = desc.albedo;
+            textures.push_back(t);
+            strings.insert(strings.end(), desc.file.begin(), desc.file.end());
+            strings.push_back('\0');
+        }
+
+        void add_material(const material_desc& desc) override{
+            cache_material m;
+            m.kind = uint32_t(desc.kind);
+            m.tex = desc.tex;
+            m.albedo = desc.albedo;
+            m.param = desc.param;
+            materials.push_back(m);
+        }
+
+        bool open_block(const block_desc& desc) override{
+            frame f = frames.back();
+            f.top_level = f.top_level && desc.kind == block_kind::group;
+            if(desc.kind == block_kind::translate){
+                f.offset = f.to_world(desc.offset);
+            } else if(desc.kind == block_kind::rotate_y){
+                auto radians = degrees_to_radians(desc.value);
+                auto c = std::cos(radians), s = std::sin(radians);
+                auto cos_theta = f.cos_theta * c - f.sin_theta * s;
+                f.sin_theta = f.sin_theta * c + f.cos_theta * s;
+                f.cos_theta = cos_theta;
+            } else if(desc.kind == block_kind::constant_medium){
+                if(in_medium){
+                    error = "nested constant_medium blocks can't be cached";
+                    return false;
+                }
+                in_medium = true;
+                cache_medium m;
+                m.density = desc.value;
+                m.tex = desc.tex;
+                m.first = uint32_t(medium_prims.size());
+                m.count = 0;
+                media.push_back(m);
+            }
+            f.medium = desc.kind == block_kind::constant_medium;
+            frames.push_back(f);
+            return true;
+        }
+
+        bool close_block() override{
+            if(frames.back().medium){
+                media.back().count = uint32_t(medium_prims.size()) - media.back().first;
+                in_medium = false;
+            }
+            frames.pop_back();
+            return true;
+        }
+
+        bool write(const std::string& path, const camera& cam, uint64_t source_size, int64_t source_time,
+                   std::string& error_text) const{
+            // Builds the BVH and writes the cache, through a temporary file so an interrupted
+            // write never leaves a truncated cache behind
+            bvh_options options;
+            options.split = bvh_split::sah;
+            options.max_leaf_size = 4;
+            bvh_builder builder(bvh_bounds, options);
+            aligned_vector<linear_bvh_node> nodes(builder.nodes.size());
+            flatten_bvh_nodes(builder, nodes.data());
+            std::vector<uint32_t> ids(builder.prim_order.size());
+            for(size_t i = 0; i < ids.size(); i++) ids[i] = bvh_prims[builder.prim_order[i]];
+
+            cache_header header;
+            std::memset(static_cast<void*>(&header), 0, sizeof(header));
+            std::memcpy(header.magic, cache_header::format_magic(), 4);
+            header.version = cache_header::format_version();
+            header.real_size = uint32_t(sizeof(real));
+            header.source_size = source_size;
+            header.source_time = source_time;
+            header.camera = camera_settings(cam);
+
+            uint64_t offset = align(sizeof(header));
+            auto section = [&](cache_section& s, size_t count, size_t size){
+                s.offset = offset;
+                s.count = count;
+                offset = align(offset + count * size);
+            };
+            section(header.textures, textures.size(), sizeof(cache_texture));
+            section(header.materials, materials.size(), sizeof(cache_material));
+            section(header.strings, strings.size(), 1);
+            section(header.spheres, spheres.size(), sizeof(cache_sphere));
+            section(header.quads, quads.size(), sizeof(cache_quad));
+            section(header.nodes, nodes.size(), sizeof(linear_bvh_node));
+            section(header.prim_ids, ids.size(), sizeof(uint32_t));
+            section(header.lights, lights.size(), sizeof(uint32_t));
+            section(header.media, media.size(), sizeof(cache_medium));
+            section(header.medium_prims, medium_prims.size(), sizeof(uint32_t));
+            header.file_size = offset;
+
+            std::string temp_path = path + ".tmp";
+            {
+                std::ofstream out(temp_path, std::ios::binary);
+                if(!out){
+                    error_text = "cannot write " + temp_path;
+                    return false;
+                }
+                uint64_t written = 0;
+                auto put = [&](const cache_section& s, const void* data, size_t bytes){
+                    static const char zeros[64] = {};
+                    out.write(zeros, std::streamsize(s.offset - written));
+                    out.write(static_cast<const char*>(data), std::streamsize(bytes));
+                    written = s.offset + bytes;
+                };
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                written = sizeof(header);
+                put(header.textures, textures.data(), textures.size() * sizeof(cache_texture));
+                put(header.materials, materials.data(), materials.size() * sizeof(cache_material));
+                put(header.strings, strings.data(), strings.size());
+                put(header.spheres, spheres.data(), spheres.size() * sizeof(cache_sphere));
+                put(header.quads, quads.data(), quads.size() * sizeof(cache_quad));
+                put(header.nodes, nodes.data(), nodes.size() * sizeof(linear_bvh_node));
+                put(header.prim_ids, ids.data(), ids.size() * sizeof(uint32_t));
+                put(header.lights, lights.data(), lights.size() * sizeof(uint32_t));
+                put(header.media, media.data(), media.size() * sizeof(cache_medium));
+                put(header.medium_prims, medium_prims.data(), medium_prims.size() * sizeof(uint32_t));
+                cache_section end = {header.file_size, 0};
+                put(end, nullptr, 0);
+                if(!out){
+                    error_text = "cannot write " + temp_path;
+                    return false;
+                }
+            }
+
+            if(std::rename(temp_path.c_str(), path.c_str()) != 0){
+                std::remove(path.c_str());
+                if(std::rename(temp_path.c_str(), path.c_str()) != 0){
+                    error_text = "cannot replace " + path;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        struct frame {
+            // Maps a block's coordinates to the world: rotation about y, then offset
+            double cos_theta = 1, sin_theta = 0;
+            vec3 offset;
+            bool top_level = true; // Only groups are open, as for gather_lights
+            bool medium = false; // The block is a constant_medium
+
+            vec3 rotate(const vec3& v) const{
+                return vec3(cos_theta * v.x() + sin_theta * v.z(), v.y(), -sin_theta * v.x() + cos_theta * v.z());
+            }
+            point3 to_world(const point3& p) const { return rotate(p) + offset; }
+        };
+
+        std::vector<frame> frames = std::vector<frame>(1);
+        bool in_medium = false;
+
+        std::vector<cache_texture> textures;
+        std::vector<cache_material> materials;
+        std::vector<char> strings;
+        std::vector<cache_sphere> spheres;
+        std::vector<cache_quad> quads;
+        std::vector<aabb> bvh_bounds;
+        std::vector<uint32_t> bvh_prims; // Primitive ids in the BVH, parallel to bvh_bounds
+        std::vector<uint32_t> lights;
+        std::vector<cache_medium> media;
+        std::vector<uint32_t> medium_prims;
+
+        void add_prim(uint32_t id, int mat, const aabb& bbox){
+            // Emitters outside any transform, BVH or medium stay objects of their own, so
+            // gather_lights finds the same lights as in the parsed scene
+            if(in_medium){
+                medium_prims.push_back(id);
+            } else if(frames.back().top_level && materials[mat].kind == uint32_t(material_kind::diffuse_light)){
+                lights.push_back(id);
+            } else {
+                bvh_prims.push_back(id);
+                bvh_bounds.push_back(bbox);
+            }
+        }
+
+        static uint64_t align(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+        static cache_camera camera_settings(const camera& cam){
+            cache_camera c;
+            std::memset(static_cast<void*>(&c), 0, sizeof(c));
+            c.aspect_ratio = cam.aspect_ratio;
+            c.image_width = cam.image_width;
+            c.samples_per_pixel = cam.samples_per_pixel;
+            c.max_depth = cam.max_depth;
+            c.russian_roulette_depth = cam.russian_roulette_depth;
+            c.vfov = cam.vfov;
+            c.lookfrom = cam.lookfrom;
+            c.lookat = cam.lookat;
+            c.vup = cam.vup;
+            c.defocus_angle = cam.defocus_angle;
+            c.focus_dist = cam.focus_dist;
+            c.background = cam.background;
+            c.seed = cam.seed;
+            c.sample_lights = cam.sample_lights ? 1 : 0;
+            c.sampler = int32_t(cam.sampling);
+            c.adaptive_threshold = cam.adaptive_threshold;
+            c.adaptive_min_samples = cam.adaptive_min_samples;
+            return c;
+        }
+};
+
+inline bool build_scene_cache(const std::string& scene_path, const std::string& cache_path, std::string& error){
+    // Parses a scene file and writes its cache. Fails with the reason in error if the scene
+    // has an error or something a cache can't hold.
+    uint64_t size;
+    int64_t time;
+    std::string text;
+    if(!scene_file_stamp(scene_path, size, time) || !read_text_file(scene_path, text, error)){
+        if(error.empty()) error = "cannot open " + scene_path;
+        return false;
+    }
+    camera cam;
+    scene_cache_builder builder;
+    scene_parser parser(text.data(), text.data() + text.size(), scene_path);
+    if(!parser.parse(cam, builder)){
+        error = parser.error();
+        return false;
+    }
+    return builder.write(cache_path, cam, size, time, error);
+}
+
+inline shared_ptr<hittable> cached_object(const mapped_file& file, const cache_header& header, uint32_t id,
+                                          const std::vector<shared_ptr<material>>& materials){
+    // A separate sphere or quad object for a primitive that isn't in the BVH
+    if(id & cache_quad_bit){
+        const auto& q = reinterpret_cast<const cache_quad*>(file.data() + header.quads.offset)[id & ~cache_quad_bit];
+        return make_shared<quad>(q.Q, q.u, q.v, materials[q.mat]);
+    }
+    const auto& s = reinterpret_cast<const cache_sphere*>(file.data() + header.spheres.offset)[id];
+    if(s.motion.length_squared() == 0) return make_shared<sphere>(s.center, s.radius, materials[s.mat]);
+    return make_shared<sphere>(s.center, s.center + s.motion, s.radius, materials[s.mat]);
+}
+
+inline bool valid_cache_subtree(const linear_bvh_node* nodes, uint64_t node_count, uint64_t prim_id_count,
+                                uint64_t index, int depth, uint64_t& end){
+    // Checks the depth first layout of the subtree at index: right children follow the left
+    // subtree, leaves stay inside prim_ids and no path has more interior nodes than the
+    // traversal stacks hold. Sets end to the index after the subtree.
+    if(index >= node_count) return false;
+    const auto& node = nodes[index];
+    if(node.is_leaf()){
+        end = index + 1;
+        return node.offset + uint64_t(node.prim_count) <= prim_id_count;
+    }
+    uint64_t left_end;
+    return depth < bvh_max_depth && node.axis < 3
+        && valid_cache_subtree(nodes, node_count, prim_id_count, index + 1, depth + 1, left_end)
+        && node.offset == left_end
+        && valid_cache_subtree(nodes, node_count, prim_id_count, node.offset, depth + 1, end);
+}
+
+inline bool valid_cache_contents(const char* base, const cache_header& header){
+    // Checks every number the loader and cached_geometry look up by: kinds, texture, material
+    // and primitive numbers, string offsets, medium ranges and the BVH. The sections themselves
+    // are already known to lie inside the file.
+    auto textures = reinterpret_cast<const cache_texture*>(base + header.textures.offset);
+    auto strings = base + header.strings.offset;
+    for(uint64_t i = 0; i < header.textures.count; i++){
+        const auto& t = textures[i];
+        if(t.kind >= uint32_t(texture_kind::custom)) return false;
+        // Checkers refer to textures defined before them
+        if(texture_kind(t.kind) == texture_kind::checker
+           && (t.even < 0 || uint64_t(t.even) >= i || t.odd < 0 || uint64_t(t.odd) >= i))
+            return false;
+        if(texture_kind(t.kind) == texture_kind::image
+           && (t.file >= header.strings.count || !std::memchr(strings + t.file, '\0', header.strings.count - t.file)))
+            return false;
+    }
+    auto valid_texture = [&](int32_t tex){ return tex >= 0 && uint64_t(tex) < header.textures.count; };
+
+    auto materials = reinterpret_cast<const cache_material*>(base + header.materials.offset);
+    for(uint64_t i = 0; i < header.materials.count; i++){
+        const auto& m = materials[i];
+        if(m.kind >= uint32_t(material_kind::custom)) return false;
+        material_kind kind = material_kind(m.kind);
+        bool textured = kind == material_kind::lambertian || kind == material_kind::diffuse_light
+                        || kind == material_kind::isotropic;
+        if(textured && !valid_texture(m.tex)) return false;
+    }
+
+    auto spheres = reinterpret_cast<const cache_sphere*>(base + header.spheres.offset);
+    for(uint64_t i = 0; i < header.spheres.count; i++)
+        if(spheres[i].mat >= header.materials.count) return false;
+    auto quads = reinterpret_cast<const cache_quad*>(base + header.quads.offset);
+    for(uint64_t i = 0; i < header.quads.count; i++)
+        if(quads[i].mat >= header.materials.count) return false;
+
+    auto valid_prims = [&](const cache_section& section){
+        auto ids = reinterpret_cast<const uint32_t*>(base + section.offset);
+        for(uint64_t i = 0; i < section.count; i++){
+            uint32_t id = ids[i];
+            if((id & cache_quad_bit) ? (id & ~cache_quad_bit) >= header.quads.count : id >= header.spheres.count)
+                return false;
+        }
+        return true;
+    };
+    if(!valid_prims(header.prim_ids) || !valid_prims(header.lights) || !valid_prims(header.medium_prims))
+        return false;
+
+    auto media = reinterpret_cast<const cache_medium*>(base + header.media.offset);
+    for(uint64_t i = 0; i < header.media.count; i++){
+        const auto& m = media[i];
+        if(uint64_t(m.first) + m.count > header.medium_prims.count || !valid_texture(m.tex)) return false;
+    }
+
+    if(header.nodes.count == 0) return true;
+    uint64_t end;
+    auto nodes = reinterpret_cast<const linear_bvh_node*>(base + header.nodes.offset);
+    return valid_cache_subtree(nodes, header.nodes.count, header.prim_ids.count, 0, 0, end)
+        && end == header.nodes.count;
+}
+
+inline bool load_scene_cache(const std::string& cache_path, const std::string& scene_path, scene& s, std::string& error){
+    // Maps a cache and sets up s to render from it. Fails if the cache is missing, damaged,
+    // from another version or older than the scene file at scene_path.
+    auto file = make_shared<mapped_file>();
+    if(!file->open(cache_path)){
+        error = "cannot open " + cache_path;
+        return false;
+    }
+    cache_header header;
+    if(file->size() < sizeof(header)){
+        error = cache_path + " is not a scene cache";
+        return false;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if(std::memcmp(header.magic, cache_header::format_magic(), 4) != 0 || header.file_size != file->size()){
+        error = cache_path + " is not a scene cache";
+        return false;
+    }
+    if(header.version != cache_header::format_version()){
+        error = cache_path + " is from another version";
+        return false;
+    }
+    if(header.real_size != sizeof(real)){
+        error = cache_path + " is from a build with another geometry precision";
+        return false;
+    }
+    uint64_t size;
+    int64_t time;
+    if(!scene_file_stamp(scene_path, size, time) || size != header.source_size || time != header.source_time){
+        error = cache_path + " is out of date";
+        return false;
+    }
+    const cache_section* sections = &header.textures;
+    const size_t entry_sizes[] = {sizeof(cache_texture), sizeof(cache_material), 1, sizeof(cache_sphere),
+                                  sizeof(cache_quad), sizeof(linear_bvh_node), sizeof(uint32_t),
+                                  sizeof(uint32_t), sizeof(cache_medium), sizeof(uint32_t)};
+    for(int i = 0; i < 10; i++){
+        if(sections[i].offset % 64 != 0 || sections[i].offset > header.file_size
+           || sections[i].count > (header.file_size - sections[i].offset) / entry_sizes[i]){
+            error = cache_path + " is damaged";
+            return false;
+        }
+    }
+    const char* base = file->data();
+    if(!valid_cache_contents(base, header)){
+        error = cache_path + " is damaged";
+        return false;
+    }
+
+    std::vector<shared_ptr<texture>> textures;
+    auto cached_textures = reinterpret_cast<const cache_texture*>(base + header.textures.offset);
+    for(uint64_t i = 0; i < header.textures.count; i++){
+        const auto& t = cached_textures[i];
+        texture_desc desc;
+        desc.kind = texture_kind(t.kind);
+        desc.albedo = t.albedo;
+        desc.scale = t.scale;
+        desc.even = t.even;
+        desc.odd = t.odd;
+        if(desc.kind == texture_kind::image) desc.file = base + header.strings.offset + t.file;
+        textures.push_back(scene_object_builder::make_texture(desc, textures));
+    }
+    std::vector<shared_ptr<material>> materials;
+    auto cached_materials = reinterpret_cast<const cache_material*>(base + header.materials.offset);
+    for(uint64_t i = 0; i < header.materials.count; i++){
+        const auto& m = cached_materials[i];
+        material_desc desc;
+        desc.kind = material_kind(m.kind);
+        desc.tex = m.tex;
+        desc.albedo = m.albedo;
+        desc.param = m.param;
+        materials.push_back(scene_object_builder::make_material(desc, textures));
+    }
+
+    const cache_camera& c = header.camera;
+    camera& cam = s.cam;
+    cam.aspect_ratio = c.aspect_ratio;
+    cam.image_width = c.image_width;
+    cam.samples_per_pixel = c.samples_per_pixel;
+    cam.max_depth = c.max_depth;
+    cam.russian_roulette_depth = c.russian_roulette_depth;
+    cam.vfov = c.vfov;
+    cam.lookfrom = c.lookfrom;
+    cam.lookat = c.lookat;
+    cam.vup = c.vup;
+    cam.defocus_angle = c.defocus_angle;
+    cam.focus_dist = c.focus_dist;
+    cam.background = c.background;
+    cam.seed = c.seed;
+    cam.sample_lights = c.sample_lights != 0;
+    cam.sampling = sampler_type(c.sampler);
+    cam.adaptive_threshold = c.adaptive_threshold;
+    cam.adaptive_min_samples = c.adaptive_min_samples;
+
+    s.world.clear();
+    if(header.nodes.count > 0)
+        s.world.add(make_shared<cached_geometry>(file, header, materials));
+    auto lights = reinterpret_cast<const uint32_t*>(base + header.lights.offset);
+    for(uint64_t i = 0; i < header.lights.count; i++)
+        s.world.add(cached_object(*file, header, lights[i], materials));
+    auto media = reinterpret_cast<const cache_medium*>(base + header.media.offset);
+    auto medium_prims = reinterpret_cast<const uint32_t*>(base + header.medium_prims.offset);
+    for(uint64_t i = 0; i < header.media.count; i++){
+        hittable_list boundary;
+        for(uint32_t j = media[i].first; j < media[i].first + media[i].count; j++)
+            boundary.add(cached_object(*file, header, medium_prims[j], materials));
+        shared_ptr<hittable> inner = boundary.objects.size() == 1
+            ? boundary.objects[0] : make_shared<hittable_list>(boundary);
+        s.world.add(make_shared<constant_medium>(inner, media[i].density, textures[media[i].tex]));
+    }
+    return true;
+}
+
+#endif // SCENE_CACHE_H
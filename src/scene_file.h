@@ -0,0 +1,631 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+#include "scenes.h"
+#include "parse_number.h"
+#include "obj_file.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Text scene files. Every statement is a keyword and its arguments, one statement per line, and
+// # starts a comment. Textures and materials are named and defined before use; objects are
+// added to the world, or to the innermost open block:
+//
+//   camera vfov 40 lookfrom 278 278 -800 lookat 278 278 0
+//   texture checks checker 0.32 0.2 0.3 0.1 0.9 0.9 0.9
+//   material white lambertian 0.73 0.73 0.73
+//   material ground lambertian checks
+//   sphere 0 -1000 0 1000 ground
+//   translate 265 0 295 {
+//       rotate_y 15 {
+//           box 0 0 0 165 330 165 white
+//       }
+//   }
+//
+// Wherever a texture is taken, three numbers give a solid color instead.
+//
+//   camera <key> <values> ...   aspect_ratio, image_width, samples_per_pixel, max_depth,
+//                               russian_roulette_depth, vfov, lookfrom, lookat, vup,
+//                               defocus_angle, focus_dist, background, seed, sample_lights (0/1),
+//                               sampler (independent, stratified, sobol or halton),
+//                               adaptive_threshold, adaptive_min_samples
+//   texture <name> solid <r g b> | checker <scale> <even> <odd> | image <file> | noise <scale>
+//   material <name> lambertian <texture> | metal <r g b> <fuzz> | dielectric <index>
+//                 | diffuse_light <texture> | isotropic <texture>
+//   sphere <center> <radius> <material>
+//   moving_sphere <center at time 0> <center at time 1> <radius> <material>
+//   quad <corner> <u> <v> <material>
+//   box <corner> <opposite corner> <material>
+//   mesh <file> <material>                      a Wavefront OBJ file, relative to the scene file
+//   group { ... }                               a hittable_list
+//   bvh [<option> <value>] ... { ... }          layout (tree, linear, wide4, wide8, packed),
+//                                               split (median, sah), sah_bins, max_leaf_size, simd
+//   translate <offset> { ... }
+//   rotate_y <degrees> { ... }
+//   constant_medium <density> <texture> { ... } the objects in the block are its boundary
+
+struct texture_desc {
+    // A texture as written in a scene file. Checkers refer to their two textures by number.
+    texture_kind kind = texture_kind::solid;
+    color albedo; // Solid color
+    double scale = 1; // Checker and noise scale
+    int even = -1, odd = -1;
+    std::string file; // Image file
+};
+
+struct material_desc {
+    material_kind kind = material_kind::lambertian;
+    int tex = -1; // Texture number of lambertian, diffuse_light and isotropic
+    color albedo; // Metal albedo
+    double param = 0; // Metal fuzz or dielectric refraction index
+};
+
+enum class block_kind { group, bvh, translate, rotate_y, constant_medium };
+
+struct block_desc {
+    block_kind kind = block_kind::group;
+    vec3 offset; // translate
+    double value = 0; // Angle of rotate_y, density of constant_medium
+    int tex = -1; // Texture number of constant_medium
+    bvh_options bvh;
+};
+
+class scene_builder {
+    // Receives the contents of a scene file as the parser reads them. Textures and materials
+    // are numbered in the order they are added, and objects go into the innermost open block.
+    // A builder can refuse an object or block by returning false with the reason in error.
+    public:
+        virtual ~scene_builder() = default;
+
+        virtual void add_texture(const texture_desc& desc) = 0;
+        virtual void add_material(const material_desc& desc) = 0;
+        virtual bool add_sphere(const point3& center, double radius, int mat) = 0;
+        virtual bool add_moving_sphere(const point3& center0, const point3& center1, double radius, int mat) = 0;
+        virtual bool add_quad(const point3& Q, const vec3& u, const vec3& v, int mat) = 0;
+        virtual bool add_box(const point3& a, const point3& b, int mat) = 0;
+        virtual bool add_mesh(const std::string& path, int mat) = 0;
+        virtual bool open_block(const block_desc& desc) = 0;
+        virtual bool close_block() = 0;
+
+        std::string error;
+};
+
+class scene_object_builder: public scene_builder {
+    // Builds the hittables of a scene file into a world
+    public:
+        explicit scene_object_builder(hittable_list& world): world(world) {}
+
+        void add_texture(const texture_desc& desc) override{
+            textures.push_back(make_texture(desc, textures));
+        }
+
+        void add_material(const material_desc& desc) override{
+            materials.push_back(make_material(desc, textures));
+        }
+
+        bool add_sphere(const point3& center, double radius, int mat) override{
+            add(make_shared<sphere>(center, radius, materials[mat]));
+            return true;
+        }
+
+        bool add_moving_sphere(const point3& center0, const point3& center1, double radius, int mat) override{
+            add(make_shared<sphere>(center0, center1, radius, materials[mat]));
+            return true;
+        }
+
+        bool add_quad(const point3& Q, const vec3& u, const vec3& v, int mat) override{
+            add(make_shared<quad>(Q, u, v, materials[mat]));
+            return true;
+        }
+
+        bool add_box(const point3& a, const point3& b, int mat) override{
+            add(box(a, b, materials[mat]));
+            return true;
+        }
+
+        bool add_mesh(const std::string& path, int mat) override{
+            shared_ptr<triangle_mesh> mesh;
+            if(!load_obj(path, materials[mat], mesh, error)) return false;
+            add(mesh);
+            return true;
+        }
+
+        bool open_block(const block_desc& desc) override{
+            blocks.push_back(block{desc, hittable_list()});
+            return true;
+        }
+
+        bool close_block() override{
+            block b = std::move(blocks.back());
+            blocks.pop_back();
+
+            // Transforms and media wrap a single object without the list around it
+            shared_ptr<hittable> inner = b.objects.objects.size() == 1
+                ? b.objects.objects[0] : make_shared<hittable_list>(b.objects);
+            switch(b.desc.kind){
+                case block_kind::group: add(make_shared<hittable_list>(b.objects)); break;
+                case block_kind::bvh: add(make_bvh(b.objects, b.desc.bvh)); break;
+                case block_kind::translate: add(make_shared<translate>(inner, b.desc.offset)); break;
+                case block_kind::rotate_y: add(make_shared<rotate_y>(inner, b.desc.value)); break;
+                case block_kind::constant_medium:
+                    add(make_shared<constant_medium>(inner, b.desc.value, textures[b.desc.tex]));
+                    break;
+            }
+            return true;
+        }
+
+        static shared_ptr<texture> make_texture(const texture_desc& desc, const std::vector<shared_ptr<texture>>& textures){
+            // textures holds the ones defined before, which a checker refers to
+            switch(desc.kind){
+                case texture_kind::solid: return make_shared<solid_color>(desc.albedo);
+                case texture_kind::checker: return make_shared<checker_texture>(desc.scale, textures[desc.even], textures[desc.odd]);
+                case texture_kind::image: return make_shared<image_texture>(desc.file.c_str());
+                case texture_kind::noise: return make_shared<noise_texture>(desc.scale);
+                case texture_kind::custom: break; // Scene files only name built-in textures
+            }
+            return nullptr;
+        }
+
+        static shared_ptr<material> make_material(const material_desc& desc, const std::vector<shared_ptr<texture>>& textures){
+            switch(desc.kind){
+                case material_kind::lambertian: return make_shared<lambertian>(textures[desc.tex]);
+                case material_kind::metal: return make_shared<metal>(desc.albedo, desc.param);
+                case material_kind::dielectric: return make_shared<dielectric>(desc.param);
+                case material_kind::diffuse_light: return make_shared<diffuse_light>(textures[desc.tex]);
+                case material_kind::isotropic: return make_shared<isotropic>(textures[desc.tex]);
+                case material_kind::custom: break;
+            }
+            return nullptr;
+        }
+
+    private:
+        struct block {
+            block_desc desc;
+            hittable_list objects;
+        };
+
+        hittable_list& world;
+        std::vector<block> blocks;
+        std::vector<shared_ptr<texture>> textures;
+        std::vector<shared_ptr<material>> materials;
+
+        void add(shared_ptr<hittable> object){
+            if(blocks.empty()) world.add(object);
+            else blocks.back().objects.add(object);
+        }
+};
+
+class scene_parser {
+    // Parses the text in one pass without building a token list, see parse_number for numbers
+    public:
+        scene_parser(const char* begin, const char* end, const std::string& source_name)
+            : p(begin), end(end), source(source_name) {}
+
+        bool parse(scene& s){
+            // Fills in s, or returns false with the location and reason in error()
+            scene_object_builder objects(s.world);
+            return parse(s.cam, objects);
+        }
+
+        bool parse(camera& cam, scene_builder& b){
+            // Sets the camera settings in cam and passes everything else to b
+            target = &cam;
+            builder = &b;
+            while(skip_blank()){
+                token keyword = word();
+                if(!statement(keyword)) return false;
+                skip_space();
+                if(p < end && *p != '\n')
+                    return fail("unexpected '" + word().str() + "' after " + keyword.str());
+            }
+            if(!blocks.empty()){
+                line = blocks.back().line;
+                return fail("block is not closed");
+            }
+            return true;
+        }
+
+        const std::string& error() const { return error_text; }
+
+    private:
+        struct token {
+            const char* text = nullptr;
+            size_t length = 0;
+
+            bool operator==(const char* s) const { return std::strlen(s) == length && std::memcmp(text, s, length) == 0; }
+            std::string str() const { return std::string(text, length); }
+        };
+
+        struct block {
+            int line; // Where the block was opened
+            int objects; // Statements added to it so far
+        };
+
+        const char* p;
+        const char* end;
+        std::string source;
+        int line = 1;
+        std::string error_text;
+
+        camera* target = nullptr;
+        scene_builder* builder = nullptr;
+        std::vector<block> blocks;
+        std::unordered_map<std::string, int> textures; // Texture numbers by name
+        std::unordered_map<std::string, int> materials;
+        int texture_count = 0;
+        int material_count = 0;
+
+        // Last material looked up, as consecutive objects usually share one
+        std::string last_material_name;
+        int last_material = -1;
+
+        bool fail(const std::string& message){
+            error_text = source + ":" + std::to_string(line) + ": " + message;
+            return false;
+        }
+
+        void skip_space(){
+            // Skips blanks and a comment up to, but not past, the end of the line
+            while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+            if(p < end && *p == '#')
+                while(p < end && *p != '\n') p++;
+        }
+
+        bool skip_blank(){
+            // Skips to the next statement, returns false at the end of the text
+            for(;;){
+                skip_space();
+                if(p < end && *p == '\n'){
+                    p++;
+                    line++;
+                    continue;
+                }
+                return p < end;
+            }
+        }
+
+        bool at_line_end(){
+            skip_space();
+            return p == end || *p == '\n';
+        }
+
+        token word(){
+            skip_space();
+            token t;
+            t.text = p;
+            while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+            t.length = size_t(p - t.text);
+            return t;
+        }
+
+        bool number(double& value){
+            skip_space();
+            const char* start = p;
+            if(!parse_number(p, end, value)){
+                p = start;
+                return fail("expected a number, got '" + word().str() + "'");
+            }
+            return true;
+        }
+
+        bool integer(int& value){
+            double d;
+            if(!number(d)) return false;
+            if(d != std::floor(d) || std::fabs(d) > 2147483647.0) return fail("expected an integer");
+            value = int(d);
+            return true;
+        }
+
+        template <typename T>
+        bool vector(basic_vec3<T>& v){
+            // Reads a point, direction or color
+            double x, y, z;
+            if(!number(x) || !number(y) || !number(z)) return false;
+            v = basic_vec3<T>(x, y, z);
+            return true;
+        }
+
+        bool name(token& t, const char* what){
+            t = word();
+            if(t.length == 0) return fail(std::string("expected ") + what);
+            return true;
+        }
+
+        bool starts_number(){
+            skip_space();
+            return p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.');
+        }
+
+        int add_texture(const texture_desc& desc){
+            builder->add_texture(desc);
+            return texture_count++;
+        }
+
+        bool texture_argument(int& tex){
+            // A texture name or an r g b solid color
+            if(starts_number()){
+                texture_desc desc;
+                if(!vector(desc.albedo)) return false;
+                tex = add_texture(desc);
+                return true;
+            }
+            token t;
+            if(!name(t, "a texture or color")) return false;
+            auto it = textures.find(t.str());
+            if(it == textures.end()) return fail("unknown texture '" + t.str() + "'");
+            tex = it->second;
+            return true;
+        }
+
+        bool material_argument(int& mat){
+            token t;
+            if(!name(t, "a material")) return false;
+            if(last_material >= 0 && t == last_material_name.c_str()){
+                mat = last_material;
+                return true;
+            }
+            auto it = materials.find(t.str());
+            if(it == materials.end()) return fail("unknown material '" + t.str() + "'");
+            last_material_name = it->first;
+            last_material = it->second;
+            mat = it->second;
+            return true;
+        }
+
+        std::string relative_path(const std::string& path) const{
+            // Paths in a scene file are relative to the directory it is in
+            size_t slash = source.find_last_of("/\\");
+            if(path.empty() || path[0] == '/' || path[0] == '\\' || slash == std::string::npos) return path;
+            return source.substr(0, slash + 1) + path;
+        }
+
+        bool added(bool ok){
+            // Counts an object the builder took, or reports why it didn't
+            if(!ok) return fail(builder->error);
+            if(!blocks.empty()) blocks.back().objects++;
+            return true;
+        }
+
+        bool open_block(const block_desc& desc){
+            if(!(word() == "{")) return fail("expected '{'");
+            if(!builder->open_block(desc)) return fail(builder->error);
+            blocks.push_back(block{line, 0});
+            return true;
+        }
+
+        bool close_block(){
+            if(blocks.empty()) return fail("'}' without an open block");
+            block b = blocks.back();
+            blocks.pop_back();
+            if(b.objects == 0){
+                line = b.line;
+                return fail("empty block");
+            }
+            return added(builder->close_block());
+        }
+
+        bool statement(const token& keyword){
+            if(keyword == "sphere"){
+                vec3 center;
+                double radius;
+                int mat;
+                if(!vector(center) || !number(radius) || !material_argument(mat)) return false;
+                return added(builder->add_sphere(center, radius, mat));
+            }
+            if(keyword == "quad"){
+                vec3 q, u, v;
+                int mat;
+                if(!vector(q) || !vector(u) || !vector(v) || !material_argument(mat)) return false;
+                return added(builder->add_quad(q, u, v, mat));
+            }
+            if(keyword == "box"){
+                vec3 a, b;
+                int mat;
+                if(!vector(a) || !vector(b) || !material_argument(mat)) return false;
+                return added(builder->add_box(a, b, mat));
+            }
+            if(keyword == "mesh"){
+                token file;
+                int mat;
+                if(!name(file, "an OBJ file") || !material_argument(mat)) return false;
+                return added(builder->add_mesh(relative_path(file.str()), mat));
+            }
+            if(keyword == "moving_sphere"){
+                vec3 center0, center1;
+                double radius;
+                int mat;
+                if(!vector(center0) || !vector(center1) || !number(radius) || !material_argument(mat)) return false;
+                return added(builder->add_moving_sphere(center0, center1, radius, mat));
+            }
+            if(keyword == "}") return close_block();
+            if(keyword == "material") return material_statement();
+            if(keyword == "texture") return texture_statement();
+            if(keyword == "camera") return camera_statement();
+            block_desc b;
+            if(keyword == "group"){
+                b.kind = block_kind::group;
+                return open_block(b);
+            }
+            if(keyword == "bvh") return bvh_statement();
+            if(keyword == "translate"){
+                b.kind = block_kind::translate;
+                return vector(b.offset) && open_block(b);
+            }
+            if(keyword == "rotate_y"){
+                b.kind = block_kind::rotate_y;
+                return number(b.value) && open_block(b);
+            }
+            if(keyword == "constant_medium"){
+                b.kind = block_kind::constant_medium;
+                return number(b.value) && texture_argument(b.tex) && open_block(b);
+            }
+            return fail("unknown statement '" + keyword.str() + "'");
+        }
+
+        bool texture_statement(){
+            token t, kind;
+            if(!name(t, "a texture name") || !name(kind, "a texture type")) return false;
+            texture_desc desc;
+            if(kind == "solid"){
+                if(!vector(desc.albedo)) return false;
+            } else if(kind == "checker"){
+                desc.kind = texture_kind::checker;
+                if(!number(desc.scale) || !texture_argument(desc.even) || !texture_argument(desc.odd)) return false;
+            } else if(kind == "image"){
+                desc.kind = texture_kind::image;
+                token file;
+                if(!name(file, "an image file")) return false;
+                desc.file = file.str();
+            } else if(kind == "noise"){
+                desc.kind = texture_kind::noise;
+                if(!number(desc.scale)) return false;
+            } else {
+                return fail("unknown texture type '" + kind.str() + "'");
+            }
+            textures[t.str()] = add_texture(desc);
+            return true;
+        }
+
+        bool material_statement(){
+            token t, kind;
+            if(!name(t, "a material name") || !name(kind, "a material type")) return false;
+            material_desc desc;
+            if(kind == "lambertian"){
+                if(!texture_argument(desc.tex)) return false;
+            } else if(kind == "metal"){
+                desc.kind = material_kind::metal;
+                if(!vector(desc.albedo) || !number(desc.param)) return false;
+            } else if(kind == "dielectric"){
+                desc.kind = material_kind::dielectric;
+                if(!number(desc.param)) return false;
+            } else if(kind == "diffuse_light"){
+                desc.kind = material_kind::diffuse_light;
+                if(!texture_argument(desc.tex)) return false;
+            } else if(kind == "isotropic"){
+                desc.kind = material_kind::isotropic;
+                if(!texture_argument(desc.tex)) return false;
+            } else {
+                return fail("unknown material type '" + kind.str() + "'");
+            }
+            builder->add_material(desc);
+            materials[t.str()] = material_count++;
+            last_material = -1;
+            return true;
+        }
+
+        bool camera_statement(){
+            camera& cam = *target;
+            do {
+                token key = word();
+                bool ok;
+                if(key == "aspect_ratio") ok = number(cam.aspect_ratio);
+                else if(key == "image_width") ok = integer(cam.image_width);
+                else if(key == "samples_per_pixel") ok = integer(cam.samples_per_pixel);
+                else if(key == "max_depth") ok = integer(cam.max_depth);
+                else if(key == "russian_roulette_depth") ok = integer(cam.russian_roulette_depth);
+                else if(key == "vfov") ok = number(cam.vfov);
+                else if(key == "lookfrom") ok = vector(cam.lookfrom);
+                else if(key == "lookat") ok = vector(cam.lookat);
+                else if(key == "vup") ok = vector(cam.vup);
+                else if(key == "defocus_angle") ok = number(cam.defocus_angle);
+                else if(key == "focus_dist") ok = number(cam.focus_dist);
+                else if(key == "background") ok = vector(cam.background);
+                else if(key == "adaptive_threshold") ok = number(cam.adaptive_threshold);
+                else if(key == "adaptive_min_samples") ok = integer(cam.adaptive_min_samples);
+                else if(key == "seed"){
+                    int seed;
+                    ok = integer(seed);
+                    cam.seed = uint64_t(seed);
+                } else if(key == "sample_lights"){
+                    int flag;
+                    ok = integer(flag);
+                    cam.sample_lights = flag != 0;
+                } else if(key == "sampler"){
+                    token type = word();
+                    ok = true;
+                    if(type == "independent") cam.sampling = sampler_type::independent;
+                    else if(type == "stratified") cam.sampling = sampler_type::stratified;
+                    else if(type == "sobol") cam.sampling = sampler_type::sobol;
+                    else if(type == "halton") cam.sampling = sampler_type::halton;
+                    else ok = fail("unknown sampler '" + type.str() + "'");
+                } else {
+                    ok = fail("unknown camera setting '" + key.str() + "'");
+                }
+                if(!ok) return false;
+            } while(!at_line_end());
+            return true;
+        }
+
+        bool bvh_statement(){
+            block_desc b;
+            b.kind = block_kind::bvh;
+            while(!at_line_end() && *p != '{'){
+                token key = word();
+                token value = word();
+                if(key == "layout"){
+                    if(value == "tree") b.bvh.layout = bvh_layout::tree;
+                    else if(value == "linear") b.bvh.layout = bvh_layout::linear;
+                    else if(value == "wide4") b.bvh.layout = bvh_layout::wide4;
+                    else if(value == "wide8") b.bvh.layout = bvh_layout::wide8;
+                    else if(value == "packed") b.bvh.layout = bvh_layout::packed;
+                    else return fail("unknown bvh layout '" + value.str() + "'");
+                } else if(key == "split"){
+                    if(value == "median") b.bvh.split = bvh_split::median;
+                    else if(value == "sah") b.bvh.split = bvh_split::sah;
+                    else return fail("unknown bvh split '" + value.str() + "'");
+                } else if(key == "simd"){
+                    if(value == "automatic") b.bvh.simd = simd_level::automatic;
+                    else if(value == "scalar") b.bvh.simd = simd_level::scalar;
+                    else if(value == "sse") b.bvh.simd = simd_level::sse;
+                    else if(value == "avx2") b.bvh.simd = simd_level::avx2;
+                    else return fail("unknown simd level '" + value.str() + "'");
+                } else if(key == "sah_bins" || key == "max_leaf_size"){
+                    char* number_end;
+                    std::string text = value.str();
+                    long n = std::strtol(text.c_str(), &number_end, 10);
+                    if(text.empty() || *number_end != '\0' || n < 1) return fail("expected a positive integer for " + key.str());
+                    if(key == "sah_bins") b.bvh.sah_bins = int(n);
+                    else b.bvh.max_leaf_size = int(n);
+                } else {
+                    return fail("unknown bvh option '" + key.str() + "'");
+                }
+            }
+            return open_block(b);
+        }
+};
+
+inline bool parse_scene(const std::string& text, const std::string& source_name, scene& s, std::string& error){
+    // Parses scene text into s; source_name only labels error messages
+    scene_parser parser(text.data(), text.data() + text.size(), source_name);
+    if(parser.parse(s)) return true;
+    error = parser.error();
+    return false;
+}
+
+inline bool read_text_file(const std::string& path, std::string& text, std::string& error){
+    std::ifstream in(path, std::ios::binary);
+    if(!in){
+        error = "cannot open " + path;
+        return false;
+    }
+    in.seekg(0, std::ios::end);
+    text.resize(size_t(in.tellg()));
+    in.seekg(0, std::ios::beg);
+    in.read(&text[0], std::streamsize(text.size()));
+    if(!in){
+        error = "cannot read " + path;
+        return false;
+    }
+    return true;
+}
+
+inline bool load_scene_file(const std::string& path, scene& s, std::string& error){
+    // Reads and parses a scene file, returns false with a message in error on failure
+    std::string text;
+    return read_text_file(path, text, error) && parse_scene(text, path, s, error);
+}
+
+#endif // SCENE_FILE_H
@@ -0,0 +1,97 @@
+#ifndef SIMD_H
+#define SIMD_H
+// Runtime SIMD kernel selection. The build targets the baseline instruction set, kernels using
+// newer instructions are compiled with per-function target attributes and only called after the
+// CPU has been checked for support.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define RT_X86 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#else
+    #define RT_X86 0
+#endif
+
+#include <cstdint>
+
+#if RT_X86 && (defined(__GNUC__) || defined(__clang__))
+    #define RT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+    #define RT_TARGET_AVX2
+#endif
+
+// Inlines every call made by a function, so kernels end up compiled for its target
+#if defined(__GNUC__) || defined(__clang__)
+    #define RT_FLATTEN __attribute__((flatten))
+#else
+    #define RT_FLATTEN
+#endif
+
+enum class simd_level {
+    automatic, // The widest level the CPU supports
+    scalar,    // Plain C++ loops
+    sse,       // 4 float lanes (baseline on x86-64)
+    avx2       // 8 float lanes
+};
+
+inline bool cpu_has_avx2(){
+#if RT_X86 && (defined(__GNUC__) || defined(__clang__))
+    static const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has_avx2;
+#elif RT_X86 && defined(_MSC_VER)
+    static const bool has_avx2 = []() {
+        int info[4];
+        __cpuid(info, 1);
+        bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (info[2] & (1 << 12))
+                            && ((_xgetbv(0) & 6) == 6);
+        __cpuidex(info, 7, 0);
+        return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+    }();
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+inline simd_level resolve_simd_level(simd_level requested){
+    // Maps automatic to the best supported level and lowers requests the CPU can't run
+    if(!RT_X86) return simd_level::scalar;
+    if(requested == simd_level::automatic || requested == simd_level::avx2)
+        return cpu_has_avx2() ? simd_level::avx2 : simd_level::sse;
+    return requested;
+}
+
+// Lane masks as returned by movemask: index of the lowest set bit (mask must not be 0) and the
+// number of set bits
+inline int lowest_bit(uint32_t mask){
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int lane = 0;
+    while(!(mask & (1u << lane))) lane++;
+    return lane;
+#endif
+}
+
+inline int bit_count(uint32_t mask){
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(mask);
+#else
+    int count = 0;
+    for(; mask; mask &= mask - 1) count++;
+    return count;
+#endif
+}
+
+inline const char* simd_level_name(simd_level level){
+    switch(level){
+        case simd_level::scalar: return "scalar";
+        case simd_level::sse: return "sse";
+        case simd_level::avx2: return "avx2";
+        default: return "auto";
+    }
+}
+
+#endif // SIMD_H
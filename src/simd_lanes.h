@@ -0,0 +1,191 @@
+#ifndef SIMD_LANES_H
+#define SIMD_LANES_H
+// Vectors of real for batch kernels. real_lanes<level> holds as many reals as one register of
+// that level: 1 for scalar, 16 bytes for sse and 32 for avx2, so 2/4 doubles or 4/8 floats.
+// Kernels are written once as templates over the lane type; comparisons return all-ones or
+// all-zero lanes that select() and mask_bits() consume. AVX2 members carry the target
+// attribute, so they inline into kernels compiled for it (see simd.h).
+
+#include "constants.h"
+#include "simd.h"
+
+template <simd_level Level>
+struct real_lanes;
+
+template <>
+struct real_lanes<simd_level::scalar> {
+    static const int width = 1;
+    real v;
+
+    real_lanes() {}
+    explicit real_lanes(real x): v(x) {}
+    static real_lanes load(const real* p) { return real_lanes(*p); }
+    void store(real* p) const { *p = v; }
+
+    friend real_lanes operator+(real_lanes a, real_lanes b) { return real_lanes(a.v + b.v); }
+    friend real_lanes operator-(real_lanes a, real_lanes b) { return real_lanes(a.v - b.v); }
+    friend real_lanes operator*(real_lanes a, real_lanes b) { return real_lanes(a.v * b.v); }
+    friend real_lanes operator/(real_lanes a, real_lanes b) { return real_lanes(a.v / b.v); }
+    friend real_lanes min(real_lanes a, real_lanes b) { return real_lanes(a.v < b.v ? a.v : b.v); }
+    friend real_lanes max(real_lanes a, real_lanes b) { return real_lanes(a.v > b.v ? a.v : b.v); }
+    friend real_lanes sqrt(real_lanes a) { return real_lanes(std::sqrt(a.v)); }
+    friend real_lanes abs(real_lanes a) { return real_lanes(std::fabs(a.v)); }
+    friend real_lanes copysign(real_lanes a, real_lanes b) { return real_lanes(std::copysign(a.v, b.v)); }
+
+    // Masks are kept as 0 or 1, the scalar build never needs bit patterns
+    friend real_lanes operator<(real_lanes a, real_lanes b) { return real_lanes(a.v < b.v); }
+    friend real_lanes operator<=(real_lanes a, real_lanes b) { return real_lanes(a.v <= b.v); }
+    friend real_lanes operator&(real_lanes a, real_lanes b) { return real_lanes(a.v * b.v); }
+    friend real_lanes operator|(real_lanes a, real_lanes b) { return real_lanes(a.v + b.v != 0); }
+    friend real_lanes select(real_lanes mask, real_lanes a, real_lanes b) { return mask.v != 0 ? a : b; }
+    friend int mask_bits(real_lanes mask) { return mask.v != 0; }
+};
+
+#if RT_X86
+#ifdef RT_SINGLE_PRECISION
+
+template <>
+struct real_lanes<simd_level::sse> {
+    static const int width = 4;
+    __m128 v;
+
+    real_lanes() {}
+    real_lanes(__m128 x): v(x) {}
+    explicit real_lanes(real x): v(_mm_set1_ps(x)) {}
+    static real_lanes load(const real* p) { return _mm_load_ps(p); }
+    void store(real* p) const { _mm_storeu_ps(p, v); }
+
+    friend real_lanes operator+(real_lanes a, real_lanes b) { return _mm_add_ps(a.v, b.v); }
+    friend real_lanes operator-(real_lanes a, real_lanes b) { return _mm_sub_ps(a.v, b.v); }
+    friend real_lanes operator*(real_lanes a, real_lanes b) { return _mm_mul_ps(a.v, b.v); }
+    friend real_lanes operator/(real_lanes a, real_lanes b) { return _mm_div_ps(a.v, b.v); }
+    friend real_lanes min(real_lanes a, real_lanes b) { return _mm_min_ps(a.v, b.v); }
+    friend real_lanes max(real_lanes a, real_lanes b) { return _mm_max_ps(a.v, b.v); }
+    friend real_lanes sqrt(real_lanes a) { return _mm_sqrt_ps(a.v); }
+    friend real_lanes abs(real_lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+    friend real_lanes copysign(real_lanes a, real_lanes b) {
+        __m128 sign = _mm_set1_ps(-0.0f);
+        return _mm_or_ps(_mm_andnot_ps(sign, a.v), _mm_and_ps(sign, b.v));
+    }
+
+    friend real_lanes operator<(real_lanes a, real_lanes b) { return _mm_cmplt_ps(a.v, b.v); }
+    friend real_lanes operator<=(real_lanes a, real_lanes b) { return _mm_cmple_ps(a.v, b.v); }
+    friend real_lanes operator&(real_lanes a, real_lanes b) { return _mm_and_ps(a.v, b.v); }
+    friend real_lanes operator|(real_lanes a, real_lanes b) { return _mm_or_ps(a.v, b.v); }
+    friend real_lanes select(real_lanes mask, real_lanes a, real_lanes b) {
+        return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+    }
+    friend int mask_bits(real_lanes mask) { return _mm_movemask_ps(mask.v); }
+};
+
+template <>
+struct real_lanes<simd_level::avx2> {
+    static const int width = 8;
+    __m256 v;
+
+    RT_TARGET_AVX2 real_lanes() {}
+    RT_TARGET_AVX2 real_lanes(__m256 x): v(x) {}
+    RT_TARGET_AVX2 explicit real_lanes(real x): v(_mm256_set1_ps(x)) {}
+    RT_TARGET_AVX2 static real_lanes load(const real* p) { return _mm256_load_ps(p); }
+    RT_TARGET_AVX2 void store(real* p) const { _mm256_storeu_ps(p, v); }
+
+    RT_TARGET_AVX2 friend real_lanes operator+(real_lanes a, real_lanes b) { return _mm256_add_ps(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes operator-(real_lanes a, real_lanes b) { return _mm256_sub_ps(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes operator*(real_lanes a, real_lanes b) { return _mm256_mul_ps(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes operator/(real_lanes a, real_lanes b) { return _mm256_div_ps(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes min(real_lanes a, real_lanes b) { return _mm256_min_ps(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes max(real_lanes a, real_lanes b) { return _mm256_max_ps(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes sqrt(real_lanes a) { return _mm256_sqrt_ps(a.v); }
+    RT_TARGET_AVX2 friend real_lanes abs(real_lanes a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    RT_TARGET_AVX2 friend real_lanes copysign(real_lanes a, real_lanes b) {
+        __m256 sign = _mm256_set1_ps(-0.0f);
+        return _mm256_or_ps(_mm256_andnot_ps(sign, a.v), _mm256_and_ps(sign, b.v));
+    }
+
+    RT_TARGET_AVX2 friend real_lanes operator<(real_lanes a, real_lanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    RT_TARGET_AVX2 friend real_lanes operator<=(real_lanes a, real_lanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    RT_TARGET_AVX2 friend real_lanes operator&(real_lanes a, real_lanes b) { return _mm256_and_ps(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes operator|(real_lanes a, real_lanes b) { return _mm256_or_ps(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes select(real_lanes mask, real_lanes a, real_lanes b) {
+        return _mm256_blendv_ps(b.v, a.v, mask.v);
+    }
+    RT_TARGET_AVX2 friend int mask_bits(real_lanes mask) { return _mm256_movemask_ps(mask.v); }
+};
+
+#else
+
+template <>
+struct real_lanes<simd_level::sse> {
+    static const int width = 2;
+    __m128d v;
+
+    real_lanes() {}
+    real_lanes(__m128d x): v(x) {}
+    explicit real_lanes(real x): v(_mm_set1_pd(x)) {}
+    static real_lanes load(const real* p) { return _mm_load_pd(p); }
+    void store(real* p) const { _mm_storeu_pd(p, v); }
+
+    friend real_lanes operator+(real_lanes a, real_lanes b) { return _mm_add_pd(a.v, b.v); }
+    friend real_lanes operator-(real_lanes a, real_lanes b) { return _mm_sub_pd(a.v, b.v); }
+    friend real_lanes operator*(real_lanes a, real_lanes b) { return _mm_mul_pd(a.v, b.v); }
+    friend real_lanes operator/(real_lanes a, real_lanes b) { return _mm_div_pd(a.v, b.v); }
+    friend real_lanes min(real_lanes a, real_lanes b) { return _mm_min_pd(a.v, b.v); }
+    friend real_lanes max(real_lanes a, real_lanes b) { return _mm_max_pd(a.v, b.v); }
+    friend real_lanes sqrt(real_lanes a) { return _mm_sqrt_pd(a.v); }
+    friend real_lanes abs(real_lanes a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a.v); }
+    friend real_lanes copysign(real_lanes a, real_lanes b) {
+        __m128d sign = _mm_set1_pd(-0.0);
+        return _mm_or_pd(_mm_andnot_pd(sign, a.v), _mm_and_pd(sign, b.v));
+    }
+
+    friend real_lanes operator<(real_lanes a, real_lanes b) { return _mm_cmplt_pd(a.v, b.v); }
+    friend real_lanes operator<=(real_lanes a, real_lanes b) { return _mm_cmple_pd(a.v, b.v); }
+    friend real_lanes operator&(real_lanes a, real_lanes b) { return _mm_and_pd(a.v, b.v); }
+    friend real_lanes operator|(real_lanes a, real_lanes b) { return _mm_or_pd(a.v, b.v); }
+    friend real_lanes select(real_lanes mask, real_lanes a, real_lanes b) {
+        return _mm_or_pd(_mm_and_pd(mask.v, a.v), _mm_andnot_pd(mask.v, b.v));
+    }
+    friend int mask_bits(real_lanes mask) { return _mm_movemask_pd(mask.v); }
+};
+
+template <>
+struct real_lanes<simd_level::avx2> {
+    static const int width = 4;
+    __m256d v;
+
+    RT_TARGET_AVX2 real_lanes() {}
+    RT_TARGET_AVX2 real_lanes(__m256d x): v(x) {}
+    RT_TARGET_AVX2 explicit real_lanes(real x): v(_mm256_set1_pd(x)) {}
+    RT_TARGET_AVX2 static real_lanes load(const real* p) { return _mm256_load_pd(p); }
+    RT_TARGET_AVX2 void store(real* p) const { _mm256_storeu_pd(p, v); }
+
+    RT_TARGET_AVX2 friend real_lanes operator+(real_lanes a, real_lanes b) { return _mm256_add_pd(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes operator-(real_lanes a, real_lanes b) { return _mm256_sub_pd(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes operator*(real_lanes a, real_lanes b) { return _mm256_mul_pd(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes operator/(real_lanes a, real_lanes b) { return _mm256_div_pd(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes min(real_lanes a, real_lanes b) { return _mm256_min_pd(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes max(real_lanes a, real_lanes b) { return _mm256_max_pd(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes sqrt(real_lanes a) { return _mm256_sqrt_pd(a.v); }
+    RT_TARGET_AVX2 friend real_lanes abs(real_lanes a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v); }
+    RT_TARGET_AVX2 friend real_lanes copysign(real_lanes a, real_lanes b) {
+        __m256d sign = _mm256_set1_pd(-0.0);
+        return _mm256_or_pd(_mm256_andnot_pd(sign, a.v), _mm256_and_pd(sign, b.v));
+    }
+
+    RT_TARGET_AVX2 friend real_lanes operator<(real_lanes a, real_lanes b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+    RT_TARGET_AVX2 friend real_lanes operator<=(real_lanes a, real_lanes b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+    RT_TARGET_AVX2 friend real_lanes operator&(real_lanes a, real_lanes b) { return _mm256_and_pd(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes operator|(real_lanes a, real_lanes b) { return _mm256_or_pd(a.v, b.v); }
+    RT_TARGET_AVX2 friend real_lanes select(real_lanes mask, real_lanes a, real_lanes b) {
+        return _mm256_blendv_pd(b.v, a.v, mask.v);
+    }
+    RT_TARGET_AVX2 friend int mask_bits(real_lanes mask) { return _mm256_movemask_pd(mask.v); }
+};
+
+#endif // RT_SINGLE_PRECISION
+#endif // RT_X86
+
+// Lanes of the widest level, which sets the block size of SIMD primitive storage
+const int real_block_width = 32 / int(sizeof(real));
+
+#endif // SIMD_LANES_H
@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material.h"
 #include "vec3.h"
 # include "interval.h"
 class sphere : public hittable {
@@ -24,37 +25,107 @@ class sphere : public hittable {
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
             point3 curr_center = center.at(r.time());
-            vec3 oc = curr_center - r.origin();
-            auto a = r.direction().length_squared();
-            auto h = dot(r.direction(), (oc));
-            auto c = oc.length_squared() - radius * radius;
-            auto discriminant = h * h - a * c;
-                if (discriminant < 0) {
-                    return false; // No intersection
-                } 
-                auto sqrtd = std::sqrt(discriminant);
+            real near, far;
+            if (!intersect(curr_center, radius, r, near, far)) {
+                return false; // No intersection
+            }
 
                 //Calculate nearest root in acceptable range
-                auto root = (h - sqrtd) / a;
+                auto root = near;
                 if (!ray_t.surrounds(root)) {
-                    root = (h + sqrtd) / a;
+                    root = far;
                     if (!ray_t.surrounds(root)) {
                         return false; // No valid intersection
                     }
                 }
-                rec.t = root;
-                rec.p = r.at(rec.t);
-                rec.mat = mat; 
-                vec3 outward_normal = (rec.p - curr_center) / radius; 
-                rec.set_face_normal(r, outward_normal); 
-                get_sphere_uv(outward_normal, rec.u, rec.v); 
+                set_hit_record(curr_center, radius, mat.get(), r, root, rec);
                 return true; 
             
         }
         
+        bool occluded(const ray& r, interval ray_t) const override{
+            // Either root inside the interval occludes, no hit point or normal needed
+            real near, far;
+            if (!intersect(center.at(r.time()), radius, r, near, far)) return false;
+            return ray_t.surrounds(near) || ray_t.surrounds(far);
+        }
+
+        static bool intersect(const point3& center, real radius, const ray& r, real& near, real& far){
+            // Both roots of |origin + t dir - center| = radius, near <= far. The discriminant
+            // comes from the distance between the center and the line rather than as h^2 - ac,
+            // and the smaller root from the product of the roots, which avoids the cancellations
+            // that lose most of the bits on large or distant spheres (Haines et al.,
+            // Ray Tracing Gems, chapter 7).
+            vec3 oc = center - r.origin();
+            auto a = r.direction().length_squared();
+            auto h = dot(r.direction(), oc);
+            vec3 to_line = (h / a) * r.direction() - oc;
+            auto discriminant = a * (radius * radius - to_line.length_squared());
+            if (discriminant < 0) return false;
+
+            auto q = h + std::copysign(std::sqrt(discriminant), h);
+            auto c = oc.length_squared() - radius * radius;
+            near = q / a;
+            far = c / q;
+            if (near > far) std::swap(near, far);
+            return true;
+        }
+
+        static void set_hit_record(const point3& center, real radius, const material* mat, const ray& r, real t, hit_record& rec){
+            rec.t = t;
+            // The hit point is projected back onto the sphere, which leaves it with the
+            // rounding error of the sphere's coordinates rather than of the ray's
+            vec3 outward_normal = unit_vector(r.at(t) - center);
+            rec.p = center + radius * outward_normal;
+            rec.scale = max_abs(center) + radius;
+            rec.mat = mat;
+            rec.set_face_normal(r, outward_normal);
+            get_sphere_uv(outward_normal, rec.u, rec.v);
+        }
+
         aabb bounding_box() const override {return bbox;}
 
-        void get_sphere_uv(const point3& p, double& u, double& v) const {
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            // Directions are sampled uniformly in the cone the sphere subtends from origin, or
+            // over the whole sphere of directions when origin is inside. Moving spheres are
+            // sampled at their time 0 position.
+            hit_record rec;
+            if(!this->hit(ray(origin, direction), interval(0, infinity), rec))
+                return 0;
+
+            auto distance_squared = (center.at(0) - origin).length_squared();
+            if(distance_squared <= radius * radius)
+                return 1 / (4 * pi);
+
+            auto cos_theta_max = std::sqrt(1 - radius * radius / distance_squared);
+            auto solid_angle = 2 * pi * (1 - cos_theta_max);
+            return 1 / solid_angle;
+        }
+
+        vec3 random(const point3& origin) const override {
+            vec3 direction = center.at(0) - origin;
+            auto distance_squared = direction.length_squared();
+            if(distance_squared <= radius * radius)
+                return random_unit_vector();
+
+            // Uniform direction in the cone, expressed in a basis whose z axis points at the center
+            auto r1 = random_double();
+            auto r2 = random_double();
+            auto z = 1 + r2 * (std::sqrt(1 - radius * radius / distance_squared) - 1);
+            auto phi = 2 * pi * r1;
+            auto x = std::cos(phi) * std::sqrt(1 - z * z);
+            auto y = std::sin(phi) * std::sqrt(1 - z * z);
+
+            vec3 axis_w = unit_vector(direction);
+            vec3 a = (std::fabs(axis_w.x()) > 0.9) ? vec3(0,1,0) : vec3(1,0,0);
+            vec3 axis_v = unit_vector(cross(axis_w, a));
+            vec3 axis_u = cross(axis_w, axis_v);
+            return x * axis_u + y * axis_v + z * axis_w;
+        }
+
+        bool is_emissive() const override { return mat->is_emissive(); }
+
+        static void get_sphere_uv(const point3& p, double& u, double& v) {
             // p: a point on the sphere of radius one, centered at the origin.
             // u: returned value [0,1] of angle around the Y axis from X=-1.
             // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -67,8 +138,10 @@ class sphere : public hittable {
         }
 
     private:
+        friend class packed_bvh; // Copies spheres into its arrays
+
         ray center;
-        double radius;
+        real radius;
         shared_ptr<material> mat; // Pointer to the material of the sphere
         aabb bbox;
 };
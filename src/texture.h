@@ -4,21 +4,32 @@
 #include "rt_stb_image.h"
 #include "perlin.h"
 
+// The built-in textures, and custom for the ones deriving from custom_texture
+enum class texture_kind : uint32_t { solid, checker, image, noise, custom };
+
 class texture{
+    // Textures are told apart by their kind, and value() switches over the built-in ones, so a
+    // lookup is a direct call the compiler can inline instead of a virtual one. Textures beyond
+    // those derive from custom_texture and are reached through its virtual value().
     public:
+    const texture_kind kind;
+
     virtual ~texture() = default;
 
-    virtual color value(double u, double v, const point3& p) const = 0;
+    color value(double u, double v, const point3& p) const;
+
+    protected:
+    explicit texture(texture_kind kind) : kind(kind) {}
 };
 
 class solid_color: public texture{
     public:
-    solid_color(const color& albedo): albedo(albedo) {}
+    solid_color(const color& albedo): texture(texture_kind::solid), albedo(albedo) {}
 
     solid_color(double red, double green, double blue)
         : solid_color(color(red, green, blue)) {}
 
-    color value(double u, double v, const point3& p) const override{
+    color value(double u, double v, const point3& p) const{
         return albedo;
     }
 
@@ -26,42 +37,64 @@ class solid_color: public texture{
     color albedo;
 };
 
+class texture_ref{
+    // A texture as materials and checkers hold it: a solid color by value, which saves the
+    // pointer chase for the most common texture, and any other shared
+    public:
+    texture_ref(const color& albedo): albedo(albedo) {}
+
+    texture_ref(shared_ptr<texture> tex): tex(std::move(tex)) {
+        if(this->tex && this->tex->kind == texture_kind::solid){
+            albedo = static_cast<const solid_color&>(*this->tex).value(0, 0, point3());
+            this->tex.reset();
+        }
+    }
+
+    color value(double u, double v, const point3& p) const{
+        return tex ? tex->value(u, v, p) : albedo;
+    }
+
+    private:
+    color albedo;
+    shared_ptr<texture> tex; // Null for solid colors
+};
+
 class checker_texture: public texture{
     public:
     checker_texture(double scale, shared_ptr<texture> even, shared_ptr<texture> odd)
-        : inv_scale(1.0/scale), even(even), odd(odd) {}
+        : texture(texture_kind::checker), inv_scale(1.0/scale), even(std::move(even)), odd(std::move(odd)) {}
 
     checker_texture(double scale, const color& c1, const color& c2)
-        : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
+        : texture(texture_kind::checker), inv_scale(1.0/scale), even(c1), odd(c2) {}
 
-    color value(double u, double v, const point3& p) const override{
+    color value(double u, double v, const point3& p) const{
         auto xInteger = int(std::floor(p.x() * inv_scale));
         auto yInteger = int(std::floor(p.y() * inv_scale));
         auto zInteger = int(std::floor(p.z() * inv_scale));
 
         bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
 
-        return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+        return isEven ? even.value(u, v, p) : odd.value(u, v, p);
     }
 
     private:
     double inv_scale;
-    shared_ptr<texture> even;
-    shared_ptr<texture> odd;
+    texture_ref even;
+    texture_ref odd;
 
 };
 
 class image_texture: public texture {
     public:
-        image_texture(const char* filename) : image(filename) {}
+        image_texture(const char* filename) : texture(texture_kind::image), image(filename) {}
 
-    color value(double u, double v, const point3& p) const override{ 
+    color value(double u, double v, const point3& p) const{
         // If no image data, return pure cyan for debugging
         if(image.width() == 0 || image.height() == 0) return color(0, 1, 1);
 
         // Clamp u,v to [0,1]
         u = interval(0,1).clamp(u);
-        v = 1.0 - interval(0,1).clamp(v); 
+        v = 1.0 - interval(0,1).clamp(v);
 
         auto i = int(u * image.width());
         auto j = int(v * image.height());
@@ -78,14 +111,32 @@ class image_texture: public texture {
 
 class noise_texture: public texture {
     public:
-        noise_texture(double scale) : scale(scale) {}
+        noise_texture(double scale) : texture(texture_kind::noise), scale(scale) {}
 
-        color value(double u, double v, const point3& p) const override {
-            return color(0.5,0.5,0.5) * (1 + sin(scale * p.z() + 10 * noise.turb(p, 7))); 
+        color value(double u, double v, const point3& p) const {
+            return color(0.5,0.5,0.5) * (1 + sin(scale * p.z() + 10 * noise.turb(p, 7)));
         }
     private:
         perlin noise;
         double scale;
 };
 
-#endif
\ No newline at end of file
+class custom_texture: public texture {
+    // Base of textures other than the built-in ones, which implement value()
+    public:
+        custom_texture() : texture(texture_kind::custom) {}
+
+        virtual color value(double u, double v, const point3& p) const = 0;
+};
+
+inline color texture::value(double u, double v, const point3& p) const{
+    switch(kind){
+        case texture_kind::solid: return static_cast<const solid_color*>(this)->value(u, v, p);
+        case texture_kind::checker: return static_cast<const checker_texture*>(this)->value(u, v, p);
+        case texture_kind::image: return static_cast<const image_texture*>(this)->value(u, v, p);
+        case texture_kind::noise: return static_cast<const noise_texture*>(this)->value(u, v, p);
+        default: return static_cast<const custom_texture*>(this)->value(u, v, p);
+    }
+}
+
+#endif
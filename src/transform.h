@@ -0,0 +1,125 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include <cmath>
+
+class affine_transform {
+    // A 4x4 affine transform, of which only the top three rows are stored since the last one is
+    // always 0 0 0 1: p' = M p + t with m[i][3] holding t
+    public:
+        double m[3][4];
+
+        affine_transform(){
+            for(int i = 0; i < 3; i++)
+                for(int j = 0; j < 4; j++)
+                    m[i][j] = i == j ? 1 : 0;
+        }
+
+        static affine_transform translation(const vec3& offset){
+            affine_transform a;
+            for(int i = 0; i < 3; i++) a.m[i][3] = offset[i];
+            return a;
+        }
+
+        static affine_transform scaling(const vec3& factors){
+            affine_transform a;
+            for(int i = 0; i < 3; i++) a.m[i][i] = factors[i];
+            return a;
+        }
+
+        static affine_transform rotation(const vec3& axis, double degrees){
+            // Counterclockwise rotation about axis when looking down it (Rodrigues' formula)
+            vec3 k = unit_vector(axis);
+            double radians = degrees_to_radians(degrees);
+            double c = std::cos(radians), s = std::sin(radians), t = 1 - c;
+            affine_transform a;
+            a.m[0][0] = t * k.x() * k.x() + c;
+            a.m[0][1] = t * k.x() * k.y() - s * k.z();
+            a.m[0][2] = t * k.x() * k.z() + s * k.y();
+            a.m[1][0] = t * k.x() * k.y() + s * k.z();
+            a.m[1][1] = t * k.y() * k.y() + c;
+            a.m[1][2] = t * k.y() * k.z() - s * k.x();
+            a.m[2][0] = t * k.x() * k.z() - s * k.y();
+            a.m[2][1] = t * k.y() * k.z() + s * k.x();
+            a.m[2][2] = t * k.z() * k.z() + c;
+            return a;
+        }
+
+        affine_transform operator*(const affine_transform& b) const{
+            // Applies b first, then this
+            affine_transform a;
+            for(int i = 0; i < 3; i++){
+                for(int j = 0; j < 4; j++){
+                    a.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+                    if(j == 3) a.m[i][j] += m[i][3];
+                }
+            }
+            return a;
+        }
+
+        double determinant() const{
+            return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                 - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                 + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        }
+
+        affine_transform inverse() const{
+            // The inverse of the linear part from its cofactors, then t' = -M^-1 t. The transform
+            // must not be singular.
+            affine_transform a;
+            double inv_det = 1 / determinant();
+            a.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+            a.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+            a.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+            a.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+            a.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+            a.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+            a.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+            a.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+            a.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+            for(int i = 0; i < 3; i++)
+                a.m[i][3] = -(a.m[i][0] * m[0][3] + a.m[i][1] * m[1][3] + a.m[i][2] * m[2][3]);
+            return a;
+        }
+
+        point3 point(const point3& p) const{
+            return point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                          m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                          m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+        }
+
+        vec3 vector(const vec3& v) const{
+            // Directions ignore the translation
+            return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                        m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                        m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+        }
+
+        vec3 transposed_vector(const vec3& v) const{
+            // Multiplies by the transposed linear part. Normals transform by the inverse
+            // transpose, so the inverse of a transform maps object normals to world with this.
+            return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                        m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                        m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+        }
+
+        aabb box(const aabb& b) const{
+            // Tight bounds of the transformed box: per output axis, each matrix entry picks the
+            // end of the input interval that minimizes or maximizes its term (Arvo)
+            interval out[3];
+            for(int i = 0; i < 3; i++){
+                double lo = m[i][3], hi = m[i][3];
+                for(int j = 0; j < 3; j++){
+                    const interval& in = b.axis_interval(j);
+                    double e = m[i][j] * in.min, f = m[i][j] * in.max;
+                    lo += std::fmin(e, f);
+                    hi += std::fmax(e, f);
+                }
+                out[i] = interval(lo, hi);
+            }
+            return aabb(out[0], out[1], out[2]);
+        }
+};
+
+#endif // TRANSFORM_H
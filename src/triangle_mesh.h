@@ -0,0 +1,198 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "hittable.h"
+#include "material.h"
+#include "linear_bvh.h"
+#include <cstdint>
+#include <vector>
+
+const uint32_t mesh_no_index = 0xffffffffu; // A triangle corner without a normal or uv
+
+struct mesh_data {
+    // Indexed triangles over shared vertex arrays. Each triangle has three position indices,
+    // and normal and uv indices are either empty or three per triangle like in an OBJ file,
+    // with mesh_no_index for corners that have none.
+    std::vector<point3> positions;
+    std::vector<vec3> normals;
+    std::vector<point2> uvs;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> normal_indices;
+    std::vector<uint32_t> uv_indices;
+
+    size_t triangle_count() const { return indices.size() / 3; }
+};
+
+class triangle_mesh: public hittable {
+    // A mesh with its own linear BVH over the triangles. The triangles are reordered so every
+    // leaf covers a contiguous range of them, and nothing is stored per triangle beyond its
+    // indices: the memory use is the vertex and index data plus the BVH nodes. Meshes aren't
+    // sampled as lights; emissive ones still glow where paths hit them.
+    public:
+        triangle_mesh(mesh_data data, shared_ptr<material> mat)
+            : mesh(std::move(data)), mat(mat) {
+            size_t count = mesh.triangle_count();
+            std::vector<aabb> bounds;
+            bounds.reserve(count);
+            for(size_t i = 0; i < count; i++){
+                const point3& p0 = mesh.positions[mesh.indices[3 * i]];
+                const point3& p1 = mesh.positions[mesh.indices[3 * i + 1]];
+                const point3& p2 = mesh.positions[mesh.indices[3 * i + 2]];
+                bounds.push_back(aabb(aabb(p0, p1), aabb(p2, p2)));
+            }
+
+            // Triangle tests are cheap next to node visits, so leaves are allowed to grow large.
+            // On a two million triangle heightfield this takes a third less memory than
+            // leaves of at most 4 and is a little faster (raytracer_bench mesh).
+            bvh_options options;
+            options.split = bvh_split::sah;
+            options.max_leaf_size = 16;
+            options.traversal_cost = 4.0;
+            bvh_builder builder(bounds, options);
+            std::vector<aabb>().swap(bounds);
+
+            bbox = builder.nodes.empty() ? aabb::empty : builder.nodes[0].bbox;
+            nodes.resize(builder.nodes.size());
+            flatten_bvh_nodes(builder, nodes.data());
+            reorder(mesh.indices, builder.prim_order);
+            reorder(mesh.normal_indices, builder.prim_order);
+            reorder(mesh.uv_indices, builder.prim_order);
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
+            if(nodes.empty()) return false;
+            return hit_subtree(0, r, ray_t, rec);
+        }
+
+        void hit_packet(ray_packet& packet, uint32_t active) const override{
+            if(nodes.empty()) return;
+            auto trace_single = [&](uint32_t node, int lane){
+                if(hit_subtree(node, packet.rays[lane], packet.lane_interval(lane), packet.recs[lane]))
+                    packet.record_hit(lane);
+            };
+            traverse_linear_bvh_packet(nodes.data(), packet, active, [&](uint32_t node, uint32_t mask){
+                for(; mask; mask &= mask - 1)
+                    trace_single(node, lowest_bit(mask));
+            }, trace_single);
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            if(nodes.empty()) return false;
+            return traverse_linear_bvh_any(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count){
+                real t, b1, b2;
+                for(uint32_t i = first; i < first + count; i++)
+                    if(intersect(i, r, ray_t, t, b1, b2)) return true;
+                return false;
+            });
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        size_t triangle_count() const { return mesh.triangle_count(); }
+
+        size_t memory_bytes() const{
+            // Bytes held by the vertex, index and node arrays
+            return mesh.positions.size() * sizeof(point3) + mesh.normals.size() * sizeof(vec3)
+                 + mesh.uvs.size() * sizeof(point2)
+                 + (mesh.indices.size() + mesh.normal_indices.size() + mesh.uv_indices.size()) * sizeof(uint32_t)
+                 + nodes.size() * sizeof(linear_bvh_node);
+        }
+
+    private:
+        mesh_data mesh;
+        shared_ptr<material> mat;
+        aligned_vector<linear_bvh_node> nodes;
+        aabb bbox;
+
+        bool hit_subtree(uint32_t root, const ray& r, interval ray_t, hit_record& rec) const{
+            return traverse_linear_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count, interval& t){
+                bool hit_leaf = false;
+                real b1 = 0, b2 = 0;
+                uint32_t closest = 0;
+                for(uint32_t i = first; i < first + count; i++){
+                    real tri_t, tri_b1, tri_b2;
+                    if(intersect(i, r, t, tri_t, tri_b1, tri_b2)){
+                        hit_leaf = true;
+                        t.max = tri_t;
+                        b1 = tri_b1;
+                        b2 = tri_b2;
+                        closest = i;
+                    }
+                }
+                // The hit record is only filled in for the closest triangle of the leaf
+                if(hit_leaf) fill_record(closest, r, t.max, b1, b2, rec);
+                return hit_leaf;
+            }, root);
+        }
+
+        static void reorder(std::vector<uint32_t>& corner_indices, const std::vector<uint32_t>& order){
+            // Puts the three corners of triangle order[i] at position i
+            if(corner_indices.empty()) return;
+            std::vector<uint32_t> sorted(corner_indices.size());
+            for(size_t i = 0; i < order.size(); i++)
+                for(int k = 0; k < 3; k++)
+                    sorted[3 * i + k] = corner_indices[3 * size_t(order[i]) + k];
+            corner_indices.swap(sorted);
+        }
+
+        bool intersect(uint32_t tri, const ray& r, const interval& ray_t, real& t, real& b1, real& b2) const{
+            // Moller-Trumbore: solves for the distance and the barycentric coordinates of the
+            // second and third corner at once. A ray in the triangle's plane has det == 0; nearly
+            // parallel ones get huge barycentrics and fail the range tests.
+            const point3& p0 = mesh.positions[mesh.indices[3 * tri]];
+            vec3 e1 = mesh.positions[mesh.indices[3 * tri + 1]] - p0;
+            vec3 e2 = mesh.positions[mesh.indices[3 * tri + 2]] - p0;
+
+            vec3 pvec = cross(r.direction(), e2);
+            real det = dot(e1, pvec);
+            if(det == 0) return false;
+            real inv_det = 1 / det;
+
+            vec3 tvec = r.origin() - p0;
+            b1 = dot(tvec, pvec) * inv_det;
+            if(!(b1 >= 0 && b1 <= 1)) return false;
+
+            vec3 qvec = cross(tvec, e1);
+            b2 = dot(r.direction(), qvec) * inv_det;
+            if(!(b2 >= 0 && b1 + b2 <= 1)) return false;
+
+            t = dot(e2, qvec) * inv_det;
+            return ray_t.surrounds(t);
+        }
+
+        void fill_record(uint32_t tri, const ray& r, real t, real b1, real b2, hit_record& rec) const{
+            const uint32_t* corners = &mesh.indices[3 * tri];
+            const point3& p0 = mesh.positions[corners[0]];
+            const point3& p1 = mesh.positions[corners[1]];
+            const point3& p2 = mesh.positions[corners[2]];
+            vec3 geometric_normal = cross(p1 - p0, p2 - p0);
+            real b0 = 1 - b1 - b2;
+
+            rec.t = t;
+            rec.p = b0 * p0 + b1 * p1 + b2 * p2; // In the triangle's plane up to its own rounding
+            rec.scale = 0;
+            rec.mat = mat.get();
+            // Interpolated vertex normals shade smoothly and say which side is outside, whatever
+            // the winding. Which side the ray is on still comes from the flat triangle.
+            vec3 normal = geometric_normal;
+            if(!mesh.normal_indices.empty() && mesh.normal_indices[3 * tri] != mesh_no_index){
+                const uint32_t* n = &mesh.normal_indices[3 * tri];
+                normal = b0 * mesh.normals[n[0]] + b1 * mesh.normals[n[1]] + b2 * mesh.normals[n[2]];
+                if(dot(normal, geometric_normal) < 0) geometric_normal = -geometric_normal;
+            }
+            normal = unit_vector(normal);
+            rec.front_face = dot(r.direction(), geometric_normal) < 0;
+            rec.normal = rec.front_face ? normal : -normal;
+
+            if(!mesh.uv_indices.empty() && mesh.uv_indices[3 * tri] != mesh_no_index){
+                const uint32_t* uv = &mesh.uv_indices[3 * tri];
+                rec.u = b0 * mesh.uvs[uv[0]].x + b1 * mesh.uvs[uv[1]].x + b2 * mesh.uvs[uv[2]].x;
+                rec.v = b0 * mesh.uvs[uv[0]].y + b1 * mesh.uvs[uv[1]].y + b2 * mesh.uvs[uv[2]].y;
+            } else {
+                rec.u = b1;
+                rec.v = b2;
+            }
+        }
+};
+
+#endif // TRIANGLE_MESH_H
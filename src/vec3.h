@@ -1,39 +1,47 @@
 #ifndef VEC3_H
 #define VEC3_H
 
-class vec3 {
+template <typename T>
+class basic_vec3 {
+    // Three components of type T: real for geometry (vec3, point3), double for colors, so
+    // radiance sums keep their precision in single-precision builds
     public:
-        double e[3];
-        vec3() : e{0, 0, 0} {}
-        vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+        using scalar = T;
 
-        double x() const { return e[0];}
-        double y() const { return e[1];}
-        double z() const { return e[2];}
+        T e[3];
+        basic_vec3() : e{0, 0, 0} {}
+        basic_vec3(T e0, T e1, T e2) : e{e0, e1, e2} {}
 
-        vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const {return e[i]; }
-        double& operator[](int i) { return e[i]; }
+        template <typename U>
+        explicit basic_vec3(const basic_vec3<U>& v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
-        vec3& operator+=(const vec3& v) {
+        T x() const { return e[0];}
+        T y() const { return e[1];}
+        T z() const { return e[2];}
+
+        basic_vec3 operator-() const { return basic_vec3(-e[0], -e[1], -e[2]); }
+        T operator[](int i) const {return e[i]; }
+        T& operator[](int i) { return e[i]; }
+
+        basic_vec3& operator+=(const basic_vec3& v) {
             e[0] += v.e[0];
             e[1] += v.e[1];
             e[2] += v.e[2];
             return *this;
         }
         
-        vec3& operator*=(double t){
+        basic_vec3& operator*=(T t){
             e[0] *= t;
             e[1] *= t;
             e[2] *= t;
             return *this;
         }
 
-        vec3& operator/=(double t) {
+        basic_vec3& operator/=(T t) {
             return *this *= 1/t;
         }
 
-        double length_squared() const { return e[0]*e[0] + e[1]*e[1] +e[2]*e[2];}
+        T length_squared() const { return e[0]*e[0] + e[1]*e[1] +e[2]*e[2];}
 
         bool near_zero() const {
             // Return true if the vector is close to zero in all dimensions.
@@ -42,51 +50,61 @@ class vec3 {
         }
 
 
-        static vec3 random() {
-            return vec3(random_double(), random_double(), random_double());
+        static basic_vec3 random() {
+            return basic_vec3(random_double(), random_double(), random_double());
         }
 
-        static vec3 random(double min, double max){
-            return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+        static basic_vec3 random(double min, double max){
+            return basic_vec3(random_double(min, max), random_double(min, max), random_double(min, max));
         }
 
-        double length() const { return std::sqrt(length_squared()); }
+        T length() const { return std::sqrt(length_squared()); }
 
 };
 
+using vec3 = basic_vec3<real>;
+
 // We use point3 as an alias for vec3
 using point3 = vec3;
 
-// Utility Functions
-inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
+// Utility Functions. Scalars are taken as the vector's own type, so they convert as they would
+// for a plain function instead of taking part in template deduction.
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const basic_vec3<T>& v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3& u, const vec3& v) { 
-    return vec3(v.e[0] + u.e[0], v.e[1] + u.e[1], v.e[2] + u.e[2]);
+template <typename T>
+inline basic_vec3<T> operator+(const basic_vec3<T>& u, const basic_vec3<T>& v) { 
+    return basic_vec3<T>(v.e[0] + u.e[0], v.e[1] + u.e[1], v.e[2] + u.e[2]);
     }
 
-inline vec3 operator-(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator-(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 // note:  t, vec3
-inline vec3 operator*(double t, const vec3& v){
-    return vec3(v.e[0] * t, v.e[1] * t, v.e[2] * t);
+template <typename T>
+inline basic_vec3<T> operator*(typename basic_vec3<T>::scalar t, const basic_vec3<T>& v){
+    return basic_vec3<T>(v.e[0] * t, v.e[1] * t, v.e[2] * t);
 }
 
-inline vec3 operator*(const vec3& u, const vec3& v){
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T>& u, const basic_vec3<T>& v){
+    return basic_vec3<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 // note:  vec3, t
-inline vec3 operator*(const vec3& v, double t){
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T>& v, typename basic_vec3<T>::scalar t){
     return t * v;
 }
 
-inline vec3 operator/(const vec3& v, double t) {
+template <typename T>
+inline basic_vec3<T> operator/(const basic_vec3<T>& v, typename basic_vec3<T>::scalar t) {
     return (1/t) * v;
 }
 // dot product
-inline double dot(const vec3& u, const vec3& v){
+inline real dot(const vec3& u, const vec3& v){
     return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 
 }
@@ -102,7 +120,7 @@ inline vec3 reflect(const vec3& v, const vec3& n){
     return v - 2*dot(v,n)*n;
 }
 // refract vector uv around normal n with refractive index ratio etai_over_etat
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etet){
+inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etet){
     auto cos_theta = fmin(dot(-uv, n), 1.0);
     vec3 r_out_perp = etai_over_etet * (uv + cos_theta * n);
     vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
@@ -113,20 +131,69 @@ inline vec3 unit_vector(const vec3& v) {
     return v/v.length();
 }
 
+// largest absolute component
+inline real max_abs(const vec3& v){
+    return std::max(std::max(std::fabs(v.x()), std::fabs(v.y())), std::fabs(v.z()));
+}
+
+// Closed-form warps of a 2D sample in [0,1)^2. Each takes exactly one sample and has no data
+// dependent branches, so stratified and low-discrepancy samples keep their structure.
+
+inline void sin_cos(double phi, double& s, double& c){
+    // sin and cos of phi without calls into libm: phi is reduced to the nearest quarter turn
+    // and a remainder in [-pi/4, pi/4], where Taylor polynomials are accurate to ~1e-14, and
+    // the quadrant is applied arithmetically, as random quadrants would defeat branch prediction
+    double t = phi * (2 / pi);
+    int64_t q = int64_t(t + std::copysign(0.5, t)); // Rounds by truncation, floor() may be a call
+    double x = (t - double(q)) * (pi / 2);
+    double x2 = x * x;
+    double x4 = x2 * x2;
+    double x8 = x4 * x4;
+
+    // Estrin's scheme, which evaluates the terms in parallel instead of as one Horner chain
+    double sx = x * ((1 - x2 * (1.0 / 6)) + x4 * ((1.0 / 120) - x2 * (1.0 / 5040))
+              + x8 * (((1.0 / 362880) - x2 * (1.0 / 39916800)) + x4 * (1.0 / 6227020800)));
+    double cx = (1 - x2 * 0.5) + x4 * ((1.0 / 24) - x2 * (1.0 / 720))
+              + x8 * (((1.0 / 40320) - x2 * (1.0 / 3628800))
+                      + x4 * ((1.0 / 479001600) - x2 * (1.0 / 87178291200)));
+    int quadrant = int(q & 3);
+    double odd = double(quadrant & 1);
+    double a = odd * cx + (1 - odd) * sx;
+    double b = odd * sx + (1 - odd) * cx;
+    s = a * (1 - double(quadrant & 2));
+    c = b * (1 - double((quadrant + 1) & 2));
+}
+
+inline vec3 sample_unit_sphere(point2 u){
+    // Uniform direction: z uniform in [-1,1] (Archimedes) and a uniform azimuth
+    auto z = 1 - 2 * u.x;
+    auto r = std::sqrt(std::max(0.0, 1 - z * z));
+    double s, c;
+    sin_cos(2 * pi * u.y, s, c);
+    return vec3(r * c, r * s, z);
+}
+
+inline vec3 sample_concentric_disk(point2 u){
+    // Uniform point in the unit disk by Shirley and Chiu's concentric mapping, which takes
+    // squares around the center to rings and so keeps nearby samples nearby. The octant is
+    // blended in arithmetically, as the comparison is a coin flip for the branch predictor.
+    auto a = 2 * u.x - 1;
+    auto b = 2 * u.y - 1;
+    auto wide = double(std::fabs(a) > std::fabs(b));
+    auto r = wide * a + (1 - wide) * b;
+    auto ratio = (wide * b + (1 - wide) * a) / (r + double(r == 0));
+    auto phi = (pi / 4) * (wide * ratio + (1 - wide) * (2 - ratio));
+    double s, c;
+    sin_cos(phi, s, c);
+    return vec3(r * c, r * s, 0);
+}
+
 inline vec3 random_unit_vector(){
-    while (true){
-        auto p = vec3::random(-1, 1);
-        auto lensq = p.length_squared();
-        // Reject if outside unit sphere
-        if (1e-160 < lensq && lensq <= 1) return p/sqrt(lensq);
-    }
+    return sample_unit_sphere(sample_2d());
 }
 
 inline vec3 random_in_unit_disk(){
-    while (true){
-        auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-        if (p.length_squared() <= 1) return p;
-    }
+    return sample_concentric_disk(sample_2d());
 }
 
 
@@ -139,12 +206,4 @@ inline vec3 random_on_hemisphere(const vec3& normal){
 
 }
 
-inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() < 1)
-            return p;
-    }
-}
-
 #endif // VEC3_H
\ No newline at end of file
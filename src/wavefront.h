@@ -0,0 +1,126 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+// Queues of the wavefront integrator (camera::wavefront_size): the state of paths in flight,
+// batches of their rays in structure of arrays form, and the sort orders that make a batch
+// coherent for traversal and shading
+
+#include "aabb.h"
+#include "color.h"
+#include "hittable.h"
+#include "rng.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+struct path_state {
+    // What a path carries from one bounce to the next
+    color radiance = color(0,0,0);
+    color throughput = color(1,1,1);
+    double scatter_pdf = 0; // Density of the previous bounce's direction, 0 if it wasn't diffuse
+    point3 scatter_origin;
+};
+
+struct wavefront_path {
+    // One pixel sample between stages. Its generator is saved here while other paths run, so
+    // it draws the same numbers as when traced alone.
+    pcg32 rng;
+    uint64_t pixel_index;
+    int sample;
+    uint32_t tile; // Slot of the tile it belongs to
+    uint32_t tile_sample; // Index of its color in the tile's samples
+    int depth;
+    path_state state;
+    color light_sample; // Direct light added if the shadow ray gets through
+    hit_record rec;
+    bool found;
+};
+
+struct ray_queue {
+    // Rays waiting for a stage, each of one path and with t in [0, tmax]
+    std::vector<real> origin[3];
+    std::vector<real> direction[3];
+    std::vector<real> tmax;
+    std::vector<double> time;
+    std::vector<uint32_t> path;
+
+    size_t size() const { return path.size(); }
+
+    void clear(){
+        for(int axis = 0; axis < 3; axis++){
+            origin[axis].clear();
+            direction[axis].clear();
+        }
+        tmax.clear();
+        time.clear();
+        path.clear();
+    }
+
+    void push(const ray& r, real t_max, uint32_t path_index){
+        for(int axis = 0; axis < 3; axis++){
+            origin[axis].push_back(r.origin()[axis]);
+            direction[axis].push_back(r.direction()[axis]);
+        }
+        tmax.push_back(t_max);
+        time.push_back(r.time());
+        path.push_back(path_index);
+    }
+
+    ray get(size_t i) const{
+        // The ray as pushed, its inverse direction recomputed to the same values
+        return ray(point3(origin[0][i], origin[1][i], origin[2][i]),
+                   vec3(direction[0][i], direction[1][i], direction[2][i]), time[i]);
+    }
+};
+
+inline void radix_sort(const std::vector<uint32_t>& keys, int bits, std::vector<uint32_t>& order,
+                       std::vector<uint32_t>& scratch){
+    // Sets order to the indices of keys sorted by their low bits, a byte per pass. The sort is
+    // stable, so equal keys keep their queue order.
+    order.resize(keys.size());
+    scratch.resize(keys.size());
+    for(size_t i = 0; i < keys.size(); i++)
+        order[i] = uint32_t(i);
+    for(int shift = 0; shift < bits; shift += 8){
+        uint32_t start[257] = {};
+        for(uint32_t key : keys)
+            start[((key >> shift) & 0xff) + 1]++;
+        for(int digit = 0; digit < 256; digit++)
+            start[digit + 1] += start[digit];
+        for(uint32_t i : order)
+            scratch[start[(keys[i] >> shift) & 0xff]++] = i;
+        order.swap(scratch);
+    }
+}
+
+inline uint32_t spread_bits_4(uint32_t x){
+    // Moves the low 4 bits of x to every third bit, for interleaving three coordinates
+    x &= 0xf;
+    x = (x | (x << 4)) & 0x0c3;
+    x = (x | (x << 2)) & 0x249;
+    return x;
+}
+
+inline void bin_by_direction(const ray_queue& queue, const aabb& bounds, std::vector<uint32_t>& keys,
+                             std::vector<uint32_t>& order, std::vector<uint32_t>& scratch){
+    // Orders the queue by direction octant, then by origin along a Morton curve through a 16^3
+    // grid over bounds. Rays of one bin take the same child order at every node and start close
+    // together, so consecutive rays mostly visit the nodes just visited.
+    keys.resize(queue.size());
+    real scale[3];
+    for(int axis = 0; axis < 3; axis++){
+        const interval& extent = bounds.axis_interval(axis);
+        scale[axis] = extent.size() > 0 ? 16 / extent.size() : 0;
+    }
+    for(size_t i = 0; i < queue.size(); i++){
+        uint32_t octant = 0, morton = 0;
+        for(int axis = 0; axis < 3; axis++){
+            real cell = (queue.origin[axis][i] - bounds.axis_interval(axis).min) * scale[axis];
+            morton |= spread_bits_4(uint32_t(std::min(std::max(cell, real(0)), real(15)))) << axis;
+            octant |= uint32_t(queue.direction[axis][i] < 0) << axis;
+        }
+        keys[i] = octant << 12 | morton;
+    }
+    radix_sort(keys, 15, order, scratch);
+}
+
+#endif // WAVEFRONT_H
@@ -0,0 +1,351 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh_builder.h"
+#include "aligned_allocator.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+template <int Width>
+struct alignas(64) wide_bvh_node {
+    // Child boxes in structure of arrays form: rows are min x/y/z then max x/y/z, one lane per
+    // child, so one SIMD load fetches the same plane of every child.
+    float bounds[6][Width];
+    uint32_t child[Width]; // Interior children: node index. Leaf children: first entry of prim_indices.
+    uint16_t prim_count[Width]; // Number of primitives of leaf children, 0 for interior children
+    uint8_t child_count; // Children are packed into the first child_count lanes
+};
+
+struct wide_bvh_ray {
+    // A ray prepared for box tests: float origin, exact inverse direction and, per axis, the
+    // bounds rows of the near and far planes picked by the direction sign. A ray parallel to a
+    // slab and starting on one of its planes gets a NaN distance there, which the kernels drop
+    // by passing it as the first operand of max and min, leaving the interval unchanged.
+    float origin[3];
+    float inv_dir[3];
+    int near_row[3];
+    int far_row[3];
+    float tmin;
+    float tmax;
+};
+
+inline float wide_bvh_far_limit(double tmax){
+    // Rounds the far end of the ray interval up and pads it for the float rounding of the slab
+    // computation (3 operations, see PBRT's gamma(3) bound)
+    const float gamma3 = 3 * std::numeric_limits<float>::epsilon() * 0.5f;
+    return float_round_up(tmax) * (1 + 2 * gamma3);
+}
+
+inline wide_bvh_ray make_wide_bvh_ray(const ray& r, interval ray_t){
+    wide_bvh_ray wr;
+    for(int axis = 0; axis < 3; axis++){
+        bool neg = r.dir_is_neg(axis);
+        wr.origin[axis] = float(r.origin()[axis]);
+        wr.inv_dir[axis] = float(r.inv_direction()[axis]);
+        wr.near_row[axis] = neg ? axis + 3 : axis;
+        wr.far_row[axis] = neg ? axis : axis + 3;
+    }
+    wr.tmin = float_round_down(ray_t.min);
+    wr.tmax = wide_bvh_far_limit(ray_t.max);
+    return wr;
+}
+
+// Box test kernels. Each tests lanes [0, Width) of a node, writes the entry distance of every
+// lane to tnear and returns a bit mask of the lanes whose box the ray overlaps.
+
+template <int Width>
+inline int wide_box_hits_scalar(const wide_bvh_node<Width>& node, const wide_bvh_ray& r, float* tnear){
+    int mask = 0;
+    for(int lane = 0; lane < Width; lane++){
+        float t0 = r.tmin, t1 = r.tmax;
+        for(int axis = 0; axis < 3; axis++){
+            float near = (node.bounds[r.near_row[axis]][lane] - r.origin[axis]) * r.inv_dir[axis];
+            float far = (node.bounds[r.far_row[axis]][lane] - r.origin[axis]) * r.inv_dir[axis];
+            if(near > t0) t0 = near;
+            if(far < t1) t1 = far;
+        }
+        tnear[lane] = t0;
+        if(t0 <= t1) mask |= 1 << lane;
+    }
+    return mask;
+}
+
+#if RT_X86
+template <int Width>
+inline int wide_box_hits_sse(const wide_bvh_node<Width>& node, const wide_bvh_ray& r, float* tnear){
+    int mask = 0;
+    for(int lane = 0; lane < Width; lane += 4){
+        __m128 t0 = _mm_set1_ps(r.tmin);
+        __m128 t1 = _mm_set1_ps(r.tmax);
+        for(int axis = 0; axis < 3; axis++){
+            __m128 org = _mm_set1_ps(r.origin[axis]);
+            __m128 inv = _mm_set1_ps(r.inv_dir[axis]);
+            __m128 near = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[r.near_row[axis]][lane]), org), inv);
+            __m128 far = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[r.far_row[axis]][lane]), org), inv);
+            t0 = _mm_max_ps(near, t0);
+            t1 = _mm_min_ps(far, t1);
+        }
+        _mm_storeu_ps(tnear + lane, t0);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << lane;
+    }
+    return mask;
+}
+
+RT_TARGET_AVX2
+inline int wide_box_hits_avx2(const wide_bvh_node<8>& node, const wide_bvh_ray& r, float* tnear){
+    __m256 t0 = _mm256_set1_ps(r.tmin);
+    __m256 t1 = _mm256_set1_ps(r.tmax);
+    for(int axis = 0; axis < 3; axis++){
+        __m256 org = _mm256_set1_ps(r.origin[axis]);
+        __m256 inv = _mm256_set1_ps(r.inv_dir[axis]);
+        __m256 near = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.near_row[axis]]), org), inv);
+        __m256 far = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.far_row[axis]]), org), inv);
+        t0 = _mm256_max_ps(near, t0);
+        t1 = _mm256_min_ps(far, t1);
+    }
+    _mm256_storeu_ps(tnear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+template <int Width>
+class wide_bvh: public hittable {
+    // A BVH with Width (4 or 8) children per node, made by collapsing a binary BVH. All child
+    // boxes of a node are tested at once with the SIMD kernel picked at construction.
+    public:
+        static_assert(Width == 4 || Width == 8, "wide_bvh supports 4 and 8 children per node");
+
+        wide_bvh(const hittable_list& list, const bvh_options& options = bvh_options(), bvh_stats* stats = nullptr)
+            : objects(list.objects), level(resolve_simd_level(options.simd)) {
+            if(level == simd_level::avx2 && Width != 8) level = simd_level::sse;
+
+            std::vector<aabb> bounds;
+            bounds.reserve(objects.size());
+            for(const auto& object : objects)
+                bounds.push_back(object->bounding_box());
+
+            bvh_options build_options = options;
+            if(build_options.max_leaf_size > 0xffff) build_options.max_leaf_size = 0xffff;
+
+            bvh_builder builder(bounds, build_options);
+            if(stats) *stats = builder.stats();
+            prim_indices = builder.prim_order;
+            if(builder.nodes.empty()){
+                bbox = aabb::empty;
+                return;
+            }
+
+            bbox = builder.nodes[0].bbox;
+            collapse(builder, 0);
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
+            if(nodes.empty()) return false;
+#if RT_X86
+            if(level == simd_level::avx2) return hit_avx2<false>(r, ray_t, &rec);
+            if(level == simd_level::sse) return traverse<sse_kernel, false>(r, ray_t, &rec);
+#endif
+            return traverse<scalar_kernel, false>(r, ray_t, &rec);
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override{
+            if(nodes.empty()) return false;
+#if RT_X86
+            if(level == simd_level::avx2) return hit_avx2<true>(r, ray_t, nullptr);
+            if(level == simd_level::sse) return traverse<sse_kernel, true>(r, ray_t, nullptr);
+#endif
+            return traverse<scalar_kernel, true>(r, ray_t, nullptr);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        simd_level kernel() const { return level; }
+
+    private:
+        aligned_vector<wide_bvh_node<Width>> nodes;
+        std::vector<uint32_t> prim_indices; // Indices into objects, grouped by leaf
+        std::vector<shared_ptr<hittable>> objects;
+        simd_level level;
+        aabb bbox;
+
+        struct scalar_kernel {
+            static int hits(const wide_bvh_node<Width>& n, const wide_bvh_ray& r, float* tnear) {
+                return wide_box_hits_scalar<Width>(n, r, tnear);
+            }
+        };
+
+#if RT_X86
+        struct sse_kernel {
+            static int hits(const wide_bvh_node<Width>& n, const wide_bvh_ray& r, float* tnear) {
+                return wide_box_hits_sse<Width>(n, r, tnear);
+            }
+        };
+
+        struct avx2_kernel {
+            RT_TARGET_AVX2
+            static int hits(const wide_bvh_node<8>& n, const wide_bvh_ray& r, float* tnear) {
+                return wide_box_hits_avx2(n, r, tnear);
+            }
+        };
+
+        // Only the 8-wide tree has an AVX2 kernel; the 4-wide one never takes this path
+        template <bool AnyHit>
+        RT_TARGET_AVX2 RT_FLATTEN
+        bool hit_avx2(const ray& r, interval ray_t, hit_record* rec) const{
+            return traverse_avx2<AnyHit>(r, ray_t, rec, std::integral_constant<bool, Width == 8>());
+        }
+
+        template <bool AnyHit>
+        bool traverse_avx2(const ray& r, interval ray_t, hit_record* rec, std::true_type) const{
+            return traverse<avx2_kernel, AnyHit>(r, ray_t, rec);
+        }
+
+        template <bool AnyHit>
+        bool traverse_avx2(const ray& r, interval ray_t, hit_record* rec, std::false_type) const{
+            return traverse<sse_kernel, AnyHit>(r, ray_t, rec);
+        }
+#endif
+
+        template <typename Kernel, bool AnyHit>
+        bool traverse(const ray& r, interval ray_t, hit_record* rec) const{
+            // Closest hit search filling *rec, or with AnyHit an occlusion query that returns
+            // at the first primitive hit in the interval
+            wide_bvh_ray wr = make_wide_bvh_ray(r, ray_t);
+
+            struct entry {
+                uint32_t node;
+                float tnear;
+            };
+            entry stack[bvh_max_depth * Width];
+            int stack_size = 0;
+            stack[stack_size++] = entry{0, wr.tmin};
+            bool hit_anything = false;
+
+            while(stack_size > 0){
+                entry e = stack[--stack_size];
+                if(e.tnear > wr.tmax) continue; // A closer hit was found since the node was pushed
+                const auto& node = nodes[e.node];
+
+                alignas(32) float tnear[Width];
+                int mask = Kernel::hits(node, wr, tnear) & ((1 << node.child_count) - 1);
+                if(mask == 0) continue;
+
+                // Order the hit children near to far
+                int order[Width];
+                int hits = 0;
+                for(; mask; mask &= mask - 1){
+                    int lane = lowest_bit(mask);
+                    int k = hits++;
+                    while(k > 0 && tnear[order[k-1]] > tnear[lane]){
+                        order[k] = order[k-1];
+                        k--;
+                    }
+                    order[k] = lane;
+                }
+
+                // Intersect leaves right away, near first, then push interior children far
+                // first so the nearest is popped next
+                for(int k = 0; k < hits; k++){
+                    int lane = order[k];
+                    if(node.prim_count[lane] == 0 || tnear[lane] > wr.tmax) continue;
+                    uint32_t first = node.child[lane];
+                    for(uint32_t i = 0; i < node.prim_count[lane]; i++){
+                        const auto& object = objects[prim_indices[first + i]];
+                        if(AnyHit){
+                            if(object->occluded(r, ray_t)) return true;
+                        } else if(object->hit(r, ray_t, *rec)){
+                            hit_anything = true;
+                            ray_t.max = rec->t;
+                            wr.tmax = wide_bvh_far_limit(rec->t);
+                        }
+                    }
+                }
+                for(int k = hits - 1; k >= 0; k--){
+                    int lane = order[k];
+                    if(node.prim_count[lane] != 0 || tnear[lane] > wr.tmax) continue;
+                    stack[stack_size++] = entry{node.child[lane], tnear[lane]};
+                }
+            }
+
+            return hit_anything;
+        }
+
+        uint32_t collapse(const bvh_builder& builder, int binary_index){
+            // Turns the binary subtree at binary_index into wide nodes. Starting from the two
+            // children, the interior child with the largest surface area is replaced by its own
+            // children until the node is full.
+            uint32_t index = uint32_t(nodes.size());
+            nodes.emplace_back();
+
+            std::vector<int> children;
+            const auto& root = builder.nodes[binary_index];
+            if(root.is_leaf()){
+                children.push_back(binary_index);
+            } else {
+                children.push_back(binary_index + 1);
+                children.push_back(root.right);
+            }
+
+            while(int(children.size()) < Width){
+                int best = -1;
+                double best_area = -1;
+                for(int c = 0; c < int(children.size()); c++){
+                    const auto& child = builder.nodes[children[c]];
+                    if(child.is_leaf()) continue;
+                    double area = child.bbox.surface_area();
+                    if(area > best_area){
+                        best_area = area;
+                        best = c;
+                    }
+                }
+                if(best < 0) break;
+
+                int expanded = children[best];
+                children[best] = expanded + 1;
+                children.push_back(builder.nodes[expanded].right);
+            }
+
+            wide_bvh_node<Width> node;
+            for(int lane = 0; lane < Width; lane++){
+                for(int row = 0; row < 6; row++) node.bounds[row][lane] = 0;
+                node.child[lane] = 0;
+                node.prim_count[lane] = 0;
+            }
+            node.child_count = uint8_t(children.size());
+
+            for(int lane = 0; lane < int(children.size()); lane++){
+                const auto& child = builder.nodes[children[lane]];
+                set_lane_bounds(node, lane, child.bbox);
+                if(child.is_leaf()){
+                    node.child[lane] = child.first;
+                    node.prim_count[lane] = uint16_t(child.count);
+                } else {
+                    node.child[lane] = collapse(builder, children[lane]);
+                }
+            }
+
+            nodes[index] = node;
+            return index;
+        }
+
+        static void set_lane_bounds(wide_bvh_node<Width>& node, int lane, const aabb& box){
+            // Rounds outwards to float, then pads by a few float ulps of the coordinate magnitude
+            // to absorb rounding the ray origin to float during traversal
+            for(int axis = 0; axis < 3; axis++){
+                const interval& ax = box.axis_interval(axis);
+                double pad = 4 * std::numeric_limits<float>::epsilon() * std::max(std::fabs(ax.min), std::fabs(ax.max));
+                node.bounds[axis][lane] = float_round_down(ax.min - pad);
+                node.bounds[axis + 3][lane] = float_round_up(ax.max + pad);
+            }
+        }
+};
+
+#endif // WIDE_BVH_H